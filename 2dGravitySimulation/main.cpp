@@ -4,26 +4,47 @@
 #include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <stdexcept>
 #include <thread>
 #include <vector>
 
 #include "renderer.h"
+#include "pacer.h"
+#include "snapshot.h"
+#include "recorder.h"
+#include "replay.h"
 
 #define WINDOW_WIDTH 1000
 #define WINDOW_HEIGHT 800
 
-#define NUM_RECT_COLS 10
+#define NUM_RECT_COLS 10 // vector field arrows, computed and drawn on the GPU
 #define NUM_RECT_ROWS 10
 #define NUM_CIRCLES 2
-#define NUM_CIRCLE_SIDES 32
 #define CIRCLE_RADIUS 50.0f
 #define GRAVITY 900
 #define DT 0.7
 
 #define TARGET_FRAME_TIME 1.0 / 60.0
 
+// --gpu --bodies <n> : disk of n small bodies, simulated by the compute passes of the renderer
+#define DISK_RADIUS 350.0f
+#define DISK_TOTAL_MASS 200.0f
+#define DISK_BODY_RADIUS 1.5f
+#define DISK_SOFTENING 25.0f
+#define BH_THETA 0.5f // Barnes-Hut opening angle
+
+#define SNAPSHOT_PATH "gravity_snapshot.bin"
+
+#define CAMERA_ZOOM_STEP 1.03f // per frame while = / - is held
+#define CAMERA_MIN_ZOOM (1.0f / 64.0f)
+#define CAMERA_MAX_ZOOM 64.0f
+
 // -------- Rectangle object. Indicates net force --------
 std::vector<Vertex> rect_vertices = {
     {{-7.0f, -5.0f}},
@@ -34,36 +55,7 @@ std::vector<Vertex> rect_vertices = {
 std::vector<uint16_t> rect_indices = {0, 1, 2, 2, 3, 0}; // ccw order
 // ---------------------------------------------- //
 
-// ---------- Circle Object ---------------------------
-std::vector<Vertex> circle_vertices{};
-std::vector<uint16_t> circle_indices{};
-
-void createCircleObject(int n_sides) {
-  circle_vertices.clear();
-  circle_indices.clear();
-
-  float angle;
-  for (int i = 0; i < n_sides; i++) {
-    angle = glm::two_pi<float>() / n_sides * i;
-    circle_vertices.push_back({
-        {glm::cos(angle), glm::sin(angle)}
-    });
-  }
-
-  // add origin
-  uint16_t origin_idx = n_sides;
-  circle_vertices.push_back({{0.0f, 0.0f}}); // {1.0f, 0.0f, 0.0f}});
-
-  // generate index
-  for (int i = 0; i < n_sides; i++) {
-    circle_indices.push_back(origin_idx);        
-    circle_indices.push_back(i);                 
-    circle_indices.push_back((i + 1) % n_sides);
-  }
-}
-// ---------------------------------------------------
-
-enum ShapeType { SHAPE_TYPE_RECTANGLE = 0, SHAPE_TYPE_CIRCLE };
+enum ShapeType { SHAPE_TYPE_RECTANGLE = 0 };
 
 void initMeshBuffers(Renderer &renderer, Mesh &mesh, ShapeType shapeType) {
   switch (shapeType) {
@@ -76,14 +68,6 @@ void initMeshBuffers(Renderer &renderer, Mesh &mesh, ShapeType shapeType) {
     mesh.indexCount = rect_indices.size();
     break;
 
-  case SHAPE_TYPE_CIRCLE:
-    renderer.createVertexBuffer(&circle_vertices, mesh.vertexBuffer,
-                                mesh.vertexBufferMemory);
-    renderer.createIndexBuffer(&circle_indices, mesh.indexBuffer,
-                               mesh.indexBufferMemory);
-    mesh.indexCount = circle_indices.size();
-    break;
-
   default:
     throw std::runtime_error("Failed to initialize mesh buffers!");
   }
@@ -94,28 +78,6 @@ class GravitySystem {
 public:
   GravitySystem(float g, float dt) : gravity(g), dt(dt) {}
 
-  void initVectorFieldComponent(std::vector<RectObject> &rects,
-                                Renderer &renderer) {
-    const float width = static_cast<float>(renderer.imageExtent.width);
-    const float height = static_cast<float>(renderer.imageExtent.height);
-
-    const float dx = width / NUM_RECT_COLS;
-    const float dy = height / NUM_RECT_ROWS;
-
-    const float startX = -width * 0.5f + dx * 0.5f;
-    const float startY = -height * 0.5f + dy * 0.5f;
-
-    for (int row = 0; row < NUM_RECT_ROWS; row++) {
-      for (int col = 0; col < NUM_RECT_COLS; col++) {
-        int idx = row * NUM_RECT_COLS + col;
-
-        rects[idx].position = glm::vec2(startX + col * dx, startY + row * dy);
-
-        rects[idx].net_force = glm::vec2(0.0f);
-      }
-    }
-  }
-
   void initCircles(std::vector<CircleObject> &circles, Renderer &renderer) {
     const float width = static_cast<float>(renderer.imageExtent.width);
     const float height = static_cast<float>(renderer.imageExtent.height);
@@ -134,6 +96,28 @@ public:
     }
   }
 
+  // Rotating disk around the origin, each body on a roughly circular orbit of the mass inside it
+  void initDisk(std::vector<CircleObject> &circles) {
+    const float n = static_cast<float>(circles.size());
+    for (size_t i = 0; i < circles.size(); i++) {
+      // sqrt spreads the bodies evenly over the area, the golden angle keeps them apart
+      float r = DISK_RADIUS * sqrt((i + 0.5f) / n);
+      float angle = i * 2.39996323f;
+      glm::vec2 dir = glm::vec2(cos(angle), sin(angle));
+
+      float enclosed = DISK_TOTAL_MASS * (i + 1) / n;
+      float speed = sqrt(gravity * enclosed / r);
+
+      circles[i].position = dir * r;
+      circles[i].velocity = glm::vec2(-dir.y, dir.x) * speed;
+      circles[i].net_force = glm::vec2(0.0f);
+      circles[i].mass = DISK_TOTAL_MASS / n;
+      circles[i].radius = DISK_BODY_RADIUS;
+      circles[i].color = glm::mix(glm::vec3(1.0f, 0.9f, 0.6f),
+                                  glm::vec3(0.4f, 0.6f, 1.0f), r / DISK_RADIUS);
+    }
+  }
+
   // Initialize circles manually
   void initCircles2(std::vector<CircleObject> &circles, Renderer &renderer) {
     // const float width = static_cast<float>(renderer.imageExtent.width);
@@ -168,11 +152,9 @@ public:
 
   }
 
-  void update(Renderer &renderer, std::vector<RectObject> &rects,
-              std::vector<CircleObject> &circles) {
+  void update(std::vector<CircleObject> &circles) {
     updateCircle(circles);
     collision(circles);
-    updateVectorFieldComponent(rects, circles);
   }
 
 private:
@@ -211,25 +193,6 @@ private:
     }
   }
 
-  void updateVectorFieldComponent(std::vector<RectObject> &rects,
-                                  std::vector<CircleObject> &circles) {
-    for (RectObject &rect : rects) {
-      rect.net_force = glm::vec2(0.0f);
-      for (CircleObject &circle : circles) {
-        glm::vec2 r = circle.position - rect.position;
-
-        float len = glm::length(r);
-        float dist = len * len + 1e-6f; // softening
-        float invDist = glm::inversesqrt(dist);
-        glm::vec2 dir = r * invDist;
-
-        float force_mag = gravity * 1 * circle.mass * invDist * invDist;
-
-        rect.net_force += force_mag * dir;
-      }
-    }
-  }
-
   void collision(std::vector<CircleObject>& circles) {
     for (int i = 0; i < circles.size(); i++) {
         for (int j = i + 1; j < circles.size(); j++) {
@@ -263,62 +226,346 @@ private:
 };
 
 
+// -------- Camera. Left drag : pan, = / - : zoom in / out, C : reset --------
+struct CameraControl {
+  bool dragging = false;
+  double lastX = 0.0;
+  double lastY = 0.0;
 
-int main() {
+  void update(GLFWwindow *window, Camera &camera) {
+    double x, y;
+    glfwGetCursorPos(window, &x, &y);
+    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+      if (dragging) {
+        // the world follows the cursor, cursor y grows downwards
+        camera.center -= glm::vec2(x - lastX, lastY - y) / camera.zoom;
+      }
+      dragging = true;
+    } else {
+      dragging = false;
+    }
+    lastX = x;
+    lastY = y;
 
-  Renderer renderer(WINDOW_WIDTH, WINDOW_HEIGHT);
-  GravitySystem system(GRAVITY, DT);
+    if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS) camera.zoom *= CAMERA_ZOOM_STEP;
+    if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS) camera.zoom /= CAMERA_ZOOM_STEP;
+    camera.zoom = std::clamp(camera.zoom, CAMERA_MIN_ZOOM, CAMERA_MAX_ZOOM);
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) camera = Camera{};
+  }
+};
 
-  std::vector<RectObject> rects(NUM_RECT_COLS * NUM_RECT_ROWS);
-  std::vector<CircleObject> circles(NUM_CIRCLES);
 
-  Mesh rectMesh;
-  Mesh circleMesh;
-  createCircleObject(NUM_CIRCLE_SIDES);
+// -------- Replay. Draws recorded frames instead of simulating --------
+// Space : pause, Left / Right : scrub (one frame when paused), Up / Down : time scale x2 / /2,
+// Home / End : first / last frame, 0 - 9 : seek to 0% - 90%
+struct KeyEdge {
+  bool down = false;
+  bool pressed(GLFWwindow *window, int key) {
+    bool now = glfwGetKey(window, key) == GLFW_PRESS;
+    bool edge = now && !down;
+    down = now;
+    return edge;
+  }
+};
 
-  initMeshBuffers(renderer, rectMesh, SHAPE_TYPE_RECTANGLE);
-  initMeshBuffers(renderer, circleMesh, SHAPE_TYPE_CIRCLE);
+void runReplay(Renderer &renderer, Scene &scene, const char *path, uint64_t seekFrame) {
+  TrajectoryPlayer player(path);
 
-  system.initVectorFieldComponent(rects, renderer);
-  system.initCircles(circles, renderer);
-  // system.initCircles2(circles, renderer);
+  // the recording ran one step per TARGET_FRAME_TIME
+  const double framesPerSecond = 1.0 / (TARGET_FRAME_TIME) / player.everyNth();
+  const double lastFrame = static_cast<double>(player.frameCount() - 1);
 
-  Scene scene{.circles = circles,
-              .rects = rects,
-              .circleMesh = circleMesh,
-              .rectMesh = rectMesh};
+  double playhead = std::min(static_cast<double>(seekFrame), lastFrame);
+  double timeScale = 1.0;
+  bool paused = false;
+  player.seek(static_cast<uint64_t>(playhead));
+
+  KeyEdge pauseKey, leftKey, rightKey, upKey, downKey, homeKey, endKey;
+  KeyEdge digitKeys[10];
+  CameraControl cameraControl;
+
+  uint64_t step = 0;
+  uint32_t misses = 0;
 
   using clock = std::chrono::high_resolution_clock;
   auto lastTime = clock::now();
+  auto lastReport = lastTime;
+  FramePacer pacer(renderer, TARGET_FRAME_TIME);
 
   while (!glfwWindowShouldClose(renderer.window)) {
 
     auto frameStart = clock::now();
+    double elapsedWall = std::chrono::duration<double>(frameStart - lastTime).count();
+    lastTime = frameStart;
 
     glfwPollEvents();
+    cameraControl.update(renderer.window, scene.camera);
+
+    double scrub = paused ? 1.0 : framesPerSecond * 5.0; // 5 s of recording while playing
+    if (pauseKey.pressed(renderer.window, GLFW_KEY_SPACE)) paused = !paused;
+    if (leftKey.pressed(renderer.window, GLFW_KEY_LEFT)) playhead -= scrub;
+    if (rightKey.pressed(renderer.window, GLFW_KEY_RIGHT)) playhead += scrub;
+    if (upKey.pressed(renderer.window, GLFW_KEY_UP)) timeScale = std::min(timeScale * 2.0, 64.0);
+    if (downKey.pressed(renderer.window, GLFW_KEY_DOWN)) timeScale = std::max(timeScale * 0.5, 1.0 / 16.0);
+    if (homeKey.pressed(renderer.window, GLFW_KEY_HOME)) playhead = 0.0;
+    if (endKey.pressed(renderer.window, GLFW_KEY_END)) playhead = lastFrame;
+    for (int i = 0; i < 10; i++) {
+      if (digitKeys[i].pressed(renderer.window, GLFW_KEY_0 + i)) playhead = lastFrame * i / 10.0;
+    }
+
+    if (!paused) {
+      playhead += elapsedWall * framesPerSecond * timeScale;
+    }
+    playhead = std::clamp(playhead, 0.0, lastFrame);
 
-    system.update(renderer, scene.rects, scene.circles);
+    uint64_t frame = static_cast<uint64_t>(playhead);
+    player.seek(frame);
+    if (!player.fetch(frame, scene.circles, step)) {
+      misses++; // decoder behind, keep showing the last frame
+    }
 
     renderer.drawFrame(scene);
 
-    // FPS limit
-    auto frameEnd = clock::now();
-    std::chrono::duration<double> elapsed = frameEnd - frameStart;
+    if (std::chrono::duration<double>(frameStart - lastReport).count() >= 1.0) {
+      printf("[Info] | Replay frame %llu / %llu (step %llu) x%.3g%s | %u decoder misses\n",
+             (unsigned long long)frame, (unsigned long long)player.frameCount(), (unsigned long long)step,
+             timeScale, paused ? " paused" : "", misses);
+      misses = 0;
+      lastReport = frameStart;
+    }
+
+    pacer.wait();
+  }
+}
+// ---------------------------------------------------
+
+// -------- Snapshot. Bodies are stored as one array per field (SoA) --------
+void saveScene(const char *path, const std::vector<CircleObject> &circles, uint64_t step) {
+  std::vector<glm::vec2> position(circles.size()), velocity(circles.size());
+  std::vector<glm::vec3> color(circles.size());
+  std::vector<float> mass(circles.size()), radius(circles.size());
+  for (size_t i = 0; i < circles.size(); i++) {
+    position[i] = circles[i].position;
+    velocity[i] = circles[i].velocity;
+    color[i] = circles[i].color;
+    mass[i] = circles[i].mass;
+    radius[i] = circles[i].radius;
+  }
+
+  SnapshotHeader header{};
+  header.kind = SNAPSHOT_KIND_GRAVITY;
+  header.layoutVersion = GRAVITY_LAYOUT_VERSION;
+  header.step = step;
+  header.dt = DT;
+
+  writeSnapshot(path, header, {
+      {GRAVITY_SNAPSHOT_CIRCLE_POSITION, sizeof(glm::vec2), position.size(), position.data()},
+      {GRAVITY_SNAPSHOT_CIRCLE_VELOCITY, sizeof(glm::vec2), velocity.size(), velocity.data()},
+      {GRAVITY_SNAPSHOT_CIRCLE_COLOR, sizeof(glm::vec3), color.size(), color.data()},
+      {GRAVITY_SNAPSHOT_CIRCLE_MASS, sizeof(float), mass.size(), mass.data()},
+      {GRAVITY_SNAPSHOT_CIRCLE_RADIUS, sizeof(float), radius.size(), radius.data()},
+  });
+}
+
+template <typename T>
+const T *snapshotArray(const MappedSnapshot &snapshot, GravitySnapshotArray id, uint64_t count) {
+  uint64_t stored;
+  const T *data = static_cast<const T *>(snapshot.array(id, sizeof(T), stored));
+  if (data == nullptr || stored != count) {
+    throw std::runtime_error("Snapshot arrays do not match!");
+  }
+  return data;
+}
+
+// Fields are read straight from the mapped file, circle count comes from the snapshot
+uint64_t restoreScene(const char *path, Scene &scene) {
+  MappedSnapshot snapshot(path, SNAPSHOT_KIND_GRAVITY, GRAVITY_LAYOUT_VERSION);
+
+  uint64_t count;
+  const glm::vec2 *position = static_cast<const glm::vec2 *>(
+      snapshot.array(GRAVITY_SNAPSHOT_CIRCLE_POSITION, sizeof(glm::vec2), count));
+  if (position == nullptr) {
+    throw std::runtime_error("Snapshot has no circles!");
+  }
+  const glm::vec2 *velocity = snapshotArray<glm::vec2>(snapshot, GRAVITY_SNAPSHOT_CIRCLE_VELOCITY, count);
+  const glm::vec3 *color = snapshotArray<glm::vec3>(snapshot, GRAVITY_SNAPSHOT_CIRCLE_COLOR, count);
+  const float *mass = snapshotArray<float>(snapshot, GRAVITY_SNAPSHOT_CIRCLE_MASS, count);
+  const float *radius = snapshotArray<float>(snapshot, GRAVITY_SNAPSHOT_CIRCLE_RADIUS, count);
+
+  scene.circles.resize(count);
+  for (uint64_t i = 0; i < count; i++) {
+    scene.circles[i].position = position[i];
+    scene.circles[i].velocity = velocity[i];
+    scene.circles[i].net_force = glm::vec2(0.0f);
+    scene.circles[i].color = color[i];
+    scene.circles[i].mass = mass[i];
+    scene.circles[i].radius = radius[i];
+  }
+
+  printf("[Info] | Restored %llu circles from %s (step %llu)\n",
+         (unsigned long long)count, path, (unsigned long long)snapshot.header().step);
+  return snapshot.header().step;
+}
+// ---------------------------------------------------
+
+int main(int argc, char **argv) {
+
+  // --restore <file> : start from a snapshot. F5 writes SNAPSHOT_PATH
+  // --record <file> : record the circles' trajectories, --record-every <n> : every nth step only
+  // --replay <file> : play a recording back instead of simulating, --seek <frame> : start frame
+  // --gpu : simulate on the GPU, --bodies <n> : start from a disk of n bodies instead
+  // --barnes-hut : GPU tree code instead of all pairs, --theta <t> : opening angle
+  // --field <n> : n x n vector field arrows (up to 512 x 512 is fine, it is all on the GPU)
+  // --heatmap : field magnitude over the whole window, H toggles it
+  const char *restorePath = nullptr;
+  const char *recordPath = nullptr;
+  const char *replayPath = nullptr;
+  uint32_t recordEvery = 1;
+  uint64_t seekFrame = 0;
+  bool gpu = false;
+  float theta = 0.0f;
+  uint32_t bodyCount = 0;
+  uint32_t fieldCols = NUM_RECT_COLS;
+  uint32_t fieldRows = NUM_RECT_ROWS;
+  bool heatmap = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+      restorePath = argv[++i];
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordPath = argv[++i];
+    } else if (strcmp(argv[i], "--record-every") == 0 && i + 1 < argc) {
+      recordEvery = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replayPath = argv[++i];
+    } else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+      seekFrame = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--gpu") == 0) {
+      gpu = true;
+    } else if (strcmp(argv[i], "--barnes-hut") == 0) {
+      gpu = true;
+      theta = theta > 0.0f ? theta : BH_THETA;
+    } else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) {
+      theta = strtof(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--bodies") == 0 && i + 1 < argc) {
+      bodyCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--field") == 0 && i + 1 < argc) {
+      fieldCols = fieldRows = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--heatmap") == 0) {
+      heatmap = true;
+    }
+  }
+
+  Renderer renderer(WINDOW_WIDTH, WINDOW_HEIGHT);
+  GravitySystem system(GRAVITY, DT);
+
+  std::vector<CircleObject> circles(bodyCount > 0 ? bodyCount : NUM_CIRCLES);
+
+  // circles need no mesh, they are quads cut out in the fragment shader
+  Mesh rectMesh;
+  initMeshBuffers(renderer, rectMesh, SHAPE_TYPE_RECTANGLE);
+
+  renderer.setVectorField(fieldCols, fieldRows, GRAVITY);
+  renderer.setHeatmap(heatmap);
+  if (bodyCount > 0) {
+    system.initDisk(circles);
+  } else {
+    system.initCircles(circles, renderer);
+  }
+  // system.initCircles2(circles, renderer);
+
+  Scene scene{.circles = circles,
+              .rectMesh = rectMesh,
+              .camera = {}};
+
+  uint64_t step = 0;
+  if (restorePath != nullptr) {
+    step = restoreScene(restorePath, scene);
+  }
+  bool snapshotKeyDown = false;
+  KeyEdge heatmapKey;
+  CameraControl cameraControl;
+
+  // bodies live on the GPU from here on
+  if (gpu && replayPath == nullptr) {
+    renderer.uploadBodies(scene.circles, GRAVITY, DT,
+                          bodyCount > 0 ? DISK_SOFTENING : 1e-6f, theta);
+  }
+
+  std::unique_ptr<TrajectoryRecorder> recorder;
+  if (replayPath != nullptr) {
+    runReplay(renderer, scene, replayPath, seekFrame);
+  } else if (recordPath != nullptr && renderer.simulatesBodies()) {
+    printf("[Error] | --record needs the bodies on the CPU, not recording\n");
+  } else if (recordPath != nullptr) {
+    recorder = std::make_unique<TrajectoryRecorder>(recordPath, recordEvery);
+  }
+
+  FramePacer pacer(renderer, TARGET_FRAME_TIME);
 
-    double sleepTime = TARGET_FRAME_TIME - elapsed.count();
-    if (sleepTime > 0.0) {
-      std::this_thread::sleep_for(std::chrono::duration<double>(sleepTime));
+  // snapshot files are written off the render loop, one at a time
+  std::thread snapshotWriter;
+  std::vector<CircleObject> snapshotBodies;
+  auto writeSceneSnapshot = [&snapshotWriter](std::vector<CircleObject> circles, uint64_t snapshotStep) {
+    if (snapshotWriter.joinable()) {
+      snapshotWriter.join();
     }
+    snapshotWriter = std::thread([circles = std::move(circles), snapshotStep]() {
+      try {
+        saveScene(SNAPSHOT_PATH, circles, snapshotStep);
+      } catch (const std::exception &e) {
+        printf("[Error] | %s\n", e.what());
+      }
+    });
+  };
+
+  while (!replayPath && !glfwWindowShouldClose(renderer.window)) {
+
+    glfwPollEvents();
+
+    // CPU bodies are copied right away. GPU bodies are copied behind this frame and handed over once its
+    // fence signalled, see takeBodySnapshot below
+    bool snapshotKey = glfwGetKey(renderer.window, GLFW_KEY_F5) == GLFW_PRESS;
+    if (snapshotKey && !snapshotKeyDown) {
+      if (renderer.simulatesBodies()) {
+        renderer.requestBodySnapshot(step + 1);
+      } else {
+        writeSceneSnapshot(scene.circles, step);
+      }
+    }
+    snapshotKeyDown = snapshotKey;
+
+    if (heatmapKey.pressed(renderer.window, GLFW_KEY_H)) {
+      renderer.setHeatmap(!renderer.heatmap());
+    }
+    cameraControl.update(renderer.window, scene.camera);
+
+    if (!renderer.simulatesBodies()) {
+      system.update(scene.circles);
+    }
+    if (recorder) {
+      recorder->record(step, scene.circles);
+    }
+    step++;
+
+    renderer.drawFrame(scene);
+
+    uint64_t snapshotStep;
+    if (renderer.takeBodySnapshot(snapshotBodies, snapshotStep)) {
+      writeSceneSnapshot(std::move(snapshotBodies), snapshotStep);
+    }
+
+    pacer.wait();
   }
   vkDeviceWaitIdle(renderer.device);
+  if (snapshotWriter.joinable()) {
+    snapshotWriter.join();
+  }
+
+  // flushes the last chunk and the frame index
+  recorder.reset();
 
   vkDestroyBuffer(renderer.device, rectMesh.vertexBuffer, nullptr);
   vkFreeMemory(renderer.device, rectMesh.vertexBufferMemory, nullptr);
   vkDestroyBuffer(renderer.device, rectMesh.indexBuffer, nullptr);
   vkFreeMemory(renderer.device, rectMesh.indexBufferMemory, nullptr);
-
-  vkDestroyBuffer(renderer.device, circleMesh.vertexBuffer, nullptr);
-  vkFreeMemory(renderer.device, circleMesh.vertexBufferMemory, nullptr);
-  vkDestroyBuffer(renderer.device, circleMesh.indexBuffer, nullptr);
-  vkFreeMemory(renderer.device, circleMesh.indexBufferMemory, nullptr);
 }
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include "pacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+FramePacer::FramePacer(Renderer &renderer, double period)
+    : renderer(renderer),
+      period(std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(period))) {
+  deadline = clock::now();
+  lastReport = deadline;
+  presentTimed = renderer.presentWaitSupported();
+}
+
+void FramePacer::wait() {
+  deadline += period;
+  clock::time_point now = clock::now();
+  if (now > deadline) {
+    missedDeadlines++;
+    // more than a whole frame behind : start over from now, no burst of short frames
+    if (now > deadline + period) {
+      deadline = now;
+    }
+  }
+
+  // the frame just submitted is on screen before the next one starts
+  uint64_t presentId = renderer.lastPresentId();
+  if (presentTimed && presentId > waitedPresentId) {
+    uint64_t timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(std::max(deadline - now, clock::duration(0))).count();
+    if (renderer.waitForPresent(presentId, timeout)) {
+      sample(clock::now());
+    }
+    waitedPresentId = presentId;
+  }
+
+  sleepUntil(deadline);
+  if (!presentTimed) {
+    sample(clock::now());
+  }
+  report(clock::now());
+}
+
+// sleep_until wakes up a scheduler quantum late at worst, the tail is spun
+void FramePacer::sleepUntil(clock::time_point target) {
+  clock::time_point sleepTarget = target - std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(spinMargin));
+  if (clock::now() < sleepTarget) {
+    std::this_thread::sleep_until(sleepTarget);
+
+    // grows at once, decays slowly
+    double oversleep = std::chrono::duration<double>(clock::now() - sleepTarget).count();
+    spinMargin = std::clamp(std::max(oversleep * 1.5, spinMargin * 0.99), PACER_MIN_SPIN, PACER_MAX_SPIN);
+  }
+
+  while (clock::now() < target) {
+    std::this_thread::yield();
+  }
+}
+
+void FramePacer::sample(clock::time_point time) {
+  if (hasSample) {
+    intervals.push_back(std::chrono::duration<double>(time - lastSample).count());
+  }
+  lastSample = time;
+  hasSample = true;
+}
+
+void FramePacer::report(clock::time_point now) {
+  double window = std::chrono::duration<double>(now - lastReport).count();
+  if (window < 1.0 || intervals.empty()) {
+    return;
+  }
+
+  double target = std::chrono::duration<double>(period).count();
+  std::vector<double> jitter(intervals.size());
+  for (size_t i = 0; i < intervals.size(); i++) {
+    jitter[i] = std::abs(intervals[i] - target) * 1000.0;
+  }
+  std::sort(jitter.begin(), jitter.end());
+  auto percentile = [&](double p) { return jitter[std::min(jitter.size() - 1, static_cast<size_t>(p * jitter.size()))]; };
+
+  printf("[Info] | frame pacing (%s) : %.1f frames/s, jitter p50 %.3f ms, p99 %.3f ms, max %.3f ms | %u missed deadlines, spin %.2f ms\n",
+         presentTimed ? "present" : "frame start", intervals.size() / window,
+         percentile(0.50), percentile(0.99), jitter.back(), missedDeadlines, spinMargin * 1000.0);
+
+  intervals.clear();
+  missedDeadlines = 0;
+  lastReport = now;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "renderer.h"
+
+#define PACER_MIN_SPIN 0.0002 // s, bounds of the spinning tail of a wait
+#define PACER_MAX_SPIN 0.004
+
+// Frame limiter. Frames are due at absolute deadlines (the previous one + period), so time lost in one
+// frame is not carried into the next, and a frame late by more than a period restarts the schedule
+// instead of bursting to catch up. A wait sleeps until spinMargin before the deadline and spins the rest,
+// the margin follows the worst recent oversleep of the OS.
+// With VK_KHR_present_wait the previous frame has to reach the display first (at most until the deadline),
+// the CPU never runs ahead of the screen, and jitter is measured between presents instead of frame starts.
+// Jitter (|interval - period|) percentiles are printed once per second.
+class FramePacer {
+public:
+  FramePacer(Renderer &renderer, double period);
+
+  // blocks until the next frame is due
+  void wait();
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  Renderer &renderer;
+  clock::duration period;
+  clock::time_point deadline;
+  double spinMargin = 0.001;
+  bool presentTimed;
+  uint64_t waitedPresentId = 0;
+
+  clock::time_point lastSample;
+  bool hasSample = false;
+  std::vector<double> intervals; // since the last report
+  uint32_t missedDeadlines = 0;
+  clock::time_point lastReport;
+
+  void sleepUntil(clock::time_point target);
+  void sample(clock::time_point time);
+  void report(clock::time_point now);
+};
@@ -0,0 +1,459 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#define QUANT_MAX ((1u << RECORDER_QUANT_BITS) - 1)
+
+// rANS (byte-wise renormalization, 32 bit state), order-0 model per chunk
+#define RANS_SCALE_BITS 12
+#define RANS_SCALE (1u << RANS_SCALE_BITS)
+#define RANS_LOW (1u << 23)
+
+// -------- Varint / zigzag --------
+static void putVarint(std::vector<uint8_t> &out, uint32_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+static uint32_t getVarint(const uint8_t *&ptr, const uint8_t *end) {
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (ptr == end) {
+      throw std::runtime_error("Corrupted trajectory chunk!");
+    }
+    uint8_t byte = *ptr++;
+    value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  throw std::runtime_error("Corrupted trajectory chunk!");
+}
+
+static uint32_t zigzag(int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+static int32_t unzigzag(uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+// -------- Quantization against a bounding box --------
+static uint32_t quantize(float value, float min, float max) {
+  float range = max - min;
+  if (range <= 0.0f) {
+    return 0;
+  }
+  float q = std::round((value - min) / range * QUANT_MAX);
+  return static_cast<uint32_t>(std::clamp(q, 0.0f, static_cast<float>(QUANT_MAX)));
+}
+
+static float dequantize(uint32_t q, float min, float max) {
+  return min + (max - min) * (static_cast<float>(q) / QUANT_MAX);
+}
+
+// -------- rANS --------
+// frequencies scaled to RANS_SCALE, every byte that occurs keeps at least 1
+static void normalizeFrequencies(const std::vector<uint8_t> &bytes, uint16_t freq[256]) {
+  uint64_t counts[256] = {};
+  for (uint8_t b : bytes) {
+    counts[b]++;
+  }
+
+  int64_t sum = 0;
+  for (int s = 0; s < 256; s++) {
+    freq[s] = counts[s] == 0 ? 0 : std::max<uint64_t>(1, counts[s] * RANS_SCALE / bytes.size());
+    sum += freq[s];
+  }
+
+  // fix rounding on the most frequent symbols
+  while (sum != RANS_SCALE) {
+    int largest = 0;
+    for (int s = 1; s < 256; s++) {
+      if (freq[s] > freq[largest]) {
+        largest = s;
+      }
+    }
+    if (sum > RANS_SCALE) {
+      int target = -1;
+      for (int s = 0; s < 256; s++) {
+        if (freq[s] > 1 && (target == -1 || freq[s] > freq[target])) {
+          target = s;
+        }
+      }
+      freq[target]--;
+      sum--;
+    } else {
+      freq[largest]++;
+      sum++;
+    }
+  }
+}
+
+static void cumulativeFrequencies(const uint16_t freq[256], uint32_t cum[257]) {
+  cum[0] = 0;
+  for (int s = 0; s < 256; s++) {
+    cum[s + 1] = cum[s] + freq[s];
+  }
+}
+
+static std::vector<uint8_t> ransEncode(const std::vector<uint8_t> &bytes, const uint16_t freq[256]) {
+  uint32_t cum[257];
+  cumulativeFrequencies(freq, cum);
+
+  // symbols are encoded backwards and the output is reversed at the end, the decoder reads forwards
+  std::vector<uint8_t> out;
+  out.reserve(bytes.size() + 4);
+  uint32_t x = RANS_LOW;
+  for (size_t i = bytes.size(); i-- > 0;) {
+    uint32_t f = freq[bytes[i]];
+    uint32_t xMax = ((RANS_LOW >> RANS_SCALE_BITS) << 8) * f;
+    while (x >= xMax) {
+      out.push_back(static_cast<uint8_t>(x & 0xff));
+      x >>= 8;
+    }
+    x = ((x / f) << RANS_SCALE_BITS) + (x % f) + cum[bytes[i]];
+  }
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<uint8_t>(x >> shift));
+  }
+
+  std::reverse(out.begin(), out.end());
+  return out;
+}
+
+static void ransDecode(const std::vector<uint8_t> &encoded, const uint16_t freq[256], std::vector<uint8_t> &out) {
+  uint32_t cum[257];
+  cumulativeFrequencies(freq, cum);
+
+  uint8_t lookup[RANS_SCALE];
+  for (int s = 0; s < 256; s++) {
+    for (uint32_t slot = cum[s]; slot < cum[s + 1]; slot++) {
+      lookup[slot] = static_cast<uint8_t>(s);
+    }
+  }
+
+  if (encoded.size() < 4) {
+    throw std::runtime_error("Corrupted trajectory chunk!");
+  }
+  const uint8_t *ptr = encoded.data();
+  const uint8_t *end = encoded.data() + encoded.size();
+  uint32_t x = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (static_cast<uint32_t>(ptr[3]) << 24);
+  ptr += 4;
+
+  for (size_t i = 0; i < out.size(); i++) {
+    uint32_t slot = x & (RANS_SCALE - 1);
+    uint8_t s = lookup[slot];
+    out[i] = s;
+    x = freq[s] * (x >> RANS_SCALE_BITS) + slot - cum[s];
+    while (x < RANS_LOW && ptr < end) {
+      x = (x << 8) | *ptr++;
+    }
+  }
+}
+
+// -------- Recorder --------
+TrajectoryRecorder::TrajectoryRecorder(const char *path, uint32_t everyNth) : everyNth(std::max<uint32_t>(1, everyNth)) {
+  file = fopen(path, "wb");
+  if (file == nullptr) {
+    throw std::runtime_error("Failed to open trajectory file!");
+  }
+
+  // rewritten with the final counts and index offset on close
+  TrajectoryFileHeader header{};
+  fwrite(&header, sizeof(header), 1, file);
+
+  worker = std::thread(&TrajectoryRecorder::run, this);
+}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+  stopping = true;
+  worker.join();
+
+  if (!chunkFrames.empty()) {
+    flushChunk();
+  }
+
+  TrajectoryFileHeader header{};
+  memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+  header.version = TRAJECTORY_VERSION;
+  header.quantBits = RECORDER_QUANT_BITS;
+  header.chunkFrames = RECORDER_CHUNK_FRAMES;
+  header.everyNth = everyNth;
+  header.frameCount = frameCount;
+  header.chunkCount = index.size();
+  header.indexOffset = ftell(file);
+
+  fwrite(index.data(), sizeof(TrajectoryChunkIndex), index.size(), file);
+  fseek(file, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, file);
+  fclose(file);
+
+  printf("[Info] | Trajectory : %llu frames (%llu dropped), %.2f MiB raw floats -> %.2f MiB (x%.1f)\n",
+         (unsigned long long)frameCount, (unsigned long long)droppedFrames.load(),
+         rawBytes / (1024.0 * 1024.0), encodedBytes / (1024.0 * 1024.0),
+         encodedBytes > 0 ? (double)rawBytes / encodedBytes : 0.0);
+}
+
+bool TrajectoryRecorder::record(uint64_t step, const std::vector<CircleObject> &circles) {
+  if (step % everyNth != 0) {
+    return true;
+  }
+
+  TrajectoryFrame *frame = queue.beginPush();
+  if (frame == nullptr) {
+    droppedFrames.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  frame->step = step;
+  frame->position.resize(circles.size());
+  frame->velocity.resize(circles.size());
+  for (size_t i = 0; i < circles.size(); i++) {
+    frame->position[i] = circles[i].position;
+    frame->velocity[i] = circles[i].velocity;
+  }
+
+  queue.endPush();
+  return true;
+}
+
+void TrajectoryRecorder::run() {
+  while (true) {
+    TrajectoryFrame *frame = queue.front();
+    if (frame != nullptr) {
+      encodeFrame(*frame);
+      queue.pop();
+      continue;
+    }
+    if (stopping) {
+      break; // producer is gone and the queue is empty
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void TrajectoryRecorder::encodeFrame(const TrajectoryFrame &frame) {
+  uint32_t count = frame.position.size();
+
+  TrajectoryFrameInfo info{};
+  info.step = frame.step;
+  info.count = count;
+  if (count > 0) {
+    info.positionMin = info.positionMax = frame.position[0];
+    info.velocityMin = info.velocityMax = frame.velocity[0];
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    info.positionMin = glm::min(info.positionMin, frame.position[i]);
+    info.positionMax = glm::max(info.positionMax, frame.position[i]);
+    info.velocityMin = glm::min(info.velocityMin, frame.velocity[i]);
+    info.velocityMax = glm::max(info.velocityMax, frame.velocity[i]);
+  }
+
+  // chunk start or changed body count : delta against zero
+  if (chunkFrames.empty() || previous.size() != count * 4) {
+    previous.assign(count * 4, 0);
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t q[4] = {
+        quantize(frame.position[i].x, info.positionMin.x, info.positionMax.x),
+        quantize(frame.position[i].y, info.positionMin.y, info.positionMax.y),
+        quantize(frame.velocity[i].x, info.velocityMin.x, info.velocityMax.x),
+        quantize(frame.velocity[i].y, info.velocityMin.y, info.velocityMax.y),
+    };
+    for (int k = 0; k < 4; k++) {
+      putVarint(chunkBytes, zigzag(static_cast<int32_t>(q[k] - previous[i * 4 + k])));
+      previous[i * 4 + k] = q[k];
+    }
+  }
+
+  chunkFrames.push_back(info);
+  frameCount++;
+  rawBytes += count * 2 * sizeof(glm::vec2);
+
+  if (chunkFrames.size() == RECORDER_CHUNK_FRAMES) {
+    flushChunk();
+  }
+}
+
+void TrajectoryRecorder::flushChunk() {
+  uint16_t freq[256] = {};
+  std::vector<uint8_t> encoded;
+  if (!chunkBytes.empty()) {
+    normalizeFrequencies(chunkBytes, freq);
+    encoded = ransEncode(chunkBytes, freq);
+  }
+
+  TrajectoryChunkHeader chunk{};
+  chunk.frameCount = chunkFrames.size();
+  chunk.rawSize = chunkBytes.size();
+  chunk.encodedSize = encoded.size();
+
+  index.push_back({frameCount - chunkFrames.size(), chunkFrames[0].step, static_cast<uint64_t>(ftell(file))});
+
+  fwrite(&chunk, sizeof(chunk), 1, file);
+  fwrite(chunkFrames.data(), sizeof(TrajectoryFrameInfo), chunkFrames.size(), file);
+  fwrite(freq, sizeof(freq), 1, file);
+  fwrite(encoded.data(), 1, encoded.size(), file);
+
+  encodedBytes += sizeof(chunk) + sizeof(TrajectoryFrameInfo) * chunkFrames.size() + sizeof(freq) + encoded.size();
+
+  chunkFrames.clear();
+  chunkBytes.clear();
+}
+
+// -------- Reader --------
+TrajectoryReader::TrajectoryReader(const char *path) {
+  file = fopen(path, "rb");
+  if (file == nullptr) {
+    throw std::runtime_error("Failed to open trajectory file!");
+  }
+
+  if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic)) != 0) {
+    fclose(file);
+    throw std::runtime_error("Not a trajectory file (or the recording was not closed)!");
+  }
+  if (header.version != TRAJECTORY_VERSION || header.quantBits != RECORDER_QUANT_BITS) {
+    fclose(file);
+    throw std::runtime_error("Unsupported trajectory version!");
+  }
+
+  index.resize(header.chunkCount);
+  fseek(file, header.indexOffset, SEEK_SET);
+  if (fread(index.data(), sizeof(TrajectoryChunkIndex), index.size(), file) != index.size()) {
+    fclose(file);
+    throw std::runtime_error("Trajectory index is truncated!");
+  }
+}
+
+TrajectoryReader::~TrajectoryReader() { fclose(file); }
+
+uint32_t TrajectoryReader::maxBodyCount() {
+  uint32_t maxCount = 0;
+  std::vector<TrajectoryFrameInfo> infos;
+  for (const TrajectoryChunkIndex &chunk : index) {
+    TrajectoryChunkHeader chunkHeader;
+    fseek(file, chunk.offset, SEEK_SET);
+    if (fread(&chunkHeader, sizeof(chunkHeader), 1, file) != 1) {
+      throw std::runtime_error("Trajectory chunk is truncated!");
+    }
+    infos.resize(chunkHeader.frameCount);
+    if (fread(infos.data(), sizeof(TrajectoryFrameInfo), infos.size(), file) != infos.size()) {
+      throw std::runtime_error("Trajectory chunk is truncated!");
+    }
+    for (const TrajectoryFrameInfo &info : infos) {
+      maxCount = std::max(maxCount, info.count);
+    }
+  }
+  return maxCount;
+}
+
+uint64_t TrajectoryReader::frameAtStep(uint64_t step) {
+  if (index.empty()) {
+    return 0;
+  }
+
+  // last chunk starting at or before step, then search its frame infos
+  auto it = std::upper_bound(index.begin(), index.end(), step,
+                             [](uint64_t s, const TrajectoryChunkIndex &chunk) { return s < chunk.firstStep; });
+  uint64_t chunk = it == index.begin() ? 0 : (it - index.begin()) - 1;
+  loadChunk(chunk);
+
+  uint64_t frame = index[chunk].firstFrame;
+  for (size_t i = 1; i < cachedInfos.size() && cachedInfos[i].step <= step; i++) {
+    frame = index[chunk].firstFrame + i;
+  }
+  return frame;
+}
+
+void TrajectoryReader::readFrame(uint64_t frame, TrajectoryFrame &out) {
+  uint64_t chunk = chunkOfFrame(frame);
+  if (static_cast<int64_t>(chunk) != cachedChunk) {
+    loadChunk(chunk);
+  }
+  uint32_t count = cachedInfos[frame - index[chunk].firstFrame].count;
+  out.position.resize(count);
+  out.velocity.resize(count);
+  readFrame(frame, out.step, out.position.data(), out.velocity.data());
+}
+
+uint32_t TrajectoryReader::readFrame(uint64_t frame, uint64_t &step, glm::vec2 *position, glm::vec2 *velocity) {
+  uint64_t chunk = chunkOfFrame(frame);
+  uint32_t local = frame - index[chunk].firstFrame;
+
+  // seeking back inside a chunk restarts its delta chain, no other chunk is touched
+  if (static_cast<int64_t>(chunk) != cachedChunk || local < nextFrame) {
+    loadChunk(chunk);
+  }
+  while (nextFrame < local) {
+    decodeNextFrame(nullptr, nullptr);
+  }
+  decodeNextFrame(position, velocity);
+
+  step = cachedInfos[local].step;
+  return cachedInfos[local].count;
+}
+
+uint64_t TrajectoryReader::chunkOfFrame(uint64_t frame) {
+  if (frame >= header.frameCount) {
+    throw std::runtime_error("Trajectory frame out of range!");
+  }
+  auto it = std::upper_bound(index.begin(), index.end(), frame,
+                             [](uint64_t f, const TrajectoryChunkIndex &chunk) { return f < chunk.firstFrame; });
+  return (it - index.begin()) - 1;
+}
+
+void TrajectoryReader::loadChunk(uint64_t chunk) {
+  TrajectoryChunkHeader chunkHeader;
+  uint16_t freq[256];
+  fseek(file, index[chunk].offset, SEEK_SET);
+  bool ok = fread(&chunkHeader, sizeof(chunkHeader), 1, file) == 1;
+  if (ok) {
+    cachedInfos.resize(chunkHeader.frameCount);
+    ok = fread(cachedInfos.data(), sizeof(TrajectoryFrameInfo), cachedInfos.size(), file) == cachedInfos.size();
+  }
+  ok = ok && fread(freq, sizeof(freq), 1, file) == 1;
+  std::vector<uint8_t> encoded(ok ? chunkHeader.encodedSize : 0);
+  ok = ok && fread(encoded.data(), 1, encoded.size(), file) == encoded.size();
+  if (!ok) {
+    cachedChunk = -1;
+    throw std::runtime_error("Trajectory chunk is truncated!");
+  }
+
+  cachedBytes.resize(chunkHeader.rawSize);
+  if (!cachedBytes.empty()) {
+    ransDecode(encoded, freq, cachedBytes);
+  }
+
+  cachedChunk = chunk;
+  bytePosition = 0;
+  nextFrame = 0;
+}
+
+// one step of the delta chain, same rules as encodeFrame. null outputs only advance the chain
+void TrajectoryReader::decodeNextFrame(glm::vec2 *position, glm::vec2 *velocity) {
+  const TrajectoryFrameInfo &info = cachedInfos[nextFrame];
+  if (nextFrame == 0 || previous.size() != info.count * 4) {
+    previous.assign(info.count * 4, 0);
+  }
+
+  const uint8_t *ptr = cachedBytes.data() + bytePosition;
+  const uint8_t *end = cachedBytes.data() + cachedBytes.size();
+  for (uint32_t i = 0; i < info.count; i++) {
+    for (int k = 0; k < 4; k++) {
+      previous[i * 4 + k] += static_cast<uint32_t>(unzigzag(getVarint(ptr, end)));
+    }
+    if (position != nullptr) {
+      position[i] = glm::vec2(dequantize(previous[i * 4 + 0], info.positionMin.x, info.positionMax.x),
+                              dequantize(previous[i * 4 + 1], info.positionMin.y, info.positionMax.y));
+      velocity[i] = glm::vec2(dequantize(previous[i * 4 + 2], info.velocityMin.x, info.velocityMax.x),
+                              dequantize(previous[i * 4 + 3], info.velocityMin.y, info.velocityMax.y));
+    }
+  }
+
+  bytePosition = ptr - cachedBytes.data();
+  nextFrame++;
+}
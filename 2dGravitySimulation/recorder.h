@@ -0,0 +1,167 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "renderer.h"
+
+// Trajectory file
+//
+//   [TrajectoryFileHeader]
+//   [chunk 0] [chunk 1] ... [TrajectoryChunkIndex x chunkCount]
+//
+//   chunk = [TrajectoryChunkHeader] [TrajectoryFrameInfo x frameCount] [uint16_t freq x 256] [rANS bytes]
+//
+// Positions / velocities are quantized to RECORDER_QUANT_BITS against the frame's bounding box,
+// delta coded against the previous frame of the same chunk (zigzag varints) and the byte stream of
+// a chunk is rANS coded. Every chunk starts from zero, so any frame decodes from its chunk alone.
+#define TRAJECTORY_MAGIC "VKTRAJ\0\0"
+#define TRAJECTORY_VERSION 1
+#define RECORDER_QUANT_BITS 16
+#define RECORDER_CHUNK_FRAMES 64
+#define RECORDER_QUEUE_SIZE 64 // power of two
+
+struct TrajectoryFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t quantBits;
+  uint32_t chunkFrames;
+  uint32_t everyNth;
+  uint64_t frameCount;
+  uint64_t chunkCount;
+  uint64_t indexOffset; // 0 while recording
+};
+
+struct TrajectoryChunkHeader {
+  uint32_t frameCount;
+  uint32_t rawSize;     // varint bytes before entropy coding
+  uint32_t encodedSize; // rANS bytes
+  uint32_t reserved;
+};
+
+struct TrajectoryFrameInfo {
+  uint64_t step;
+  uint32_t count;
+  uint32_t reserved;
+  glm::vec2 positionMin, positionMax;
+  glm::vec2 velocityMin, velocityMax;
+};
+
+struct TrajectoryChunkIndex {
+  uint64_t firstFrame;
+  uint64_t firstStep;
+  uint64_t offset;
+};
+
+struct TrajectoryFrame {
+  uint64_t step = 0;
+  std::vector<glm::vec2> position;
+  std::vector<glm::vec2> velocity;
+};
+
+// Single producer / single consumer ring. Slots are reused, so the producer fills a slot in place
+// (no allocation once the vectors have grown) and the consumer reads it in place.
+template <typename T, uint32_t N>
+class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+
+public:
+  // producer : nullptr when full
+  T *beginPush() {
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    if (head - tail.load(std::memory_order_acquire) == N) {
+      return nullptr;
+    }
+    return &slots[head & (N - 1)];
+  }
+  void endPush() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // consumer : nullptr when empty
+  T *front() {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail == head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &slots[tail & (N - 1)];
+  }
+  void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+  T slots[N];
+  alignas(64) std::atomic<uint32_t> head{0};
+  alignas(64) std::atomic<uint32_t> tail{0};
+};
+
+// Records every Nth step of the circles. record() only copies into the queue, quantization,
+// coding and file IO run on the recorder thread.
+class TrajectoryRecorder {
+public:
+  TrajectoryRecorder(const char *path, uint32_t everyNth);
+  ~TrajectoryRecorder(); // drains the queue, writes the index
+
+  // simulation thread. false when the step was dropped because the queue is full
+  bool record(uint64_t step, const std::vector<CircleObject> &circles);
+
+private:
+  FILE *file;
+  uint32_t everyNth;
+  SpscQueue<TrajectoryFrame, RECORDER_QUEUE_SIZE> queue;
+  std::thread worker;
+  std::atomic<bool> stopping{false};
+  std::atomic<uint64_t> droppedFrames{0};
+
+  // recorder thread only
+  std::vector<uint32_t> previous;
+  std::vector<TrajectoryFrameInfo> chunkFrames;
+  std::vector<uint8_t> chunkBytes;
+  std::vector<TrajectoryChunkIndex> index;
+  uint64_t frameCount = 0;
+  uint64_t rawBytes = 0;
+  uint64_t encodedBytes = 0;
+
+  void run();
+  void encodeFrame(const TrajectoryFrame &frame);
+  void flushChunk();
+};
+
+// Random access to the frames of a trajectory file. The entropy decoded bytes of the current chunk
+// are kept and frames are dequantized one at a time, reading forward within a chunk only walks
+// the delta chain from the last frame read.
+class TrajectoryReader {
+public:
+  TrajectoryReader(const char *path);
+  ~TrajectoryReader();
+  TrajectoryReader(const TrajectoryReader &) = delete;
+  TrajectoryReader &operator=(const TrajectoryReader &) = delete;
+
+  uint64_t frameCount() const { return header.frameCount; }
+  uint32_t everyNth() const { return header.everyNth; }
+  // largest body count of any frame (reads the frame infos of every chunk)
+  uint32_t maxBodyCount();
+  // frame whose step is the last one <= step
+  uint64_t frameAtStep(uint64_t step);
+  void readFrame(uint64_t frame, TrajectoryFrame &out);
+  // same, into caller owned arrays of at least maxBodyCount() elements. returns the body count
+  uint32_t readFrame(uint64_t frame, uint64_t &step, glm::vec2 *position, glm::vec2 *velocity);
+
+private:
+  FILE *file;
+  TrajectoryFileHeader header;
+  std::vector<TrajectoryChunkIndex> index;
+
+  int64_t cachedChunk = -1;
+  std::vector<TrajectoryFrameInfo> cachedInfos;
+  std::vector<uint8_t> cachedBytes;
+  size_t bytePosition = 0;
+  uint32_t nextFrame = 0; // next frame of the cached chunk on the delta chain
+  std::vector<uint32_t> previous;
+
+  uint64_t chunkOfFrame(uint64_t frame);
+  void loadChunk(uint64_t chunk);
+  void decodeNextFrame(glm::vec2 *position, glm::vec2 *velocity);
+};
@@ -5,11 +5,13 @@
 #include "renderer.h"
 
 #include <algorithm>
+#include <array>
 #include <cstring>
 #include <fstream>
 #include <limits>
 #include <stdexcept>
 #include <stdio.h>
+#include <thread>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -22,6 +24,24 @@ bool enableValidationLayers = true;
 #endif
 
 #define MAX_FRAME_IN_FLIGHT 2
+#define NBODY_TILE_SIZE 256 // local_size_x of nbody.comp / integrate.comp and the Barnes-Hut passes
+#define RADIX_SORT_PASSES 4 // 8 bit digits of the 32 bit Morton codes
+#define FIELD_ARROW_BINDING (1 + BH_BUFFER_COUNT)
+#define FIELD_GROUP_SIZE 256 // local_size_x of field.comp / heatgrid.comp
+#define HEATMAP_GRID_BINDING (FIELD_ARROW_BINDING + 1)
+#define HEATMAP_CELL_SIZE 4  // pixels per heat grid sample
+#define HEATMAP_LUT_SIZE 256 // LUT_SIZE in heatmap.frag
+#define FIELD_VIEW_BINDING (HEATMAP_GRID_BINDING + 1) // ViewUniforms of the set's frame
+#define HEATMAP_VIEW_BINDING 2
+
+// draw descriptor set, binding 0 : body table (BODY_TABLE_SIZE in body.vert), binding 1 : arrows,
+// binding 2 : visible list, binding 3 : indirect draw arguments (quads, points), binding 4 : view
+#define BODY_TABLE_GPU 0  // bodyBuffer
+#define BODY_TABLE_HOST 1 // + frame in flight, hostBodyBuffers
+#define BODY_TABLE_SIZE (BODY_TABLE_HOST + MAX_FRAME_IN_FLIGHT)
+#define DRAW_BINDING_COUNT 4
+#define DRAW_VIEW_BINDING DRAW_BINDING_COUNT // ViewUniforms, dynamic offset of the frame
+#define CULL_GROUP_SIZE 256 // local_size_x of cull.comp
 
 std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"};
 
@@ -77,10 +97,14 @@ Renderer::Renderer(int width, int height) {
 
   createRenderpass();
   createGraphicsPipeline();
+  createComputePipeline();
   createFramebuffer();
   createCommandPool();
   createCommandBuffers();
+  startRecordWorkers();
   createSyncObjects();
+  createViewBuffer();
+  createDescriptorPool();
 
   // createVertexBuffer(vertices);
   // createIndexBuffer(indices);
@@ -88,8 +112,35 @@ Renderer::Renderer(int width, int height) {
 
 Renderer::~Renderer() {
 
+  stopRecordWorkers();
   vkDeviceWaitIdle(device);
 
+  for (DeferredDeletion &deletion : deletionQueue) {
+    deletion.destroy();
+  }
+  deletionQueue.clear();
+
+  // an idle device does not mean the present engine is done with the render finished semaphores
+  if (presentFencesEnabled) {
+    std::vector<VkFence> pending = presentFences;
+    for (RetiredSwapchain &retired : retiredSwapchains) {
+      pending.insert(pending.end(), retired.presentFences.begin(), retired.presentFences.end());
+    }
+    if (!pending.empty()) {
+      vkWaitForFences(device, pending.size(), pending.data(), VK_TRUE, UINT64_MAX);
+    }
+  }
+  for (RetiredSwapchain &retired : retiredSwapchains) {
+    destroyRetiredSwapchain(retired);
+  }
+  retiredSwapchains.clear();
+  for (VkFence fence : presentFences) {
+    vkDestroyFence(device, fence, nullptr);
+  }
+  for (VkFence fence : freePresentFences) {
+    vkDestroyFence(device, fence, nullptr);
+  }
+
   // vkDestroyBuffer(device, indexBuffer, nullptr);
   // vkFreeMemory(device, indexBufferMemory, nullptr);
 
@@ -105,12 +156,74 @@ Renderer::~Renderer() {
     vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
   }
 
+  if (bodyBuffer != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device, bodyBuffer, nullptr);
+    vkFreeMemory(device, bodyBufferMemory, nullptr);
+  }
+  destroyBodyReadback();
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkDestroyBuffer(device, viewBuffer, nullptr);
+  vkFreeMemory(device, viewBufferMemory, nullptr);
+  vkDestroyPipeline(device, nbodyForcePipeline, nullptr);
+  vkDestroyPipeline(device, nbodyIntegratePipeline, nullptr);
+  for (VkPipeline pipeline : {bhBoundsPipeline, bhMortonPipeline, radixHistogramPipeline,
+                              radixScanPipeline, radixScatterPipeline, bvhBuildPipeline,
+                              bvhMassPipeline, bhForcePipeline}) {
+    vkDestroyPipeline(device, pipeline, nullptr);
+  }
+  destroyTreeBuffers();
+  vkDestroyPipeline(device, fieldPipeline, nullptr);
+  vkDestroyPipeline(device, heatGridPipeline, nullptr);
+  vkDestroyPipelineLayout(device, fieldPipelineLayout, nullptr);
+  for (VkBuffer *buffer : {&heatGridBuffer, &heatLutBuffer}) {
+    if (*buffer != VK_NULL_HANDLE) {
+      vkDestroyBuffer(device, *buffer, nullptr);
+    }
+  }
+  for (VkDeviceMemory memory : {heatGridBufferMemory, heatLutBufferMemory}) {
+    if (memory != VK_NULL_HANDLE) {
+      vkFreeMemory(device, memory, nullptr);
+    }
+  }
+  if (arrowBuffer != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device, arrowBuffer, nullptr);
+    vkFreeMemory(device, arrowBufferMemory, nullptr);
+  }
+  for (size_t i = 0; i < hostBodyBuffers.size(); i++) {
+    vkDestroyBuffer(device, hostBodyBuffers[i], nullptr);
+    vkFreeMemory(device, hostBodyBufferMemory[i], nullptr);
+  }
+  vkDestroyPipelineLayout(device, nbodyPipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, nbodyDescriptorSetLayout, nullptr);
+
   vkDestroyCommandPool(device, commandPool, nullptr);
+  for (VkCommandPool pool : rangeCommandPools) {
+    vkDestroyCommandPool(device, pool, nullptr);
+  }
   for (VkFramebuffer &framebuffer : framebuffers) {
     vkDestroyFramebuffer(device, framebuffer, nullptr);
   }
+  vkDestroyPipeline(device, bodyPipeline, nullptr);
+  vkDestroyPipeline(device, arrowPipeline, nullptr);
+  vkDestroyPipeline(device, bodyPointPipeline, nullptr);
+  vkDestroyPipeline(device, cullPipeline, nullptr);
+  vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+  for (VkBuffer buffer : {cullVisibleBuffer, cullArgsBuffer}) {
+    if (buffer != VK_NULL_HANDLE) {
+      vkDestroyBuffer(device, buffer, nullptr);
+    }
+  }
+  for (VkDeviceMemory memory : {cullVisibleBufferMemory, cullArgsBufferMemory}) {
+    if (memory != VK_NULL_HANDLE) {
+      vkFreeMemory(device, memory, nullptr);
+    }
+  }
+  vkDestroyPipeline(device, heatmapPipeline, nullptr);
+  vkDestroyPipelineLayout(device, heatmapPipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, heatmapDescriptorSetLayout, nullptr);
   vkDestroyPipeline(device, graphicsPipeline, nullptr);
   vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, drawDescriptorSetLayout, nullptr);
   vkDestroyRenderPass(device, renderpass, nullptr);
   for (VkImageView &imageView : swapchainImageViews) {
     vkDestroyImageView(device, imageView, nullptr);
@@ -146,7 +259,7 @@ void Renderer::createInstance() {
 
   VkApplicationInfo appInfo{};
   appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  appInfo.apiVersion = VK_API_VERSION_1_1; // vkGetPhysicalDeviceFeatures2
   appInfo.pApplicationName = "project";
   appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   appInfo.pEngineName = "No engine";
@@ -165,6 +278,26 @@ void Renderer::createInstance() {
   if (enableValidationLayers)
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
+  // optional, required by VK_EXT_swapchain_maintenance1 (present fences)
+  uint32_t availableCount = 0;
+  vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, nullptr);
+  std::vector<VkExtensionProperties> availableExtensions(availableCount);
+  vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, availableExtensions.data());
+  auto hasExtension = [&](const char *name) {
+    for (const VkExtensionProperties &extension : availableExtensions) {
+      if (strcmp(extension.extensionName, name) == 0) {
+        return true;
+      }
+    }
+    return false;
+  };
+  surfaceMaintenance = hasExtension(VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME) &&
+                       hasExtension(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME);
+  if (surfaceMaintenance) {
+    extensions.push_back(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME);
+    extensions.push_back(VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME);
+  }
+
   VkDebugUtilsMessengerCreateInfoEXT messengerCI{};
   populateDebugMessenger(messengerCI);
 
@@ -245,7 +378,9 @@ void Renderer::selectPhysicalDevice() {
 
     int i = 0;
     for (const VkQueueFamilyProperties queueFamilyProp : queueFamilyProps) {
-      if (queueFamilyProp.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+      // the n-body passes are recorded into the graphics command buffer
+      if ((queueFamilyProp.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+          (queueFamilyProp.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
         graphicsFamilyIndex = i;
       }
 
@@ -296,16 +431,73 @@ void Renderer::createLogicalDevice() {
     queueCreateInfos.push_back(queueCI);
   }
 
+  VkPhysicalDeviceFeatures supportedFeats{};
+  vkGetPhysicalDeviceFeatures(phys_dev, &supportedFeats);
+  if (!supportedFeats.shaderStorageBufferArrayDynamicIndexing) {
+    throw std::runtime_error("Device can not index storage buffer arrays dynamically!");
+  }
+
+  // body.vert picks its body buffer from the body table with a push constant
   VkPhysicalDeviceFeatures devFeats{};
-  // vkGetPhysicalDeviceFeatures(phys_dev, &devFeats);
+  devFeats.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+
+  // optional present feedback for the frame pacer
+  uint32_t extensionCount = 0;
+  vkEnumerateDeviceExtensionProperties(phys_dev, nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(phys_dev, nullptr, &extensionCount, availableExtensions.data());
+  auto hasExtension = [&](const char *name) {
+    for (const VkExtensionProperties &extension : availableExtensions) {
+      if (strcmp(extension.extensionName, name) == 0) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeats{};
+  presentWaitFeats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+  VkPhysicalDevicePresentIdFeaturesKHR presentIdFeats{};
+  presentIdFeats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+  presentIdFeats.pNext = &presentWaitFeats;
+  if (hasExtension(VK_KHR_PRESENT_ID_EXTENSION_NAME) && hasExtension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+    VkPhysicalDeviceFeatures2 supportedFeats2{};
+    supportedFeats2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supportedFeats2.pNext = &presentIdFeats;
+    vkGetPhysicalDeviceFeatures2(phys_dev, &supportedFeats2);
+    presentWaitEnabled = presentIdFeats.presentId && presentWaitFeats.presentWait;
+  }
+
+  // optional present fences, tell when a retired swapchain and its semaphores can go
+  VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT swapchainMaintenanceFeats{};
+  swapchainMaintenanceFeats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+  if (surfaceMaintenance && hasExtension(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME)) {
+    VkPhysicalDeviceFeatures2 supportedFeats2{};
+    supportedFeats2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supportedFeats2.pNext = &swapchainMaintenanceFeats;
+    vkGetPhysicalDeviceFeatures2(phys_dev, &supportedFeats2);
+    presentFencesEnabled = swapchainMaintenanceFeats.swapchainMaintenance1;
+  }
 
+  std::vector<const char *> extensions = deviceExtensions;
+  if (presentWaitEnabled) {
+    extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+    extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+  }
+  if (presentFencesEnabled) {
+    extensions.push_back(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME);
+  }
+
+  // every feature in the chain read back as VK_TRUE
+  swapchainMaintenanceFeats.pNext = presentWaitEnabled ? &presentIdFeats : nullptr;
   VkDeviceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  createInfo.pNext = presentFencesEnabled ? &swapchainMaintenanceFeats : swapchainMaintenanceFeats.pNext;
   createInfo.queueCreateInfoCount = queueCreateInfos.size();
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
   createInfo.pEnabledFeatures = &devFeats;
-  createInfo.enabledExtensionCount = deviceExtensions.size();
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  createInfo.enabledExtensionCount = extensions.size();
+  createInfo.ppEnabledExtensionNames = extensions.data();
   if (enableValidationLayers) {
     createInfo.enabledLayerCount = validationLayers.size();
     createInfo.ppEnabledLayerNames = validationLayers.data();
@@ -320,6 +512,12 @@ void Renderer::createLogicalDevice() {
 
   vkGetDeviceQueue(device, graphicsFamilyIndex, 0, &graphicsQueue);
   vkGetDeviceQueue(device, presentFamilyIndex, 0, &presentQueue);
+
+  if (presentWaitEnabled) {
+    waitForPresentKHR = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+    presentWaitEnabled = waitForPresentKHR != nullptr;
+  }
+  printf("[Info] | Present wait : %s\n", presentWaitEnabled ? "enabled" : "not supported, pacing on frame starts");
 }
 
 void Renderer::createSwapchain() {
@@ -406,7 +604,7 @@ void Renderer::createSwapchain() {
   createInfo.preTransform = surfaceCaps.currentTransform;
   createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   createInfo.clipped = VK_TRUE;
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  createInfo.oldSwapchain = swapchain; // retired, frames in flight still present from it
 
   chk(vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain),
       "Failed to create swapchain!");
@@ -580,6 +778,30 @@ void Renderer::createGraphicsPipeline() {
   // ----- end of color blending -----
 
   // ---------- pipeline layout ----------
+  // per instance data is read from storage buffers : binding 0 the body table, binding 1 the arrows,
+  // binding 2 the visible list and binding 3 the draw arguments, both written by cull.comp.
+  // The view is a uniform buffer with the frame's slice as dynamic offset
+  VkDescriptorSetLayoutBinding drawBindings[DRAW_BINDING_COUNT + 1]{};
+  for (uint32_t i = 0; i < DRAW_BINDING_COUNT; i++) {
+    drawBindings[i].binding = i;
+    drawBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    drawBindings[i].descriptorCount = i == 0 ? BODY_TABLE_SIZE : 1;
+    drawBindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  drawBindings[DRAW_VIEW_BINDING].binding = DRAW_VIEW_BINDING;
+  drawBindings[DRAW_VIEW_BINDING].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  drawBindings[DRAW_VIEW_BINDING].descriptorCount = 1;
+  drawBindings[DRAW_VIEW_BINDING].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
+                                               VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkDescriptorSetLayoutCreateInfo drawSetLayoutInfo{};
+  drawSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  drawSetLayoutInfo.bindingCount = DRAW_BINDING_COUNT + 1;
+  drawSetLayoutInfo.pBindings = drawBindings;
+  chk(vkCreateDescriptorSetLayout(device, &drawSetLayoutInfo, nullptr,
+                                  &drawDescriptorSetLayout),
+      "Failed to create descriptor set layout!");
+
   VkPushConstantRange pushRange{};
   pushRange.offset = 0;
   pushRange.size = sizeof(PushConstantData);
@@ -587,8 +809,8 @@ void Renderer::createGraphicsPipeline() {
 
   VkPipelineLayoutCreateInfo layoutInfo{};
   layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  layoutInfo.setLayoutCount = 0;
-  layoutInfo.pSetLayouts = nullptr;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &drawDescriptorSetLayout;
   layoutInfo.pushConstantRangeCount = 1;
   layoutInfo.pPushConstantRanges = &pushRange;
   vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout);
@@ -658,8 +880,354 @@ void Renderer::createGraphicsPipeline() {
       "Failed to create graphics pipeline!");
   printf("Created graphics pipeline!\n");
 
+  // bodies : one quad per instance (4 vertex strip, corners from gl_VertexIndex), no vertex input.
+  // body.vert reads the body of gl_InstanceIndex from the body table, the fragment shader cuts the
+  // circle out by its signed distance and blends the antialiased edge
+  VkShaderModule bodyShaderModule = createShader("2dGravitySimulation/shader/body.spv");
+  VkShaderModule circleShaderModule = createShader("2dGravitySimulation/shader/circle.spv");
+  stageInfos[0].module = bodyShaderModule;
+  stageInfos[1].module = circleShaderModule;
+
+  inputInfo.vertexBindingDescriptionCount = 0;
+  inputInfo.pVertexBindingDescriptions = nullptr;
+  inputInfo.vertexAttributeDescriptionCount = 0;
+  inputInfo.pVertexAttributeDescriptions = nullptr;
+
+  assemInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+  rasterInfo.cullMode = VK_CULL_MODE_NONE;
+  blendAttachment.blendEnable = VK_TRUE;
+  blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+
+  chk(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+                                &graphicsPipelineCreateInfo, nullptr,
+                                &bodyPipeline),
+      "Failed to create body pipeline!");
+  printf("Created body pipeline!\n");
+
+  // sub-pixel bodies : one point each, no SDF
+  VkShaderModule bodyPointShaderModule = createShader("2dGravitySimulation/shader/body_point.spv");
+  stageInfos[0].module = bodyPointShaderModule;
+  stageInfos[1].module = fragShaderModule;
+  assemInfo.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+  blendAttachment.blendEnable = VK_FALSE;
+  blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+  blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+
+  chk(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+                                &graphicsPipelineCreateInfo, nullptr,
+                                &bodyPointPipeline),
+      "Failed to create body point pipeline!");
+  printf("Created body point pipeline!\n");
+
+  assemInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  rasterInfo.cullMode = VK_CULL_MODE_BACK_BIT;
+
+  // arrows : rect mesh per vertex, arrow.vert reads the arrow of gl_InstanceIndex (binding 1)
+  VkShaderModule arrowShaderModule = createShader("2dGravitySimulation/shader/arrow.spv");
+  stageInfos[0].module = arrowShaderModule;
+
+  inputInfo.vertexBindingDescriptionCount = 1;
+  inputInfo.pVertexBindingDescriptions = &bindingDesc;
+  inputInfo.vertexAttributeDescriptionCount = attributeDesc.size();
+  inputInfo.pVertexAttributeDescriptions = attributeDesc.data();
+
+  chk(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+                                &graphicsPipelineCreateInfo, nullptr,
+                                &arrowPipeline),
+      "Failed to create arrow pipeline!");
+  printf("Created arrow pipeline!\n");
+
+  // heatmap : full-screen triangle without vertex input, the fragment shader reads the heat grid
+  // (binding 0), the colour LUT (binding 1) and the view (binding 2, dynamic offset)
+  std::array<VkDescriptorSetLayoutBinding, 3> heatmapBindings{};
+  for (uint32_t i = 0; i < heatmapBindings.size(); i++) {
+    heatmapBindings[i].binding = i;
+    heatmapBindings[i].descriptorType = i == HEATMAP_VIEW_BINDING ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+                                                                  : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    heatmapBindings[i].descriptorCount = 1;
+    heatmapBindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo heatmapSetLayoutInfo{};
+  heatmapSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  heatmapSetLayoutInfo.bindingCount = heatmapBindings.size();
+  heatmapSetLayoutInfo.pBindings = heatmapBindings.data();
+  chk(vkCreateDescriptorSetLayout(device, &heatmapSetLayoutInfo, nullptr,
+                                  &heatmapDescriptorSetLayout),
+      "Failed to create descriptor set layout!");
+
+  pushRange.size = sizeof(HeatmapPushConstants);
+  pushRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &heatmapDescriptorSetLayout;
+  chk(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &heatmapPipelineLayout),
+      "Failed to create heatmap pipeline layout!");
+
+  VkShaderModule heatmapVertModule = createShader("2dGravitySimulation/shader/heatmap_vert.spv");
+  VkShaderModule heatmapFragModule = createShader("2dGravitySimulation/shader/heatmap_frag.spv");
+  stageInfos[0].module = heatmapVertModule;
+  stageInfos[1].module = heatmapFragModule;
+
+  inputInfo.vertexBindingDescriptionCount = 0;
+  inputInfo.pVertexBindingDescriptions = nullptr;
+  inputInfo.vertexAttributeDescriptionCount = 0;
+  inputInfo.pVertexAttributeDescriptions = nullptr;
+  rasterInfo.cullMode = VK_CULL_MODE_NONE;
+  graphicsPipelineCreateInfo.layout = heatmapPipelineLayout;
+
+  chk(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+                                &graphicsPipelineCreateInfo, nullptr,
+                                &heatmapPipeline),
+      "Failed to create heatmap pipeline!");
+  printf("Created heatmap pipeline!\n");
+
   vkDestroyShaderModule(device, vertexShaderModule, nullptr);
   vkDestroyShaderModule(device, fragShaderModule, nullptr);
+  vkDestroyShaderModule(device, bodyShaderModule, nullptr);
+  vkDestroyShaderModule(device, circleShaderModule, nullptr);
+  vkDestroyShaderModule(device, bodyPointShaderModule, nullptr);
+  vkDestroyShaderModule(device, arrowShaderModule, nullptr);
+  vkDestroyShaderModule(device, heatmapVertModule, nullptr);
+  vkDestroyShaderModule(device, heatmapFragModule, nullptr);
+}
+
+void Renderer::createComputePipeline() {
+  // binding 0 : bodies, 1.. : Barnes-Hut tree (BarnesHutBuffer + 1), then the field arrows,
+  // the heat grid and the view. The field sets are per frame, so the view is a plain uniform buffer
+  std::array<VkDescriptorSetLayoutBinding, FIELD_VIEW_BINDING + 1> bindings{};
+  for (uint32_t i = 0; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = i == FIELD_VIEW_BINDING ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                                         : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+  setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setLayoutInfo.bindingCount = bindings.size();
+  setLayoutInfo.pBindings = bindings.data();
+  chk(vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr,
+                                  &nbodyDescriptorSetLayout),
+      "Failed to create descriptor set layout!");
+
+  VkPushConstantRange pushRange{};
+  pushRange.offset = 0;
+  pushRange.size = sizeof(NBodyPushConstants);
+  pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &nbodyDescriptorSetLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushRange;
+  chk(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &nbodyPipelineLayout),
+      "Failed to create compute pipeline layout!");
+
+  // forces (tiled all pairs) / integration / Barnes-Hut tree build and forces, all share one layout
+  nbodyForcePipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/nbody.spv");
+  nbodyIntegratePipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/integrate.spv");
+  bhBoundsPipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/bh_bounds.spv");
+  bhMortonPipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/bh_morton.spv");
+  radixHistogramPipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/radix_histogram.spv");
+  radixScanPipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/radix_scan.spv");
+  radixScatterPipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/radix_scatter.spv");
+  bvhBuildPipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/bvh_build.spv");
+  bvhMassPipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/bvh_mass.spv");
+  bhForcePipeline = createComputeShaderPipeline(nbodyPipelineLayout, "2dGravitySimulation/shader/bh_force.spv");
+
+  // vector field, same descriptor set layout with its own push constants
+  pushRange.size = sizeof(FieldPushConstants);
+  chk(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &fieldPipelineLayout),
+      "Failed to create compute pipeline layout!");
+  fieldPipeline = createComputeShaderPipeline(fieldPipelineLayout, "2dGravitySimulation/shader/field.spv");
+  heatGridPipeline = createComputeShaderPipeline(fieldPipelineLayout, "2dGravitySimulation/shader/heatgrid.spv");
+
+  // culling, reads the body table and writes the visible list / draw arguments of the draw set
+  pushRange.size = sizeof(CullPushConstants);
+  layoutInfo.pSetLayouts = &drawDescriptorSetLayout;
+  chk(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &cullPipelineLayout),
+      "Failed to create compute pipeline layout!");
+  cullPipeline = createComputeShaderPipeline(cullPipelineLayout, "2dGravitySimulation/shader/cull.spv");
+  printf("Created compute pipelines!\n");
+}
+
+VkPipeline Renderer::createComputeShaderPipeline(VkPipelineLayout layout,
+                                                 const char *filename) {
+  VkShaderModule computeShaderModule = createShader(filename);
+
+  VkPipelineShaderStageCreateInfo computeShaderCI{};
+  computeShaderCI.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  computeShaderCI.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  computeShaderCI.module = computeShaderModule;
+  computeShaderCI.pName = "main";
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.layout = layout;
+  pipelineInfo.stage = computeShaderCI;
+
+  VkPipeline pipeline;
+  chk(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+                               nullptr, &pipeline),
+      "Failed to create compute pipeline!");
+
+  vkDestroyShaderModule(device, computeShaderModule, nullptr);
+  return pipeline;
+}
+
+void Renderer::createDescriptorPool() {
+  std::array<VkDescriptorPoolSize, 3> poolSizes{};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[0].descriptorCount = (HEATMAP_GRID_BINDING + 1) * (1 + MAX_FRAME_IN_FLIGHT) + 2 +
+                                 BODY_TABLE_SIZE + DRAW_BINDING_COUNT - 1;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // view of the n-body / field sets
+  poolSizes[1].descriptorCount = 1 + MAX_FRAME_IN_FLIGHT;
+  poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC; // view of the heatmap / draw sets
+  poolSizes[2].descriptorCount = 2;
+
+  // the n-body set, one vector field set per frame in flight, the heatmap set and the draw set
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = poolSizes.size();
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = 3 + MAX_FRAME_IN_FLIGHT;
+  chk(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool),
+      "Failed to create descriptor pool!");
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &nbodyDescriptorSetLayout;
+  chk(vkAllocateDescriptorSets(device, &allocInfo, &nbodyDescriptorSet),
+      "Failed to allocate descriptor set!");
+
+  std::vector<VkDescriptorSetLayout> fieldLayouts(MAX_FRAME_IN_FLIGHT,
+                                                  nbodyDescriptorSetLayout);
+  fieldDescriptorSets.resize(MAX_FRAME_IN_FLIGHT);
+  allocInfo.descriptorSetCount = fieldLayouts.size();
+  allocInfo.pSetLayouts = fieldLayouts.data();
+  chk(vkAllocateDescriptorSets(device, &allocInfo, fieldDescriptorSets.data()),
+      "Failed to allocate descriptor set!");
+
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &heatmapDescriptorSetLayout;
+  chk(vkAllocateDescriptorSets(device, &allocInfo, &heatmapDescriptorSet),
+      "Failed to allocate descriptor set!");
+
+  allocInfo.pSetLayouts = &drawDescriptorSetLayout;
+  chk(vkAllocateDescriptorSets(device, &allocInfo, &drawDescriptorSet),
+      "Failed to allocate descriptor set!");
+
+  // the view never moves : field set i reads slice i, the heatmap / draw sets get the slice as dynamic offset
+  std::vector<VkDescriptorBufferInfo> viewInfos(MAX_FRAME_IN_FLIGHT + 1);
+  std::vector<VkWriteDescriptorSet> writes(MAX_FRAME_IN_FLIGHT + 2);
+  for (uint32_t i = 0; i < writes.size(); i++) {
+    VkDescriptorBufferInfo &viewInfo = viewInfos[std::min<uint32_t>(i, MAX_FRAME_IN_FLIGHT)];
+    viewInfo.buffer = viewBuffer;
+    viewInfo.offset = i < MAX_FRAME_IN_FLIGHT ? viewStride * i : 0;
+    viewInfo.range = sizeof(ViewUniforms);
+
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].descriptorCount = 1;
+    writes[i].pBufferInfo = &viewInfo;
+    if (i < MAX_FRAME_IN_FLIGHT) {
+      writes[i].dstSet = fieldDescriptorSets[i];
+      writes[i].dstBinding = FIELD_VIEW_BINDING;
+      writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    } else {
+      writes[i].dstSet = i == MAX_FRAME_IN_FLIGHT ? heatmapDescriptorSet : drawDescriptorSet;
+      writes[i].dstBinding = i == MAX_FRAME_IN_FLIGHT ? HEATMAP_VIEW_BINDING : DRAW_VIEW_BINDING;
+      writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    }
+  }
+  vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+}
+
+// One ViewUniforms slice per frame in flight, each at a valid uniform buffer offset
+void Renderer::createViewBuffer() {
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(phys_dev, &props);
+  VkDeviceSize alignment = std::max<VkDeviceSize>(props.limits.minUniformBufferOffsetAlignment, 1);
+  viewStride = (sizeof(ViewUniforms) + alignment - 1) / alignment * alignment;
+
+  createBuffer(viewStride * MAX_FRAME_IN_FLIGHT, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               viewBuffer, viewBufferMemory);
+  vkMapMemory(device, viewBufferMemory, 0, VK_WHOLE_SIZE, 0,
+              reinterpret_cast<void **>(&viewMapped));
+}
+
+// Points the draw set at the current body / arrow / culling buffers. Written once per (re)allocation,
+// never per frame or per object : the passes only pick a body table slot with a push constant
+void Renderer::writeDrawDescriptorSet() {
+  // every slot has to hold a valid buffer, missing ones repeat one that exists
+  VkBuffer fallback = bodyBuffer != VK_NULL_HANDLE ? bodyBuffer
+                      : !hostBodyBuffers.empty()   ? hostBodyBuffers[0]
+                                                   : arrowBuffer;
+  if (fallback == VK_NULL_HANDLE)
+    return;
+
+  std::array<VkDescriptorBufferInfo, BODY_TABLE_SIZE> bodyInfos{};
+  for (uint32_t i = 0; i < bodyInfos.size(); i++) {
+    VkBuffer buffer = i == BODY_TABLE_GPU ? bodyBuffer
+                      : hostBodyBuffers.empty() ? VK_NULL_HANDLE
+                                                : hostBodyBuffers[i - BODY_TABLE_HOST];
+    bodyInfos[i].buffer = buffer != VK_NULL_HANDLE ? buffer : fallback;
+    bodyInfos[i].offset = 0;
+    bodyInfos[i].range = VK_WHOLE_SIZE;
+  }
+
+  // arrows, visible list, draw arguments
+  VkBuffer buffers[DRAW_BINDING_COUNT - 1] = {arrowBuffer, cullVisibleBuffer, cullArgsBuffer};
+  VkDescriptorBufferInfo bufferInfos[DRAW_BINDING_COUNT - 1]{};
+  for (uint32_t i = 0; i < DRAW_BINDING_COUNT - 1; i++) {
+    bufferInfos[i].buffer = buffers[i] != VK_NULL_HANDLE ? buffers[i] : fallback;
+    bufferInfos[i].offset = 0;
+    bufferInfos[i].range = VK_WHOLE_SIZE;
+  }
+
+  std::array<VkWriteDescriptorSet, DRAW_BINDING_COUNT> writes{};
+  for (uint32_t i = 0; i < writes.size(); i++) {
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = drawDescriptorSet;
+    writes[i].dstBinding = i;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[i].descriptorCount = 1;
+    writes[i].pBufferInfo = i == 0 ? nullptr : &bufferInfos[i - 1];
+  }
+  writes[0].descriptorCount = bodyInfos.size();
+  writes[0].pBufferInfo = bodyInfos.data();
+  vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+}
+
+// Visible list for up to count bodies, and the two indirect draws. Callers have waited for the device
+void Renderer::ensureCullBuffers(uint32_t count) {
+  if (cullArgsBuffer == VK_NULL_HANDLE) {
+    createBuffer(sizeof(VkDrawIndirectCommand) * 2,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cullArgsBuffer,
+                 cullArgsBufferMemory);
+  }
+  if (count <= cullVisibleCapacity)
+    return;
+
+  if (cullVisibleBuffer != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device, cullVisibleBuffer, nullptr);
+    vkFreeMemory(device, cullVisibleBufferMemory, nullptr);
+  }
+  // cull.comp finds the back of the list (points) from the buffer length, so it is exactly count
+  cullVisibleCapacity = count;
+  createBuffer(sizeof(uint32_t) * cullVisibleCapacity,
+               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cullVisibleBuffer,
+               cullVisibleBufferMemory);
 }
 
 void Renderer::createFramebuffer() {
@@ -687,11 +1255,20 @@ void Renderer::createCommandPool() {
 
   chk(vkCreateCommandPool(device, &createInfo, nullptr, &commandPool),
       "Failed to create command pool!");
+
+  // one pool per (range worker, frame in flight), only ever reset as a whole
+  createInfo.flags = 0;
+  rangeCommandPools.resize(RENDER_RANGE_COUNT * MAX_FRAME_IN_FLIGHT);
+  for (VkCommandPool &pool : rangeCommandPools) {
+    chk(vkCreateCommandPool(device, &createInfo, nullptr, &pool),
+        "Failed to create command pool!");
+  }
   printf("Created command pool!\n");
 }
 
 void Renderer::createCommandBuffers() {
-  commandBuffers.resize(MAX_FRAME_IN_FLIGHT);
+  commandBuffers.resize(MAX_FRAME_IN_FLIGHT * swapchainImages.size());
+  commandBufferRecorded.assign(commandBuffers.size(), false);
 
   VkCommandBufferAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -701,9 +1278,42 @@ void Renderer::createCommandBuffers() {
 
   chk(vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()),
       "Failed to create command buffers!");
+
+  // secondaries stay allocated, their pool is reset before they are recorded again
+  if (rangeCommandBuffers.empty()) {
+    rangeCommandBuffers.resize(rangeCommandPools.size());
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = 1;
+    for (size_t i = 0; i < rangeCommandPools.size(); i++) {
+      allocInfo.commandPool = rangeCommandPools[i];
+      chk(vkAllocateCommandBuffers(device, &allocInfo, &rangeCommandBuffers[i]),
+          "Failed to create command buffers!");
+    }
+  }
   printf("Created command buffers!\n");
 }
 
+// Something a recording depends on changed. Each command buffer is recorded again the next time its
+// frame comes around, after its fence : never while pending
+void Renderer::invalidateCommandBuffers() {
+  commandBufferRecorded.assign(commandBufferRecorded.size(), false);
+}
+
+// Command buffer recordings per second, printed when the rate changes. Stays at 0 while nothing changes
+void Renderer::reportCommandBufferRecords() {
+  double now = glfwGetTime();
+  if (now - lastRecordReport < 1.0)
+    return;
+
+  uint32_t rate = static_cast<uint32_t>(commandBufferRecords / (now - lastRecordReport) + 0.5);
+  if (rate != lastRecordRate) {
+    printf("[Info] | command buffer records : %u/s\n", rate);
+    lastRecordRate = rate;
+  }
+  commandBufferRecords = 0;
+  lastRecordReport = now;
+}
+
 uint32_t Renderer::findMemoryType(uint32_t typeFilter,
                                   VkMemoryPropertyFlags properties) {
   VkPhysicalDeviceMemoryProperties memProps;
@@ -841,6 +1451,273 @@ void Renderer::createIndexBuffer(const std::vector<uint16_t> *indices,
   vkFreeMemory(device, stagingBufferMemory, nullptr);
 }
 
+void Renderer::uploadBodies(const std::vector<CircleObject> &circles,
+                            float gravity, float dt, float softening,
+                            float theta) {
+  vkDeviceWaitIdle(device);
+
+  uint32_t count = static_cast<uint32_t>(circles.size());
+  VkDeviceSize bufferSize = sizeof(GpuBody) * std::max<uint32_t>(count, 1);
+
+  if (count > bodyCapacity) {
+    if (bodyBuffer != VK_NULL_HANDLE) {
+      vkDestroyBuffer(device, bodyBuffer, nullptr);
+      vkFreeMemory(device, bodyBufferMemory, nullptr);
+    }
+    // stays on the device, the compute passes update it and the body pipeline draws from it
+    createBuffer(bufferSize,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, bodyBuffer,
+                 bodyBufferMemory);
+    bodyCapacity = count;
+    ensureCullBuffers(std::max<uint32_t>(count, 1));
+
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = bodyBuffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = nbodyDescriptorSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+
+  std::vector<GpuBody> bodies(count);
+  for (uint32_t i = 0; i < count; i++) {
+    bodies[i] = GpuBody{.position = circles[i].position,
+                        .velocity = circles[i].velocity,
+                        .color = glm::vec4(circles[i].color, 1.0f),
+                        .mass = circles[i].mass,
+                        .radius = circles[i].radius,
+                        .acceleration = glm::vec2(0.0f),
+                        .impulse = glm::vec2(0.0f),
+                        .padding = glm::vec2(0.0f)};
+  }
+
+  if (count > 0) {
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 stagingBuffer, stagingBufferMemory);
+
+    void *data;
+    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+    memcpy(data, bodies.data(), sizeof(GpuBody) * count);
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    copyBuffer(stagingBuffer, bodyBuffer, sizeof(GpuBody) * count);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingBufferMemory, nullptr);
+  }
+
+  if (theta > 0.0f && count > treeCapacity) {
+    destroyTreeBuffers();
+    createTreeBuffers(count);
+  }
+  if (count > bodyReadbackCapacity) {
+    destroyBodyReadback();
+    createBodyReadback(count);
+  }
+
+  bodyCount = count;
+  nbodyParams = NBodyPushConstants{
+      .count = count,
+      .gravity = gravity,
+      .dt = dt,
+      .softening = softening,
+      .theta = theta,
+      .shift = 0,
+      .groupCount = (count + NBODY_TILE_SIZE - 1) / NBODY_TILE_SIZE,
+      .padding = 0};
+  if (arrowBuffer != VK_NULL_HANDLE || heatGridBuffer != VK_NULL_HANDLE) {
+    writeFieldDescriptorSets(); // the field now reads the body SSBO
+  }
+  writeDrawDescriptorSet();
+  invalidateCommandBuffers();
+  if (count > 0) {
+    recordBodyReadback();
+  }
+  printf("[Info] | GPU n-body : %u bodies, %.2f MiB, %s\n", count,
+         bufferSize / (1024.0 * 1024.0),
+         theta > 0.0f ? "Barnes-Hut" : "all pairs");
+}
+
+void Renderer::createTreeBuffers(uint32_t count) {
+  uint32_t groupCount = (count + NBODY_TILE_SIZE - 1) / NBODY_TILE_SIZE;
+  VkDeviceSize sizes[BH_BUFFER_COUNT];
+  sizes[BH_KEYS_A] = sizes[BH_VALUES_A] = sizeof(uint32_t) * count;
+  sizes[BH_KEYS_B] = sizes[BH_VALUES_B] = sizeof(uint32_t) * count;
+  sizes[BH_HISTOGRAM] = sizeof(uint32_t) * 256 * groupCount;
+  sizes[BH_NODES] = BH_NODE_SIZE * (2 * count - 1);
+  sizes[BH_FLAGS] = sizeof(uint32_t) * std::max<uint32_t>(count - 1, 1);
+  sizes[BH_BOUNDS] = sizeof(uint32_t) * 4;
+
+  VkDeviceSize total = 0;
+  std::array<VkDescriptorBufferInfo, BH_BUFFER_COUNT> bufferInfos{};
+  std::array<VkWriteDescriptorSet, BH_BUFFER_COUNT> writes{};
+  for (uint32_t i = 0; i < BH_BUFFER_COUNT; i++) {
+    // never leaves the device, the tree is rebuilt from the bodies every step
+    createBuffer(sizes[i],
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, treeBuffers[i],
+                 treeBufferMemory[i]);
+    total += sizes[i];
+
+    bufferInfos[i].buffer = treeBuffers[i];
+    bufferInfos[i].offset = 0;
+    bufferInfos[i].range = VK_WHOLE_SIZE;
+
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = nbodyDescriptorSet;
+    writes[i].dstBinding = 1 + i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[i].pBufferInfo = &bufferInfos[i];
+  }
+  vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+  treeCapacity = count;
+
+  printf("[Info] | Barnes-Hut tree : %u leaves, %.2f MiB\n", count,
+         total / (1024.0 * 1024.0));
+}
+
+void Renderer::destroyTreeBuffers() {
+  for (uint32_t i = 0; i < BH_BUFFER_COUNT; i++) {
+    if (treeBuffers[i] != VK_NULL_HANDLE) {
+      vkDestroyBuffer(device, treeBuffers[i], nullptr);
+      vkFreeMemory(device, treeBufferMemory[i], nullptr);
+      treeBuffers[i] = VK_NULL_HANDLE;
+    }
+  }
+  treeCapacity = 0;
+}
+
+// Host visible copies of the body SSBO for snapshots, one per frame in flight so a copy never waits for
+// another frame
+void Renderer::createBodyReadback(uint32_t count) {
+  VkDeviceSize bufferSize = sizeof(GpuBody) * count;
+  bodyReadbackBuffers.resize(MAX_FRAME_IN_FLIGHT);
+  bodyReadbackBufferMemory.resize(MAX_FRAME_IN_FLIGHT);
+  bodyReadbackMapped.resize(MAX_FRAME_IN_FLIGHT);
+  for (int i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
+    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 bodyReadbackBuffers[i], bodyReadbackBufferMemory[i]);
+    void *data;
+    vkMapMemory(device, bodyReadbackBufferMemory[i], 0, bufferSize, 0, &data);
+    bodyReadbackMapped[i] = static_cast<GpuBody *>(data);
+  }
+
+  if (bodyReadbackCommandBuffers.empty()) {
+    bodyReadbackCommandBuffers.resize(MAX_FRAME_IN_FLIGHT);
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = bodyReadbackCommandBuffers.size();
+    allocInfo.commandPool = commandPool;
+    chk(vkAllocateCommandBuffers(device, &allocInfo, bodyReadbackCommandBuffers.data()),
+        "Failed to create command buffers!");
+  }
+  bodyReadbackCapacity = count;
+}
+
+void Renderer::destroyBodyReadback() {
+  for (size_t i = 0; i < bodyReadbackBuffers.size(); i++) {
+    vkDestroyBuffer(device, bodyReadbackBuffers[i], nullptr);
+    vkFreeMemory(device, bodyReadbackBufferMemory[i], nullptr);
+  }
+  bodyReadbackBuffers.clear();
+  bodyReadbackBufferMemory.clear();
+  bodyReadbackMapped.clear();
+  bodyReadbackCapacity = 0;
+  bodySnapshotInFlight = false;
+  bodySnapshotReady = false;
+}
+
+// Submitted right behind the frame's own command buffer : the body step of the frame is done writing,
+// the next frame's step waits for the copy
+void Renderer::recordBodyReadback() {
+  for (int i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
+    VkCommandBuffer commandbuffer = bodyReadbackCommandBuffers[i];
+    vkResetCommandBuffer(commandbuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    chk(vkBeginCommandBuffer(commandbuffer, &beginInfo),
+        "Failed to begin command buffer!");
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = bodyBuffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                         &barrier, 0, nullptr);
+
+    VkBufferCopy region{};
+    region.size = sizeof(GpuBody) * bodyCount;
+    vkCmdCopyBuffer(commandbuffer, bodyBuffer, bodyReadbackBuffers[i], 1, &region);
+
+    // the next body step overwrites what was copied, the host reads the copy after the fence
+    vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 0, nullptr);
+    barrier.buffer = bodyReadbackBuffers[i];
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                         &barrier, 0, nullptr);
+
+    chk(vkEndCommandBuffer(commandbuffer), "Failed to record command buffer!");
+  }
+}
+
+void Renderer::requestBodySnapshot(uint64_t step) {
+  if (bodyCount == 0 || bodySnapshotRequested || bodySnapshotInFlight || bodySnapshotReady) {
+    return; // one snapshot at a time
+  }
+  bodySnapshotRequested = true;
+  bodySnapshotStep = step;
+}
+
+bool Renderer::takeBodySnapshot(std::vector<CircleObject> &circles, uint64_t &step) {
+  if (!bodySnapshotReady) {
+    return false;
+  }
+  bodySnapshotReady = false;
+
+  const GpuBody *bodies = bodyReadbackMapped[bodySnapshotSlot];
+  circles.resize(bodyCount);
+  for (uint32_t i = 0; i < bodyCount; i++) {
+    circles[i].position = bodies[i].position;
+    circles[i].velocity = bodies[i].velocity;
+    circles[i].net_force = bodies[i].acceleration * bodies[i].mass;
+    circles[i].color = glm::vec3(bodies[i].color);
+    circles[i].mass = bodies[i].mass;
+    circles[i].radius = bodies[i].radius;
+  }
+  step = bodySnapshotStep;
+  return true;
+}
+
 void Renderer::createSyncObjects() {
 
   imageAvailableSemaphores.resize(MAX_FRAME_IN_FLIGHT);
@@ -872,19 +1749,81 @@ void Renderer::createSyncObjects() {
   printf("Created semaphore / fence!\n");
 }
 
-void Renderer::cleanupSwapchain() {
-  for (VkFramebuffer fb : framebuffers) {
-    vkDestroyFramebuffer(device, fb, nullptr);
+// Destroyed once every frame submitted so far has retired. Nothing submitted later uses it
+void Renderer::deferDeletion(std::function<void()> destroy) {
+  deletionQueue.push_back({frameNumber, std::move(destroy)});
+}
+
+// After the fence of frame frameNumber - MAX_FRAME_IN_FLIGHT was waited on : every frame up to it retired
+void Renderer::collectDeletions() {
+  while (!deletionQueue.empty() &&
+         deletionQueue.front().frame + MAX_FRAME_IN_FLIGHT <= frameNumber + 1) {
+    deletionQueue.front().destroy();
+    deletionQueue.pop_front();
   }
 
-  for (VkImageView view : swapchainImageViews) {
-    vkDestroyImageView(device, view, nullptr);
+  // presents to the current swapchain that completed hand their fence back
+  for (size_t i = 0; i < presentFences.size();) {
+    if (vkGetFenceStatus(device, presentFences[i]) == VK_SUCCESS) {
+      vkResetFences(device, 1, &presentFences[i]);
+      freePresentFences.push_back(presentFences[i]);
+      presentFences[i] = presentFences.back();
+      presentFences.pop_back();
+    } else {
+      i++;
+    }
   }
 
-  vkDestroySwapchainKHR(device, swapchain, nullptr);
+  while (!retiredSwapchains.empty()) {
+    RetiredSwapchain &retired = retiredSwapchains.front();
+    bool presented = true;
+    if (presentFencesEnabled) {
+      for (VkFence fence : retired.presentFences) {
+        presented = presented && vkGetFenceStatus(device, fence) == VK_SUCCESS;
+      }
+    } else {
+      presented = acquireCount >= retired.acquireCount;
+    }
+    if (!presented || retired.frame + MAX_FRAME_IN_FLIGHT > frameNumber + 1) {
+      break;
+    }
+    destroyRetiredSwapchain(retired);
+    retiredSwapchains.pop_front();
+  }
 }
 
-void Renderer::recreateSwapchain(uint32_t imageIndex) {
+VkFence Renderer::takePresentFence() {
+  VkFence fence;
+  if (!freePresentFences.empty()) {
+    fence = freePresentFences.back();
+    freePresentFences.pop_back();
+    return fence;
+  }
+
+  VkFenceCreateInfo fenceCreateInfo{};
+  fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  chk(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence),
+      "Failed to create present fence!");
+  return fence;
+}
+
+// Its present fences go back to the pool
+void Renderer::destroyRetiredSwapchain(RetiredSwapchain &retired) {
+  for (VkSemaphore semaphore : retired.renderFinishedSemaphores) {
+    vkDestroySemaphore(device, semaphore, nullptr);
+  }
+  if (!retired.presentFences.empty()) {
+    vkResetFences(device, retired.presentFences.size(), retired.presentFences.data());
+    freePresentFences.insert(freePresentFences.end(), retired.presentFences.begin(),
+                             retired.presentFences.end());
+  }
+  vkDestroySwapchainKHR(device, retired.swapchain, nullptr);
+}
+
+// No device wait : frames in flight keep rendering to and presenting from the old swapchain, which is
+// passed as oldSwapchain. its views, framebuffers and command buffers go once they retired, the swapchain
+// and its render finished semaphores once their presents are done (collectDeletions)
+void Renderer::recreateSwapchain() {
   int width, height;
   glfwGetFramebufferSize(window, &width, &height);
   while (width == 0 || height == 0) {
@@ -894,44 +1833,557 @@ void Renderer::recreateSwapchain(uint32_t imageIndex) {
     glfwPollEvents();
   }
 
-  vkDeviceWaitIdle(device);
-  cleanupSwapchain();
+  double start = glfwGetTime();
 
-  if (imageIndex != -1) {
-    vkDestroySemaphore(device, renderFinishedSemaphores[imageIndex], nullptr);
-    VkSemaphoreCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    vkCreateSemaphore(device, &createInfo, nullptr, &renderFinishedSemaphores[imageIndex]);
-  }
+  std::vector<VkImageView> oldImageViews = swapchainImageViews;
+  std::vector<VkFramebuffer> oldFramebuffers = framebuffers;
+  std::vector<VkCommandBuffer> oldCommandBuffers = commandBuffers;
+  deferDeletion([=, this]() {
+    vkFreeCommandBuffers(device, commandPool, oldCommandBuffers.size(), oldCommandBuffers.data());
+    for (VkFramebuffer fb : oldFramebuffers) {
+      vkDestroyFramebuffer(device, fb, nullptr);
+    }
+    for (VkImageView view : oldImageViews) {
+      vkDestroyImageView(device, view, nullptr);
+    }
+  });
+  // without present fences : once the newer swapchains acquired as many images as this one had
+  retiredSwapchains.push_back({swapchain, renderFinishedSemaphores, std::move(presentFences),
+                               acquireCount + swapchainImages.size(), frameNumber});
+  presentFences.clear();
 
   createSwapchain();
   createImageViews();
   createFramebuffer();
+
+  // per swapchain image, the image count may have changed
+  VkSemaphoreCreateInfo semaphoreCreateInfo{};
+  semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  renderFinishedSemaphores.resize(swapchainImages.size());
+  for (size_t i = 0; i < swapchainImages.size(); i++) {
+    chk(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr,
+                          &renderFinishedSemaphores[i]),
+        "Failed to create render_finished semaphore!");
+  }
+
+  // the recordings point at the old framebuffers. the range secondaries are re-recorded with them
+  createCommandBuffers();
+
+  printf("[Info] | Swapchain recreated : %ux%u, %zu images, stall %.2f ms\n",
+         imageExtent.width, imageExtent.height, swapchainImages.size(),
+         (glfwGetTime() - start) * 1000.0);
 }
 
-void Renderer::recordCommandBuffer(VkCommandBuffer commandbuffer,
-                                   uint32_t imageIndex, const Scene &scene) {
-  VkCommandBufferBeginInfo cmdBufBeginInfo{};
-  cmdBufBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  chk(vkBeginCommandBuffer(commandbuffer, &cmdBufBeginInfo),
-      "Failed to begin command buffer!");
+void Renderer::setVectorField(uint32_t cols, uint32_t rows, float gravity) {
+  vkDeviceWaitIdle(device);
+  if (arrowBuffer != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device, arrowBuffer, nullptr);
+    vkFreeMemory(device, arrowBufferMemory, nullptr);
+    arrowBuffer = VK_NULL_HANDLE;
+  }
 
-  VkClearValue clearColor{};
-  clearColor.color = {{.0f, .0f, .0f, 1.0f}};
+  fieldCols = cols;
+  fieldRows = rows;
+  fieldGravity = gravity;
+  invalidateCommandBuffers();
+  if (cols * rows == 0)
+    return;
 
-  VkRenderPassBeginInfo renderpassBeginInfo{};
-  renderpassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderpassBeginInfo.renderPass = renderpass;
-  renderpassBeginInfo.renderArea = {.offset = {0, 0}, .extent = imageExtent};
-  renderpassBeginInfo.framebuffer = framebuffers[imageIndex];
-  renderpassBeginInfo.clearValueCount = 1;
-  renderpassBeginInfo.pClearValues = &clearColor;
+  // written by field.comp, read by arrow.vert. Never touched by the CPU
+  VkDeviceSize bufferSize = sizeof(Arrow) * cols * rows;
+  createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, arrowBuffer,
+               arrowBufferMemory);
 
-  vkCmdBeginRenderPass(commandbuffer, &renderpassBeginInfo,
-                       VK_SUBPASS_CONTENTS_INLINE);
-  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                    graphicsPipeline);
+  if (hostBodyBuffers.empty()) {
+    uploadHostBodies({}); // binding 0 has to be valid even without bodies
+  }
+  writeFieldDescriptorSets();
+  writeDrawDescriptorSet();
+  printf("[Info] | Vector field : %u x %u arrows, %.2f MiB\n", cols, rows,
+         bufferSize / (1024.0 * 1024.0));
+}
+
+void Renderer::writeFieldDescriptorSets() {
+  for (uint32_t i = 0; i < fieldDescriptorSets.size(); i++) {
+    VkDescriptorBufferInfo bodyInfo{};
+    bodyInfo.buffer = bodyCount > 0 ? bodyBuffer : hostBodyBuffers[i];
+    bodyInfo.offset = 0;
+    bodyInfo.range = VK_WHOLE_SIZE;
+
+    VkDescriptorBufferInfo arrowInfo{};
+    arrowInfo.buffer = arrowBuffer;
+    arrowInfo.offset = 0;
+    arrowInfo.range = VK_WHOLE_SIZE;
+
+    VkDescriptorBufferInfo heatGridInfo{};
+    heatGridInfo.buffer = heatGridBuffer;
+    heatGridInfo.offset = 0;
+    heatGridInfo.range = VK_WHOLE_SIZE;
+
+    std::array<VkWriteDescriptorSet, 3> writes{};
+    for (VkWriteDescriptorSet &write : writes) {
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = fieldDescriptorSets[i];
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    }
+    // arrows / heat grid only once they exist, each pass only touches its own binding
+    uint32_t writeCount = 0;
+    writes[writeCount].dstBinding = 0;
+    writes[writeCount++].pBufferInfo = &bodyInfo;
+    if (arrowBuffer != VK_NULL_HANDLE) {
+      writes[writeCount].dstBinding = FIELD_ARROW_BINDING;
+      writes[writeCount++].pBufferInfo = &arrowInfo;
+    }
+    if (heatGridBuffer != VK_NULL_HANDLE) {
+      writes[writeCount].dstBinding = HEATMAP_GRID_BINDING;
+      writes[writeCount++].pBufferInfo = &heatGridInfo;
+    }
+    vkUpdateDescriptorSets(device, writeCount, writes.data(), 0, nullptr);
+  }
+}
+
+// CPU simulation : copies the bodies into this frame's mapped buffer, for the circle draw and the field
+void Renderer::uploadHostBodies(const std::vector<CircleObject> &circles) {
+  if (hostBodyBuffers.empty() || circles.size() > hostBodyCapacity) {
+    vkDeviceWaitIdle(device);
+    for (size_t i = 0; i < hostBodyBuffers.size(); i++) {
+      vkDestroyBuffer(device, hostBodyBuffers[i], nullptr);
+      vkFreeMemory(device, hostBodyBufferMemory[i], nullptr);
+    }
+
+    hostBodyCapacity = std::max<uint32_t>(circles.size(), 1);
+    hostBodyBuffers.resize(MAX_FRAME_IN_FLIGHT);
+    hostBodyBufferMemory.resize(MAX_FRAME_IN_FLIGHT);
+    hostBodyMapped.resize(MAX_FRAME_IN_FLIGHT);
+    for (int i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
+      createBuffer(sizeof(GpuBody) * hostBodyCapacity,
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   hostBodyBuffers[i], hostBodyBufferMemory[i]);
+      vkMapMemory(device, hostBodyBufferMemory[i], 0, VK_WHOLE_SIZE, 0,
+                  reinterpret_cast<void **>(&hostBodyMapped[i]));
+    }
+    ensureCullBuffers(hostBodyCapacity);
+    if (arrowBuffer != VK_NULL_HANDLE || heatGridBuffer != VK_NULL_HANDLE) {
+      writeFieldDescriptorSets();
+    }
+    writeDrawDescriptorSet();
+    invalidateCommandBuffers(); // the culling pass is sized for the capacity
+  }
+
+  GpuBody *bodies = hostBodyMapped[currentFrame];
+  for (size_t i = 0; i < circles.size(); i++) {
+    bodies[i].position = circles[i].position;
+    bodies[i].color = glm::vec4(circles[i].color, 1.0f);
+    bodies[i].mass = circles[i].mass;
+    bodies[i].radius = circles[i].radius;
+  }
+}
+
+// Samples the field at every arrow into the arrow buffer. The cost is arrows x bodies on the GPU,
+// the CPU only records one dispatch
+void Renderer::recordField(VkCommandBuffer commandbuffer) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = arrowBuffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+
+  // the previous frame's draw is done reading the arrows
+  barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  // field.comp lays the cols x rows cells over this frame's view
+  FieldPushConstants push{};
+  push.cols = fieldCols;
+  push.rows = fieldRows;
+  push.gravity = fieldGravity;
+
+  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fieldPipeline);
+  vkCmdBindDescriptorSets(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          fieldPipelineLayout, 0, 1,
+                          &fieldDescriptorSets[currentFrame], 0, nullptr);
+  vkCmdPushConstants(commandbuffer, fieldPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FieldPushConstants),
+                     &push);
+  vkCmdDispatch(commandbuffer,
+                (fieldCols * fieldRows + FIELD_GROUP_SIZE - 1) / FIELD_GROUP_SIZE,
+                1, 1);
+
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+}
+
+void Renderer::setHeatmap(bool enabled) {
+  heatmapEnabled = enabled;
+  invalidateCommandBuffers();
+  if (!enabled || heatLutBuffer != VK_NULL_HANDLE)
+    return;
+
+  // first use. The grid itself follows the window size, see ensureHeatGrid
+  vkDeviceWaitIdle(device);
+  createHeatLut();
+  if (hostBodyBuffers.empty()) {
+    uploadHostBodies({}); // binding 0 has to be valid even without bodies
+  }
+}
+
+// Dark to bright colour ramp, interpolated from a few stops and uploaded once
+void Renderer::createHeatLut() {
+  const glm::vec3 stops[] = {
+      {0.00f, 0.00f, 0.02f}, {0.23f, 0.04f, 0.42f}, {0.73f, 0.21f, 0.33f},
+      {0.98f, 0.55f, 0.04f}, {0.99f, 1.00f, 0.64f}};
+  const int segments = sizeof(stops) / sizeof(stops[0]) - 1;
+
+  std::vector<glm::vec4> lut(HEATMAP_LUT_SIZE);
+  for (int i = 0; i < HEATMAP_LUT_SIZE; i++) {
+    float t = static_cast<float>(i) / (HEATMAP_LUT_SIZE - 1) * segments;
+    int segment = std::min(static_cast<int>(t), segments - 1);
+    lut[i] = glm::vec4(glm::mix(stops[segment], stops[segment + 1], t - segment), 1.0f);
+  }
+
+  VkDeviceSize bufferSize = sizeof(glm::vec4) * lut.size();
+
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               stagingBuffer, stagingBufferMemory);
+
+  void *data;
+  vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+  memcpy(data, lut.data(), bufferSize);
+  vkUnmapMemory(device, stagingBufferMemory);
+
+  createBuffer(bufferSize,
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, heatLutBuffer,
+               heatLutBufferMemory);
+
+  copyBuffer(stagingBuffer, heatLutBuffer, bufferSize);
+
+  vkDestroyBuffer(device, stagingBuffer, nullptr);
+  vkFreeMemory(device, stagingBufferMemory, nullptr);
+}
+
+// One heat grid sample every HEATMAP_CELL_SIZE pixels of the current window. Grows with the window,
+// a smaller window just uses the front of the buffer
+void Renderer::ensureHeatGrid() {
+  uint32_t cols = (imageExtent.width + HEATMAP_CELL_SIZE - 1) / HEATMAP_CELL_SIZE;
+  uint32_t rows = (imageExtent.height + HEATMAP_CELL_SIZE - 1) / HEATMAP_CELL_SIZE;
+  if (cols == heatCols && rows == heatRows)
+    return;
+
+  if (cols * rows > heatGridCapacity) {
+    vkDeviceWaitIdle(device);
+    if (heatGridBuffer != VK_NULL_HANDLE) {
+      vkDestroyBuffer(device, heatGridBuffer, nullptr);
+      vkFreeMemory(device, heatGridBufferMemory, nullptr);
+    }
+
+    // written by heatgrid.comp, read by heatmap.frag. Never touched by the CPU
+    heatGridCapacity = cols * rows;
+    VkDeviceSize bufferSize = sizeof(glm::vec2) * heatGridCapacity;
+    createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, heatGridBuffer,
+                 heatGridBufferMemory);
+    writeFieldDescriptorSets();
+
+    VkDescriptorBufferInfo bufferInfos[2] = {
+        {.buffer = heatGridBuffer, .offset = 0, .range = VK_WHOLE_SIZE},
+        {.buffer = heatLutBuffer, .offset = 0, .range = VK_WHOLE_SIZE}};
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = heatmapDescriptorSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 2;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = bufferInfos;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+    printf("[Info] | Heatmap : %u x %u samples, %.2f MiB\n", cols, rows,
+           bufferSize / (1024.0 * 1024.0));
+  }
+
+  heatCols = cols;
+  heatRows = rows;
+  invalidateCommandBuffers();
+}
+
+// Samples the field over the heat grid. The cost is (pixels / HEATMAP_CELL_SIZE^2) x bodies,
+// independent of the arrow count
+void Renderer::recordHeatGrid(VkCommandBuffer commandbuffer) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = heatGridBuffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+
+  // the previous frame's heatmap is done reading the grid
+  barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  // spacing and origin follow the view, see heatgrid.comp
+  FieldPushConstants push{};
+  push.cols = heatCols;
+  push.rows = heatRows;
+  push.gravity = fieldGravity;
+
+  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, heatGridPipeline);
+  vkCmdBindDescriptorSets(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          fieldPipelineLayout, 0, 1,
+                          &fieldDescriptorSets[currentFrame], 0, nullptr);
+  vkCmdPushConstants(commandbuffer, fieldPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FieldPushConstants),
+                     &push);
+  vkCmdDispatch(commandbuffer,
+                (heatCols * heatRows + FIELD_GROUP_SIZE - 1) / FIELD_GROUP_SIZE,
+                1, 1);
+
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+}
+
+// Tests every body against the view and appends the survivors to the visible list, the draw
+// arguments are reset here and counted up by cull.comp. Dispatched for count bodies, the frame's
+// body count (ViewUniforms) may be lower
+void Renderer::recordCull(VkCommandBuffer commandbuffer, uint32_t count, uint32_t bodyTable) {
+  // the previous frame's draws are done with the arguments and the visible list
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandbuffer,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  // quads : 4 vertices, points : 1 vertex, no instances yet
+  const VkDrawIndirectCommand args[2] = {{4, 0, 0, 0}, {1, 0, 0, 0}};
+  vkCmdUpdateBuffer(commandbuffer, cullArgsBuffer, 0, sizeof(args), args);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+
+  CullPushConstants push{};
+  push.bodyTable = bodyTable;
+
+  uint32_t viewOffset = viewStride * currentFrame;
+  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+  vkCmdBindDescriptorSets(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          cullPipelineLayout, 0, 1, &drawDescriptorSet, 1,
+                          &viewOffset);
+  vkCmdPushConstants(commandbuffer, cullPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants),
+                     &push);
+  vkCmdDispatch(commandbuffer, (count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+static void computeBarrier(VkCommandBuffer commandbuffer) {
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+}
+
+// Barnes-Hut forces, the tree never leaves the device :
+// bounds -> Morton codes -> radix sort (histogram / scan / scatter per digit) ->
+// Karras build -> bottom-up mass + escape links -> stackless traversal
+void Renderer::recordBarnesHutForces(VkCommandBuffer commandbuffer) {
+  uint32_t groupCount = nbodyParams.groupCount;
+
+  // the previous step is done with the bounds / flags before they are reset
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+
+  vkCmdFillBuffer(commandbuffer, treeBuffers[BH_BOUNDS], 0, 8, 0xFFFFFFFF); // min
+  vkCmdFillBuffer(commandbuffer, treeBuffers[BH_BOUNDS], 8, 8, 0);          // max
+  vkCmdFillBuffer(commandbuffer, treeBuffers[BH_FLAGS], 0, VK_WHOLE_SIZE, 0);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+
+  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bhBoundsPipeline);
+  vkCmdDispatch(commandbuffer, groupCount, 1, 1);
+  computeBarrier(commandbuffer);
+
+  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bhMortonPipeline);
+  vkCmdDispatch(commandbuffer, groupCount, 1, 1);
+  computeBarrier(commandbuffer);
+
+  // even number of passes, A -> B -> A ...
+  NBodyPushConstants params = nbodyParams;
+  for (uint32_t pass = 0; pass < RADIX_SORT_PASSES; pass++) {
+    params.shift = pass * 8;
+    vkCmdPushConstants(commandbuffer, nbodyPipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(NBodyPushConstants), &params);
+
+    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, radixHistogramPipeline);
+    vkCmdDispatch(commandbuffer, groupCount, 1, 1);
+    computeBarrier(commandbuffer);
+
+    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, radixScanPipeline);
+    vkCmdDispatch(commandbuffer, 1, 1, 1);
+    computeBarrier(commandbuffer);
+
+    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, radixScatterPipeline);
+    vkCmdDispatch(commandbuffer, groupCount, 1, 1);
+    computeBarrier(commandbuffer);
+  }
+  vkCmdPushConstants(commandbuffer, nbodyPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(NBodyPushConstants),
+                     &nbodyParams);
+
+  // one thread per internal node
+  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bvhBuildPipeline);
+  vkCmdDispatch(commandbuffer, (bodyCount - 1 + NBODY_TILE_SIZE - 1) / NBODY_TILE_SIZE, 1, 1);
+  computeBarrier(commandbuffer);
+
+  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bvhMassPipeline);
+  vkCmdDispatch(commandbuffer, groupCount, 1, 1);
+  computeBarrier(commandbuffer);
+
+  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bhForcePipeline);
+  vkCmdDispatch(commandbuffer, groupCount, 1, 1);
+}
+
+// One simulation step on the body SSBO : forces -> integration -> vertex input.
+// All frames in flight share the buffer, they are ordered by the barriers on the one queue.
+void Renderer::recordBodyStep(VkCommandBuffer commandbuffer) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = bodyBuffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+
+  // the previous frame's draw is done reading before we overwrite
+  barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  uint32_t groupCount = (bodyCount + NBODY_TILE_SIZE - 1) / NBODY_TILE_SIZE;
+  vkCmdBindDescriptorSets(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          nbodyPipelineLayout, 0, 1, &nbodyDescriptorSet, 0,
+                          nullptr);
+  vkCmdPushConstants(commandbuffer, nbodyPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(NBodyPushConstants),
+                     &nbodyParams);
+
+  if (nbodyParams.theta > 0.0f) {
+    recordBarnesHutForces(commandbuffer);
+  } else {
+    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      nbodyForcePipeline);
+    vkCmdDispatch(commandbuffer, groupCount, 1, 1);
+  }
+
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    nbodyIntegratePipeline);
+  vkCmdDispatch(commandbuffer, groupCount, 1, 1);
+
+  // drawn from, and read by the vector field
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// Visible world rectangle and its projection, written into this frame's slice of the view buffer.
+// Called after the frame's fence, the previous submission of the slice is done reading it
+void Renderer::updateView(const Camera &camera, uint32_t drawBodyCount) {
+  ViewUniforms view{};
+  view.pixelSize = 1.0f / camera.zoom;
+  glm::vec2 halfView = glm::vec2(imageExtent.width, imageExtent.height) * 0.5f * view.pixelSize;
+  view.viewMin = camera.center - halfView;
+  view.viewMax = camera.center + halfView;
+  view.bodyCount = drawBodyCount;
+
+  view.viewProjection = glm::ortho(view.viewMin.x, view.viewMax.x, // left, right
+                                   view.viewMin.y, view.viewMax.y, // bottom, top
+                                   -1.0f, 1.0f);                   // near, far
+  view.viewProjection[1][1] *= -1;
+
+  memcpy(viewMapped + viewStride * currentFrame, &view, sizeof(view));
+}
+
+// Render pass contents of one RenderRange for the current frame, recorded by worker thread `range` into
+// its own pool of the frame. Shared by every swapchain image : the framebuffer is not inherited
+void Renderer::recordRange(uint32_t range, const Scene &scene) {
+  uint32_t slot = range * MAX_FRAME_IN_FLIGHT + currentFrame;
+  VkCommandBuffer commandbuffer = rangeCommandBuffers[slot];
 
+  // recycles the whole pool of the frame, no per buffer reset
+  vkResetCommandPool(device, rangeCommandPools[slot], 0);
+
+  VkCommandBufferInheritanceInfo inheritanceInfo{};
+  inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritanceInfo.renderPass = renderpass;
+  inheritanceInfo.subpass = 0;
+  inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+  // executed by the command buffer of every swapchain image of the frame
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                    VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+  beginInfo.pInheritanceInfo = &inheritanceInfo;
+  chk(vkBeginCommandBuffer(commandbuffer, &beginInfo),
+      "Failed to begin secondary command buffer!");
+
+  // dynamic state is not inherited from the primary
   VkViewport viewport{};
   viewport.x = 0.0f;
   viewport.y = 0.0f;
@@ -946,86 +2398,209 @@ void Renderer::recordCommandBuffer(VkCommandBuffer commandbuffer,
   scissors.offset = {0, 0};
   vkCmdSetScissor(commandbuffer, 0, 1, &scissors);
 
-  // compute projction matrix
-  glm::mat4 projection =
-      glm::ortho(-static_cast<float>(imageExtent.width) * 0.5f,  // left
-                 static_cast<float>(imageExtent.width) * 0.5f,   // right
-                 -static_cast<float>(imageExtent.height) * 0.5f, // bottom
-                 static_cast<float>(imageExtent.height) * 0.5f,  // top
-                 -1.0f, 1.0f                                     // near, far
-      );
-
-  projection[1][1] *= -1;
+  uint32_t drawBodyCount = bodyCount > 0 ? bodyCount : hostBodyCapacity;
+  uint32_t bodyTable = bodyCount > 0 ? BODY_TABLE_GPU
+                                     : BODY_TABLE_HOST + static_cast<uint32_t>(currentFrame);
+  uint32_t viewOffset = viewStride * currentFrame;
+
+  // heatmap first, everything else is drawn over it
+  if (range == RENDER_RANGE_HEATMAP && heatmapEnabled) {
+    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      heatmapPipeline);
+    vkCmdBindDescriptorSets(commandbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            heatmapPipelineLayout, 0, 1, &heatmapDescriptorSet,
+                            1, &viewOffset);
+
+    HeatmapPushConstants push{};
+    push.gridSize = glm::uvec2(heatCols, heatRows);
+    vkCmdPushConstants(commandbuffer, heatmapPipelineLayout,
+                       VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                       sizeof(HeatmapPushConstants), &push);
+    vkCmdDraw(commandbuffer, 3, 1, 0, 0);
+  }
 
-  // draw rectangles
-  for (const RectObject &obj : scene.rects) {
+  // draw arrows, one instanced draw of the rect mesh
+  if (range == RENDER_RANGE_ARROWS && arrowBuffer != VK_NULL_HANDLE) {
+    vkCmdBindDescriptorSets(commandbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipelineLayout, 0, 1, &drawDescriptorSet, 1,
+                            &viewOffset);
+    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      arrowPipeline);
 
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandbuffer, 0, 1, &scene.rectMesh.vertexBuffer,
-                           offsets);
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandbuffer, 0, 1, &scene.rectMesh.vertexBuffer, &offset);
     vkCmdBindIndexBuffer(commandbuffer, scene.rectMesh.indexBuffer, 0,
                          VK_INDEX_TYPE_UINT16);
 
-    float magnitude = glm::length(obj.net_force);
+    PushConstantData push{.color = glm::vec3(1.0f), .bodyTable = BODY_TABLE_GPU}; // arrows ignore the body table
+    vkCmdPushConstants(commandbuffer, pipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                       0, sizeof(PushConstantData),
+                       &push);
+    vkCmdDrawIndexed(commandbuffer, scene.rectMesh.indexCount,
+                     fieldCols * fieldRows, 0, 0, 0);
+  }
 
-    float angle = 0.0f;
-    // if (magnitude > 1e-8f) {
-    angle = atan2(obj.net_force.y, obj.net_force.x);
-    // }
+  // draw bodies, the instance counts come from the culling pass : SDF quads (4 vertices each),
+  // then one pixel points for the sub-pixel bodies
+  if (range == RENDER_RANGE_BODIES && drawBodyCount > 0) {
+    PushConstantData push{.color = glm::vec3(1.0f), .bodyTable = bodyTable};
 
-    float sx = std::clamp<float>(log(magnitude * 200.0f), 0.5f, 7.0f);
-    // float sy = 1 / sx;
-    float sy = 1;
+    vkCmdBindDescriptorSets(commandbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipelineLayout, 0, 1, &drawDescriptorSet, 1,
+                            &viewOffset);
+    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      bodyPipeline);
+    vkCmdPushConstants(commandbuffer, pipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantData),
+                       &push);
+    vkCmdDrawIndirect(commandbuffer, cullArgsBuffer, 0, 1, sizeof(VkDrawIndirectCommand));
 
-    glm::mat4 model(1.0f);
-    model = glm::translate(model, glm::vec3(obj.position, 0.0f));
-    model = glm::rotate(model, angle,
-                        glm::vec3(0.0f, 0.0f, 1.0f)); // rotate over Z axis
-    model = glm::scale(model, glm::vec3(sx, sy, 1.0f));
+    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      bodyPointPipeline);
+    vkCmdDrawIndirect(commandbuffer, cullArgsBuffer, sizeof(VkDrawIndirectCommand), 1,
+                      sizeof(VkDrawIndirectCommand));
+  }
 
-    glm::mat4 mvp = projection * model;
+  chk(vkEndCommandBuffer(commandbuffer), "Failed to record secondary command buffer!");
+}
 
-    glm::vec3 color = {1.0f, 1.0f, 1.0f};
-    PushConstantData push{.mvp = mvp, .color = color};
+// Compute passes inline, then the render pass executes the frame's range secondaries in RenderRange
+// order, whichever worker finished first. Nothing recorded here may change per frame : the view and
+// the body count are read from the view buffer
+void Renderer::recordCommandBuffer(VkCommandBuffer commandbuffer,
+                                   uint32_t imageIndex) {
+  VkCommandBufferBeginInfo cmdBufBeginInfo{};
+  cmdBufBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  chk(vkBeginCommandBuffer(commandbuffer, &cmdBufBeginInfo),
+      "Failed to begin command buffer!");
 
-    vkCmdPushConstants(commandbuffer, pipelineLayout,
-                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                       0, sizeof(PushConstantData),
-                       &push);
-    vkCmdDrawIndexed(commandbuffer, scene.rectMesh.indexCount, 1, 0, 0, 0);
+  if (bodyCount > 0) {
+    recordBodyStep(commandbuffer);
+  }
+  if (arrowBuffer != VK_NULL_HANDLE) {
+    recordField(commandbuffer);
+  }
+  if (heatmapEnabled) {
+    recordHeatGrid(commandbuffer);
   }
 
-  // draw circles
-  for (const CircleObject &obj : scene.circles) {
+  // bodies drawn : the GPU bodies or this frame's copy of the CPU circles, culled up to the capacity
+  uint32_t drawBodyCount = bodyCount > 0 ? bodyCount : hostBodyCapacity;
+  uint32_t bodyTable = bodyCount > 0 ? BODY_TABLE_GPU
+                                     : BODY_TABLE_HOST + static_cast<uint32_t>(currentFrame);
+  if (drawBodyCount > 0) {
+    recordCull(commandbuffer, drawBodyCount, bodyTable);
+  }
 
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandbuffer, 0, 1, &scene.circleMesh.vertexBuffer,
-                           offsets);
-    vkCmdBindIndexBuffer(commandbuffer, scene.circleMesh.indexBuffer, 0,
-                         VK_INDEX_TYPE_UINT16);
+  VkClearValue clearColor{};
+  clearColor.color = {{.0f, .0f, .0f, 1.0f}};
 
-    glm::mat4 model(1.0f);
-    model = glm::translate(model, glm::vec3(obj.position, 0.0f));
-    model = glm::scale(model, glm::vec3(obj.radius, obj.radius, 1.0f));
+  VkRenderPassBeginInfo renderpassBeginInfo{};
+  renderpassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderpassBeginInfo.renderPass = renderpass;
+  renderpassBeginInfo.renderArea = {.offset = {0, 0}, .extent = imageExtent};
+  renderpassBeginInfo.framebuffer = framebuffers[imageIndex];
+  renderpassBeginInfo.clearValueCount = 1;
+  renderpassBeginInfo.pClearValues = &clearColor;
 
-    glm::mat4 mvp = projection * model;
+  vkCmdBeginRenderPass(commandbuffer, &renderpassBeginInfo,
+                       VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-    PushConstantData push{.mvp = mvp, .color = obj.color};
-    vkCmdPushConstants(commandbuffer, pipelineLayout,
-                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantData),
-                       &push);
-    vkCmdDrawIndexed(commandbuffer, scene.circleMesh.indexCount, 1, 0, 0, 0);
+  std::array<VkCommandBuffer, RENDER_RANGE_COUNT> ranges;
+  for (uint32_t range = 0; range < RENDER_RANGE_COUNT; range++) {
+    ranges[range] = rangeCommandBuffers[range * MAX_FRAME_IN_FLIGHT + currentFrame];
   }
+  vkCmdExecuteCommands(commandbuffer, ranges.size(), ranges.data());
 
   vkCmdEndRenderPass(commandbuffer);
   vkEndCommandBuffer(commandbuffer);
 }
 
+// Records the command buffers of every swapchain image of the current frame. The ranges are recorded
+// in parallel first by the persistent workers (the calling thread takes range 0), then every image's
+// primary. None of them is pending : the frame's fence covers every submission of the frame
+void Renderer::recordFrameCommandBuffers(const Scene &scene) {
+  {
+    std::lock_guard<std::mutex> lock(recordMutex);
+    recordScene = &scene;
+    recordPending = recordWorkers.size();
+    recordGeneration++;
+  }
+  recordStart.notify_all();
+
+  recordRange(0, scene);
+  {
+    std::unique_lock<std::mutex> lock(recordMutex);
+    recordDone.wait(lock, [this]() { return recordPending == 0; });
+  }
+  commandBufferRecords += RENDER_RANGE_COUNT;
+
+  for (uint32_t image = 0; image < swapchainImages.size(); image++) {
+    uint32_t index = currentFrame * swapchainImages.size() + image;
+    vkResetCommandBuffer(commandBuffers[index], 0);
+    recordCommandBuffer(commandBuffers[index], image);
+    commandBufferRecorded[index] = true;
+    commandBufferRecords++;
+  }
+}
+
+// One thread per range but the first, alive as long as the renderer. Threads are not created per recording
+void Renderer::startRecordWorkers() {
+  for (uint32_t range = 1; range < RENDER_RANGE_COUNT; range++) {
+    recordWorkers.emplace_back(&Renderer::recordWorker, this, range);
+  }
+}
+
+void Renderer::stopRecordWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(recordMutex);
+    recordStopping = true;
+  }
+  recordStart.notify_all();
+  for (std::thread &worker : recordWorkers) {
+    worker.join();
+  }
+  recordWorkers.clear();
+}
+
+void Renderer::recordWorker(uint32_t range) {
+  uint64_t generation = 0;
+  while (true) {
+    const Scene *scene;
+    {
+      std::unique_lock<std::mutex> lock(recordMutex);
+      recordStart.wait(lock, [&]() { return recordStopping || recordGeneration != generation; });
+      if (recordStopping) {
+        return;
+      }
+      generation = recordGeneration;
+      scene = recordScene;
+    }
+
+    recordRange(range, *scene);
+
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(recordMutex);
+      last = --recordPending == 0;
+    }
+    if (last) {
+      recordDone.notify_one();
+    }
+  }
+}
+
 void Renderer::drawFrame(const Scene &scene) {
   // printf("draw\n");
 
   vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE,
                   UINT64_MAX);
+  collectDeletions();
+  if (bodySnapshotInFlight && bodySnapshotSlot == static_cast<uint32_t>(currentFrame)) {
+    bodySnapshotInFlight = false;
+    bodySnapshotReady = true;
+  }
 
   uint32_t imageIndex;
   VkResult res = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX,
@@ -1034,36 +2609,58 @@ void Renderer::drawFrame(const Scene &scene) {
   // semaphore is signaled when vkAcquireNextImageKHR returns "VK_SUBOPTIMAL_KHR"
   //  semaphore is not signaled when vkAcquireNextImageKHR returns "VK_ERROR_OUT_OF_DATE_KHR"
   if (res == VK_ERROR_OUT_OF_DATE_KHR) { 
-    recreateSwapchain(-1);
+    recreateSwapchain();
     return;
   } else if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
     throw std::runtime_error("Failed to acquire swapchain image!");
   }
+  acquireCount++;
 
   vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-  vkResetCommandBuffer(commandBuffers[currentFrame], 0);
-  recordCommandBuffer(commandBuffers[currentFrame], imageIndex, scene);
+  updateView(scene.camera, bodyCount > 0 ? bodyCount : scene.circles.size());
+
+  if (bodyCount == 0) {
+    uploadHostBodies(scene.circles);
+  }
+  if (heatmapEnabled) {
+    ensureHeatGrid();
+  }
+
+  // camera, body positions and body count only changed buffer contents, the recording is reused
+  uint32_t commandIndex = currentFrame * swapchainImages.size() + imageIndex;
+  if (!commandBufferRecorded[commandIndex]) {
+    recordFrameCommandBuffers(scene);
+  }
+  VkCommandBuffer commandbuffer = commandBuffers[commandIndex];
+  reportCommandBufferRecords();
 
   VkPipelineStageFlags waitStages[] = {
       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
 
+  // a requested body snapshot is copied behind this frame, under the same fence
+  std::array<VkCommandBuffer, 2> submitted = {commandbuffer, VK_NULL_HANDLE};
+  uint32_t submittedCount = 1;
+  if (bodySnapshotRequested) {
+    submitted[submittedCount++] = bodyReadbackCommandBuffers[currentFrame];
+    bodySnapshotRequested = false;
+    bodySnapshotInFlight = true;
+    bodySnapshotSlot = currentFrame;
+  }
+
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+  submitInfo.commandBufferCount = submittedCount;
+  submitInfo.pCommandBuffers = submitted.data();
   submitInfo.waitSemaphoreCount = 1;
   submitInfo.pWaitSemaphores = &imageAvailableSemaphores[currentFrame];
   submitInfo.pWaitDstStageMask = waitStages;
   submitInfo.signalSemaphoreCount = 1;
   submitInfo.pSignalSemaphores = &renderFinishedSemaphores[imageIndex];
 
-  res = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]);
-  if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR || framebufferResized) {
-    framebufferResized = false;
-    recreateSwapchain(imageIndex);
-    return;
-  }
+  chk(vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]),
+      "Failed to submit command buffer!");
+  frameNumber++;
 
   VkPresentInfoKHR presentInfo{};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1073,9 +2670,59 @@ void Renderer::drawFrame(const Scene &scene) {
   presentInfo.pWaitSemaphores = &renderFinishedSemaphores[imageIndex];
   presentInfo.pImageIndices = &imageIndex;
 
-  vkQueuePresentKHR(presentQueue, &presentInfo);
+  // ids increase across swapchains, frameNumber is never reused
+  VkPresentIdKHR presentIdInfo{};
+  presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+  presentIdInfo.swapchainCount = 1;
+  presentIdInfo.pPresentIds = &frameNumber;
+  if (presentWaitEnabled) {
+    presentInfo.pNext = &presentIdInfo;
+  }
+
+  // signalled once the present engine is done with the render finished semaphore
+  VkFence presentFence = VK_NULL_HANDLE;
+  VkSwapchainPresentFenceInfoEXT presentFenceInfo{};
+  if (presentFencesEnabled) {
+    presentFence = takePresentFence();
+    presentFenceInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT;
+    presentFenceInfo.pNext = presentInfo.pNext;
+    presentFenceInfo.swapchainCount = 1;
+    presentFenceInfo.pFences = &presentFence;
+    presentInfo.pNext = &presentFenceInfo;
+  }
+
+  res = vkQueuePresentKHR(presentQueue, &presentInfo);
+  if (presentFence != VK_NULL_HANDLE) {
+    presentFences.push_back(presentFence); // out of date presents still signal it
+  }
+  if (presentWaitEnabled && (res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR)) {
+    presentId = frameNumber;
+  }
 
   currentFrame = (currentFrame + 1) % MAX_FRAME_IN_FLIGHT;
+
+  // presented first : the render finished semaphore is always waited on, the swapchain is only retired
+  if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR || framebufferResized) {
+    framebufferResized = false;
+    recreateSwapchain();
+  } else if (res != VK_SUCCESS) {
+    throw std::runtime_error("Failed to present swapchain image!");
+  }
+}
+
+// false : timed out, or the swapchain the id went to was retired
+bool Renderer::waitForPresent(uint64_t id, uint64_t timeoutNs) {
+  if (!presentWaitEnabled || id == 0) {
+    return false;
+  }
+
+  VkResult res = waitForPresentKHR(device, swapchain, id, timeoutNs);
+  if (res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR) {
+    return true;
+  } else if (res == VK_TIMEOUT || res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_ERROR_SURFACE_LOST_KHR) {
+    return false;
+  }
+  throw std::runtime_error("Failed to wait for present!");
 }
 
 // --------------- NON-MEMBER FUNCTIONS --------------- //
@@ -3,6 +3,12 @@
 #define GLFW_INCLUDE_VULKAN
 #include <glfw/glfw3.h>
 #include <glm/glm.hpp>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 void chk(VkResult res, const char* msg);
@@ -43,31 +49,115 @@ struct CircleObject{
     float radius;
 };
 
-struct RectObject{
-
-    glm::vec2 position;
-    glm::vec2 net_force;
-
-    // float mass = 1.0f;
-};
-
 struct RenderObject {
     Mesh* mesh;
     glm::mat4 model;
 };
 
+// 2D camera. At zoom 1 a world unit is one pixel
+struct Camera {
+    glm::vec2 center{0.0f};
+    float zoom = 1.0f;
+};
+
 struct Scene
 {
     std::vector<CircleObject> circles;
-    std::vector<RectObject> rects;
-    Mesh circleMesh;
     Mesh rectMesh;
+    Camera camera;
 };
 
 struct PushConstantData
 {
-    glm::mat4 mvp;
     glm::vec3 color;
+    uint32_t bodyTable; // which body buffer of the draw descriptor set (BODY_TABLE_*) is drawn
+};
+
+// std140 view of one frame, written by drawFrame into the frame's slice of the view buffer. Everything that
+// changes per frame is read from here, so the recorded command buffers stay valid while the camera moves
+struct ViewUniforms {
+    glm::mat4 viewProjection;
+    glm::vec2 viewMin; // visible world rectangle
+    glm::vec2 viewMax;
+    float pixelSize;    // world units per pixel, antialiasing width of the circles
+    uint32_t bodyCount; // bodies drawn and summed by the field passes this frame
+    glm::vec2 padding;
+};
+
+// GPU n-body. std430 layout of Body in nbody.comp / integrate.comp, also read by body.vert through
+// the draw descriptor set, indexed by gl_InstanceIndex
+struct GpuBody {
+    glm::vec2 position;
+    glm::vec2 velocity;
+    glm::vec4 color; // rgb
+    float mass;
+    float radius;
+    glm::vec2 acceleration; // written by the force pass
+    glm::vec2 impulse;      // collision, written by the force pass
+    glm::vec2 padding;
+};
+
+// Vector field arrow, written by field.comp and drawn instanced on the rect mesh (arrow.vert reads
+// it by gl_InstanceIndex)
+struct Arrow {
+    glm::vec2 position;
+    glm::vec2 scale;
+    float angle;
+    float padding;
+};
+
+// the grid is laid over the view and the body count read from ViewUniforms
+struct FieldPushConstants {
+    uint32_t cols;
+    uint32_t rows;
+    float gravity;
+};
+
+// Heatmap, full-screen pass upsampling the heat grid (field sampled every HEATMAP_CELL_SIZE pixels)
+struct HeatmapPushConstants {
+    glm::uvec2 gridSize;
+};
+
+// Culling pass (cull.comp). Visible bodies are appended to the visible list, one indirect draw
+// per LOD : SDF quads at the front of the list, one pixel points for sub-pixel bodies at the back
+struct CullPushConstants {
+    uint32_t bodyTable;
+};
+
+// shared by every n-body / Barnes-Hut pass, passes declare the prefix they use
+struct NBodyPushConstants {
+    uint32_t count;
+    float gravity;
+    float dt;
+    float softening;
+    float theta;         // Barnes-Hut opening angle, 0 : all pairs
+    uint32_t shift;      // radix sort pass
+    uint32_t groupCount; // workgroups of one pass over the bodies
+    uint32_t padding;
+};
+
+// Barnes-Hut tree, bindings 1.. of the n-body descriptor set. Karras LBVH over Morton codes :
+// internal nodes [0, n - 1), leaf of sorted body k at n - 1 + k, root is node 0
+enum BarnesHutBuffer {
+    BH_KEYS_A = 0,  // Morton codes, sorted result ends up in A
+    BH_VALUES_A,    // body indices
+    BH_KEYS_B,
+    BH_VALUES_B,
+    BH_HISTOGRAM,   // 256 digits x workgroups, scanned in place
+    BH_NODES,       // BH_NODE_SIZE each
+    BH_FLAGS,       // bottom-up visit counters of the internal nodes
+    BH_BOUNDS,      // min / max of the positions as ordered uints
+    BH_BUFFER_COUNT
+};
+#define BH_NODE_SIZE 48
+
+// Render pass contents, in draw order. Each range is recorded by its own worker into a secondary
+// command buffer and executed by the primary in this order
+enum RenderRange {
+    RENDER_RANGE_HEATMAP = 0,
+    RENDER_RANGE_ARROWS,
+    RENDER_RANGE_BODIES,
+    RENDER_RANGE_COUNT
 };
 
 
@@ -81,6 +171,28 @@ public:
     void createVertexBuffer(const std::vector<Vertex> *vertices, VkBuffer &vertexBuffer, VkDeviceMemory &vertexBufferMemory);
     void createIndexBuffer(const std::vector<uint16_t> *indices, VkBuffer &indexBuffer, VkDeviceMemory &indexBufferMemory);
 
+    // GPU n-body. Once bodies are uploaded every drawFrame steps them on the GPU and draws them
+    // instanced from the body SSBO, scene.circles is no longer read.
+    // theta > 0 : Barnes-Hut forces from a tree rebuilt on the GPU every step, all pairs otherwise
+    void uploadBodies(const std::vector<CircleObject> &circles, float gravity, float dt, float softening, float theta = 0.0f);
+    // GPU bodies for a snapshot, never waits for the device. The copy rides along with the next submitted
+    // frame, takeBodySnapshot hands the bodies over once that frame's fence has signalled.
+    // step : simulation step the bodies reach with that frame
+    void requestBodySnapshot(uint64_t step);
+    bool takeBodySnapshot(std::vector<CircleObject> &circles, uint64_t &step);
+    bool simulatesBodies() const { return bodyCount > 0; }
+
+    // cols x rows arrows sampling the field of the bodies, computed and drawn on the GPU
+    void setVectorField(uint32_t cols, uint32_t rows, float gravity);
+    // field magnitude over the whole window through a colour LUT, drawn under the arrows / circles
+    void setHeatmap(bool enabled);
+    bool heatmap() const { return heatmapEnabled; }
+
+    // VK_KHR_present_wait feedback. lastPresentId : id of the last frame handed to the presentation engine
+    bool presentWaitSupported() const { return presentWaitEnabled; }
+    uint64_t lastPresentId() const { return presentId; }
+    bool waitForPresent(uint64_t id, uint64_t timeoutNs);
+
     bool framebufferResized = false;
 
     GLFWwindow* window;
@@ -90,6 +202,12 @@ public:
 private:
 
     int currentFrame = 0;
+
+    // ViewUniforms of every frame in flight, persistently mapped. Slice currentFrame is written by drawFrame
+    VkBuffer viewBuffer;
+    VkDeviceMemory viewBufferMemory;
+    uint8_t *viewMapped;
+    VkDeviceSize viewStride; // sizeof(ViewUniforms) rounded up to minUniformBufferOffsetAlignment
     
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
@@ -101,17 +219,49 @@ private:
     VkQueue graphicsQueue;
     VkQueue presentQueue;
 
-    VkSwapchainKHR swapchain;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
     VkFormat imageFormat;
     std::vector<VkImage> swapchainImages;
     std::vector<VkImageView> swapchainImageViews;
     std::vector<VkFramebuffer> framebuffers;
     
     VkRenderPass renderpass;
+    VkDescriptorSetLayout drawDescriptorSetLayout;
+    VkDescriptorSet drawDescriptorSet; // body table, arrows, visible list, draw arguments
     VkPipelineLayout pipelineLayout;
     VkPipeline graphicsPipeline;
+
+    // GPU culling, feeds the indirect body draws
+    VkPipelineLayout cullPipelineLayout;
+    VkPipeline cullPipeline;
+    VkPipeline bodyPointPipeline;
+    VkBuffer cullVisibleBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory cullVisibleBufferMemory = VK_NULL_HANDLE;
+    uint32_t cullVisibleCapacity = 0;
+    VkBuffer cullArgsBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory cullArgsBufferMemory = VK_NULL_HANDLE;
     VkCommandPool commandPool;
+    // recorded once per (frame in flight, swapchain image) and resubmitted. Recorded again only after
+    // invalidateCommandBuffers : swapchain, bodies, field, heatmap or buffer sizes changed
     std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<bool> commandBufferRecorded;
+    uint32_t commandBufferRecords = 0; // since the last report
+    uint32_t lastRecordRate = UINT32_MAX;
+    double lastRecordReport = 0.0;
+    // per (RenderRange, frame in flight), index range * MAX_FRAME_IN_FLIGHT + frame. A worker only touches
+    // the pools of its range
+    std::vector<VkCommandPool> rangeCommandPools;
+    std::vector<VkCommandBuffer> rangeCommandBuffers;
+    // persistent recording workers, worker w records range w + 1 (the render thread takes range 0).
+    // A recording job is a generation bump under recordMutex, recordPending counts the workers still on it
+    std::vector<std::thread> recordWorkers;
+    std::mutex recordMutex;
+    std::condition_variable recordStart;
+    std::condition_variable recordDone;
+    const Scene *recordScene = nullptr;
+    uint64_t recordGeneration = 0;
+    uint32_t recordPending = 0;
+    bool recordStopping = false;
     // VkBuffer vertexBuffer;
     // VkBuffer indexBuffer;
     // VkDeviceMemory vertexBufferMemory;
@@ -119,6 +269,103 @@ private:
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
+    uint64_t frameNumber = 0; // frames submitted
+    bool presentWaitEnabled = false;
+    PFN_vkWaitForPresentKHR waitForPresentKHR = nullptr;
+    uint64_t presentId = 0;
+
+    // retired swapchain resources, destroyed once frame (and every frame before it) retired
+    struct DeferredDeletion {
+        uint64_t frame;
+        std::function<void()> destroy;
+    };
+    std::deque<DeferredDeletion> deletionQueue;
+
+    // retired swapchains and their render finished semaphores. a signalled slot fence does not mean the present
+    // waiting on the semaphore is done : they go once every present to the swapchain signalled its present fence
+    // (VK_EXT_swapchain_maintenance1), otherwise once later swapchains acquired as many images as it had
+    struct RetiredSwapchain {
+        VkSwapchainKHR swapchain;
+        std::vector<VkSemaphore> renderFinishedSemaphores;
+        std::vector<VkFence> presentFences;
+        uint64_t acquireCount;
+        uint64_t frame; // after the views and framebuffers deferred with it
+    };
+    std::deque<RetiredSwapchain> retiredSwapchains;
+    bool surfaceMaintenance = false; // VK_EXT_surface_maintenance1 enabled on the instance
+    bool presentFencesEnabled = false;
+    std::vector<VkFence> presentFences; // presents to the current swapchain
+    std::vector<VkFence> freePresentFences;
+    uint64_t acquireCount = 0; // images acquired, across swapchains
+
+    // GPU n-body
+    VkPipeline bodyPipeline;
+    VkDescriptorSetLayout nbodyDescriptorSetLayout;
+    VkPipelineLayout nbodyPipelineLayout;
+    VkPipeline nbodyForcePipeline;
+    VkPipeline nbodyIntegratePipeline;
+    VkPipeline bhBoundsPipeline;
+    VkPipeline bhMortonPipeline;
+    VkPipeline radixHistogramPipeline;
+    VkPipeline radixScanPipeline;
+    VkPipeline radixScatterPipeline;
+    VkPipeline bvhBuildPipeline;
+    VkPipeline bvhMassPipeline;
+    VkPipeline bhForcePipeline;
+    VkBuffer treeBuffers[BH_BUFFER_COUNT] = {};
+    VkDeviceMemory treeBufferMemory[BH_BUFFER_COUNT] = {};
+    uint32_t treeCapacity = 0;
+
+    // vector field
+    VkPipeline arrowPipeline;
+    VkPipelineLayout fieldPipelineLayout;
+    VkPipeline fieldPipeline;
+    std::vector<VkDescriptorSet> fieldDescriptorSets; // per frame in flight
+    VkBuffer arrowBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory arrowBufferMemory = VK_NULL_HANDLE;
+    // bodies of the CPU simulation, copied every frame (persistently mapped, per frame in flight).
+    // Drawn as the circle instances and read by the field passes
+    std::vector<VkBuffer> hostBodyBuffers;
+    std::vector<VkDeviceMemory> hostBodyBufferMemory;
+    std::vector<GpuBody *> hostBodyMapped;
+    uint32_t hostBodyCapacity = 0;
+    uint32_t fieldCols = 0;
+    uint32_t fieldRows = 0;
+    float fieldGravity = 0.0f;
+
+    // heatmap
+    bool heatmapEnabled = false;
+    VkDescriptorSetLayout heatmapDescriptorSetLayout;
+    VkPipelineLayout heatmapPipelineLayout;
+    VkPipeline heatmapPipeline;
+    VkPipeline heatGridPipeline;
+    VkDescriptorSet heatmapDescriptorSet;
+    VkBuffer heatGridBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory heatGridBufferMemory = VK_NULL_HANDLE;
+    uint32_t heatGridCapacity = 0;
+    uint32_t heatCols = 0;
+    uint32_t heatRows = 0;
+    VkBuffer heatLutBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory heatLutBufferMemory = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet nbodyDescriptorSet;
+    VkBuffer bodyBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory bodyBufferMemory = VK_NULL_HANDLE;
+    uint32_t bodyCount = 0;
+    uint32_t bodyCapacity = 0;
+    NBodyPushConstants nbodyParams{};
+
+    // body snapshot readback, per frame in flight : persistently mapped buffer, copy command buffer
+    std::vector<VkBuffer> bodyReadbackBuffers;
+    std::vector<VkDeviceMemory> bodyReadbackBufferMemory;
+    std::vector<GpuBody *> bodyReadbackMapped;
+    std::vector<VkCommandBuffer> bodyReadbackCommandBuffers;
+    uint32_t bodyReadbackCapacity = 0;
+    bool bodySnapshotRequested = false;
+    bool bodySnapshotInFlight = false; // copy submitted with frame bodySnapshotSlot
+    bool bodySnapshotReady = false;    // that frame's fence signalled
+    uint32_t bodySnapshotSlot = 0;
+    uint64_t bodySnapshotStep = 0;
 
     void initWindow(int width, int height);
     void createInstance();
@@ -132,15 +379,46 @@ private:
     void createRenderpass();
     VkShaderModule createShader(const char* filename);
     void createGraphicsPipeline();
+    void createComputePipeline();
+    VkPipeline createComputeShaderPipeline(VkPipelineLayout layout, const char* filename);
+    void createDescriptorPool();
     void createFramebuffer();
     void createCommandPool();
     void createCommandBuffers();
+    void invalidateCommandBuffers();
+    void reportCommandBufferRecords();
+    void createViewBuffer();
     void createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &memory);
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
     void copyBuffer(VkBuffer &srcBuffer, VkBuffer &dstBuffer, VkDeviceSize size);
     void createSyncObjects();
-    void cleanupSwapchain();
-    void recreateSwapchain(uint32_t imageIndex);
-    void recordCommandBuffer(VkCommandBuffer commandbuffer, uint32_t imageIndex, const Scene &scene);
+    void recreateSwapchain();
+    void deferDeletion(std::function<void()> destroy);
+    void collectDeletions();
+    VkFence takePresentFence();
+    void destroyRetiredSwapchain(RetiredSwapchain &retired);
+    void updateView(const Camera &camera, uint32_t drawBodyCount);
+    void recordCommandBuffer(VkCommandBuffer commandbuffer, uint32_t imageIndex);
+    void recordRange(uint32_t range, const Scene &scene);
+    void recordFrameCommandBuffers(const Scene &scene);
+    void startRecordWorkers();
+    void stopRecordWorkers();
+    void recordWorker(uint32_t range);
+    void recordBodyStep(VkCommandBuffer commandbuffer);
+    void createTreeBuffers(uint32_t count);
+    void destroyTreeBuffers();
+    void createBodyReadback(uint32_t count);
+    void destroyBodyReadback();
+    void recordBodyReadback();
+    void recordBarnesHutForces(VkCommandBuffer commandbuffer);
+    void writeFieldDescriptorSets();
+    void uploadHostBodies(const std::vector<CircleObject> &circles);
+    void writeDrawDescriptorSet();
+    void ensureCullBuffers(uint32_t count);
+    void recordCull(VkCommandBuffer commandbuffer, uint32_t count, uint32_t bodyTable);
+    void recordField(VkCommandBuffer commandbuffer);
+    void createHeatLut();
+    void ensureHeatGrid();
+    void recordHeatGrid(VkCommandBuffer commandbuffer);
   
 };
\ No newline at end of file
@@ -0,0 +1,117 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/mman.h>
+
+TrajectoryPlayer::TrajectoryPlayer(const char *path) : reader(path) {
+  frames = reader.frameCount();
+  stepsPerFrame = reader.everyNth();
+  capacity = reader.maxBodyCount();
+  if (frames == 0) {
+    throw std::runtime_error("Trajectory has no frames!");
+  }
+
+  // slot : header, positions, velocities
+  slotSize = sizeof(SlotHeader) + capacity * 2 * sizeof(glm::vec2);
+  ringSize = slotSize * REPLAY_RING_FRAMES;
+  void *mapped = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Failed to map the replay ring!");
+  }
+  ring = static_cast<uint8_t *>(mapped);
+  scratchPosition.resize(capacity);
+  scratchVelocity.resize(capacity);
+
+  for (std::atomic<int64_t> &tag : slotFrame) {
+    tag.store(-1, std::memory_order_relaxed);
+  }
+
+  printf("[Info] | Replay : %llu frames, every %u step(s), up to %u bodies, ring %.2f MiB\n",
+         (unsigned long long)frames, stepsPerFrame, capacity, ringSize / (1024.0 * 1024.0));
+
+  decoder = std::thread(&TrajectoryPlayer::run, this);
+}
+
+TrajectoryPlayer::~TrajectoryPlayer() {
+  stopping = true;
+  decoder.join();
+  munmap(ring, ringSize);
+}
+
+void TrajectoryPlayer::seek(uint64_t frame) {
+  playhead.store(std::min(frame, frames - 1), std::memory_order_release);
+}
+
+bool TrajectoryPlayer::fetch(uint64_t frame, std::vector<CircleObject> &circles, uint64_t &step) {
+  std::atomic<int64_t> &tag = slotFrame[frame % REPLAY_RING_FRAMES];
+  if (tag.load(std::memory_order_acquire) != static_cast<int64_t>(frame)) {
+    return false;
+  }
+
+  // copy out first, the slot may be rewritten under us
+  const uint8_t *data = slot(frame);
+  SlotHeader header;
+  memcpy(&header, data, sizeof(header));
+  uint32_t count = std::min(header.count, capacity);
+  memcpy(scratchPosition.data(), data + sizeof(SlotHeader), count * sizeof(glm::vec2));
+  memcpy(scratchVelocity.data(), data + sizeof(SlotHeader) + capacity * sizeof(glm::vec2), count * sizeof(glm::vec2));
+
+  // the decoder moved on and rewrote the slot while we copied
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (tag.load(std::memory_order_relaxed) != static_cast<int64_t>(frame)) {
+    return false;
+  }
+
+  // bodies the recording does not know about (mass, radius, color) keep their current values
+  size_t oldCount = circles.size();
+  circles.resize(count);
+  for (size_t i = oldCount; i < circles.size(); i++) {
+    circles[i] = oldCount > 0 ? circles[0] : CircleObject{};
+  }
+  for (size_t i = 0; i < circles.size(); i++) {
+    circles[i].position = scratchPosition[i];
+    circles[i].velocity = scratchVelocity[i];
+  }
+  step = header.step;
+  return true;
+}
+
+// Keeps [playhead, playhead + REPLAY_RING_FRAMES) decoded, nearest frames first
+void TrajectoryPlayer::run() {
+  while (!stopping) {
+    uint64_t head = playhead.load(std::memory_order_acquire);
+    uint64_t end = std::min<uint64_t>(head + REPLAY_RING_FRAMES, frames);
+
+    bool decoded = false;
+    for (uint64_t frame = head; frame < end && !stopping; frame++) {
+      if (playhead.load(std::memory_order_relaxed) != head) {
+        break; // seek / scrub, refill around the new playhead
+      }
+
+      std::atomic<int64_t> &tag = slotFrame[frame % REPLAY_RING_FRAMES];
+      if (tag.load(std::memory_order_relaxed) == static_cast<int64_t>(frame)) {
+        continue;
+      }
+
+      tag.store(-1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      uint8_t *data = slot(frame);
+      glm::vec2 *position = reinterpret_cast<glm::vec2 *>(data + sizeof(SlotHeader));
+      SlotHeader header{};
+      header.count = reader.readFrame(frame, header.step, position, position + capacity);
+      memcpy(data, &header, sizeof(header));
+
+      tag.store(static_cast<int64_t>(frame), std::memory_order_release);
+      decoded = true;
+    }
+
+    if (!decoded) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "recorder.h"
+
+#define REPLAY_RING_FRAMES 16
+
+// Plays a trajectory file back. A decoder thread keeps the REPLAY_RING_FRAMES frames starting at the
+// playhead decoded in an anonymous memory mapped ring, the render loop only copies a ready slot.
+// Slots are tagged with their frame number (seqlock style), a slot being rewritten is never shown.
+class TrajectoryPlayer {
+public:
+  TrajectoryPlayer(const char *path);
+  ~TrajectoryPlayer();
+  TrajectoryPlayer(const TrajectoryPlayer &) = delete;
+  TrajectoryPlayer &operator=(const TrajectoryPlayer &) = delete;
+
+  uint64_t frameCount() const { return frames; }
+  uint32_t everyNth() const { return stepsPerFrame; }
+
+  // moves the decode window, the decoder starts again from the chunk of this frame
+  void seek(uint64_t frame);
+  // false when the decoder has not reached the frame yet, circles are left untouched
+  bool fetch(uint64_t frame, std::vector<CircleObject> &circles, uint64_t &step);
+
+private:
+  struct SlotHeader {
+    uint64_t step;
+    uint32_t count;
+    uint32_t reserved;
+  };
+
+  TrajectoryReader reader; // decoder thread only once it runs
+  uint64_t frames;
+  uint32_t stepsPerFrame;
+  uint32_t capacity;
+
+  uint8_t *ring = nullptr;
+  size_t slotSize = 0;
+  size_t ringSize = 0;
+  std::atomic<int64_t> slotFrame[REPLAY_RING_FRAMES];
+  // fetch copies a slot here before checking its tag again, circles only see a consistent frame
+  std::vector<glm::vec2> scratchPosition;
+  std::vector<glm::vec2> scratchVelocity;
+
+  std::atomic<uint64_t> playhead{0};
+  std::atomic<bool> stopping{false};
+  std::thread decoder;
+
+  uint8_t *slot(uint64_t frame) const { return ring + (frame % REPLAY_RING_FRAMES) * slotSize; }
+  void run();
+};
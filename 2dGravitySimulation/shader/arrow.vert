@@ -0,0 +1,41 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition; // rect mesh
+
+struct Arrow {
+    vec2 position;
+    vec2 scale;
+    float angle;
+    float padding;
+};
+
+// written by field.comp, one per instance
+layout(std430, binding = 1) readonly buffer Arrows {
+    Arrow arrows[];
+};
+
+layout(location = 0) out vec3 fragColor;
+
+// ViewUniforms in renderer.h, this frame's slice
+layout(std140, binding = 4) uniform View {
+    mat4 viewProjection;
+    vec2 viewMin;
+    vec2 viewMax;
+    float pixelSize;
+    uint bodyCount;
+} view;
+
+layout(push_constant) uniform Push {
+    vec3 color;
+} push;
+
+void main() {
+    Arrow arrow = arrows[gl_InstanceIndex];
+    float c = cos(arrow.angle);
+    float s = sin(arrow.angle);
+    vec2 local = inPosition * arrow.scale;
+    vec2 world = arrow.position + vec2(c * local.x - s * local.y, s * local.x + c * local.y);
+
+    gl_Position = view.viewProjection * vec4(world, 0.0, 1.0);
+    fragColor = push.color;
+}
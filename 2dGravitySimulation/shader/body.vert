@@ -0,0 +1,59 @@
+#version 450
+
+// Bodies are read straight from a storage buffer : the body table holds the GPU body SSBO and the
+// per frame copies of the CPU circles, push.bodyTable picks one. gl_InstanceIndex walks the front
+// of the visible list written by cull.comp
+#define BODY_TABLE_SIZE 3 // BODY_TABLE_SIZE in renderer.cpp
+
+struct Body {
+    vec2 position;
+    vec2 velocity;
+    vec4 color;
+    float mass;
+    float radius;
+    vec2 acceleration;
+    vec2 impulse;
+    vec2 padding;
+};
+
+layout(std430, binding = 0) readonly buffer Bodies {
+    Body bodies[];
+} bodyTable[BODY_TABLE_SIZE];
+
+layout(std430, binding = 2) readonly buffer Visible {
+    uint visible[];
+};
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragLocal; // world units from the centre
+layout(location = 2) out float fragRadius;
+
+// ViewUniforms in renderer.h, this frame's slice
+layout(std140, binding = 4) uniform View {
+    mat4 viewProjection;
+    vec2 viewMin;
+    vec2 viewMax;
+    float pixelSize;
+    uint bodyCount;
+} view;
+
+layout(push_constant) uniform Push {
+    vec3 color;
+    uint bodyTable;
+} push;
+
+void main() {
+    uint index = visible[gl_InstanceIndex];
+    vec2 bodyPosition = bodyTable[push.bodyTable].bodies[index].position;
+    float radius = bodyTable[push.bodyTable].bodies[index].radius;
+    float reach = radius + view.pixelSize;
+
+    // 4 vertex strip : (-1,-1) (1,-1) (-1,1) (1,1), one pixel wider than the circle for the edge
+    vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1) * 2.0 - 1.0;
+    vec2 local = corner * reach;
+
+    gl_Position = view.viewProjection * vec4(bodyPosition + local, 0.0, 1.0);
+    fragColor = bodyTable[push.bodyTable].bodies[index].color.rgb;
+    fragLocal = local;
+    fragRadius = radius;
+}
@@ -0,0 +1,46 @@
+#version 450
+
+// Bodies under half a pixel (cull.comp), one point each. They sit at the back of the visible list
+#define BODY_TABLE_SIZE 3 // BODY_TABLE_SIZE in renderer.cpp
+
+struct Body {
+    vec2 position;
+    vec2 velocity;
+    vec4 color;
+    float mass;
+    float radius;
+    vec2 acceleration;
+    vec2 impulse;
+    vec2 padding;
+};
+
+layout(std430, binding = 0) readonly buffer Bodies {
+    Body bodies[];
+} bodyTable[BODY_TABLE_SIZE];
+
+layout(std430, binding = 2) readonly buffer Visible {
+    uint visible[];
+};
+
+layout(location = 0) out vec3 fragColor;
+
+// ViewUniforms in renderer.h, this frame's slice
+layout(std140, binding = 4) uniform View {
+    mat4 viewProjection;
+    vec2 viewMin;
+    vec2 viewMax;
+    float pixelSize;
+    uint bodyCount;
+} view;
+
+layout(push_constant) uniform Push {
+    vec3 color;
+    uint bodyTable;
+} push;
+
+void main() {
+    uint index = visible[visible.length() - 1 - gl_InstanceIndex];
+    gl_Position = view.viewProjection * vec4(bodyTable[push.bodyTable].bodies[index].position, 0.0, 1.0);
+    gl_PointSize = 1.0;
+    fragColor = bodyTable[push.bodyTable].bodies[index].color.rgb;
+}
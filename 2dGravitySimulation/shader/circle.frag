@@ -0,0 +1,26 @@
+#version 450
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragLocal;
+layout(location = 2) in float fragRadius;
+
+layout(location = 0) out vec4 outColor;
+
+// ViewUniforms in renderer.h, this frame's slice
+layout(std140, binding = 4) uniform View {
+    mat4 viewProjection;
+    vec2 viewMin;
+    vec2 viewMax;
+    float pixelSize;
+    uint bodyCount;
+} view;
+
+// Coverage from the signed distance to the circle, one pixel wide ramp across the edge
+void main() {
+    float distance = length(fragLocal) - fragRadius;
+    float coverage = clamp(0.5 - distance / view.pixelSize, 0.0, 1.0);
+    if (coverage <= 0.0) {
+        discard;
+    }
+    outColor = vec4(fragColor, coverage);
+}
@@ -0,0 +1,53 @@
+#version 450
+
+// Heatmap. Bilinearly upsamples the force grid written by heatgrid.comp and maps the magnitude
+// through the colour LUT, log scaled like the arrow lengths. The direction shades the colour slightly.
+#define LUT_SIZE 256 // HEATMAP_LUT_SIZE in renderer.cpp
+#define CELL_SIZE 4   // HEATMAP_CELL_SIZE in renderer.cpp
+
+layout(std430, binding = 0) readonly buffer HeatGrid {
+    vec2 heatGrid[];
+};
+
+layout(std430, binding = 1) readonly buffer Lut {
+    vec4 lut[LUT_SIZE];
+};
+
+// ViewUniforms in renderer.h, this frame's slice
+layout(std140, binding = 2) uniform View {
+    mat4 viewProjection;
+    vec2 viewMin;
+    vec2 viewMax;
+    float pixelSize;
+    uint bodyCount;
+} view;
+
+layout(push_constant) uniform Push {
+    uvec2 gridSize;
+} push;
+
+layout(location = 0) out vec4 outColor;
+
+vec2 cell(ivec2 c) {
+    c = clamp(c, ivec2(0), ivec2(push.gridSize) - 1);
+    return heatGrid[c.y * push.gridSize.x + c.x];
+}
+
+void main() {
+    // framebuffer -> world, the projection flips y. Grid cell (0, 0) is centred half a cell into the view
+    vec2 world = vec2(view.viewMin.x, view.viewMax.y) + vec2(gl_FragCoord.x, -gl_FragCoord.y) * view.pixelSize;
+    vec2 spacing = vec2(CELL_SIZE * view.pixelSize);
+    vec2 g = (world - view.viewMin) / spacing - 0.5;
+    ivec2 c = ivec2(floor(g));
+    vec2 f = g - vec2(c);
+
+    vec2 force = mix(mix(cell(c), cell(c + ivec2(1, 0)), f.x),
+                     mix(cell(c + ivec2(0, 1)), cell(c + ivec2(1, 1)), f.x), f.y);
+
+    float magnitude = length(force);
+    float t = clamp((log(max(magnitude, 1e-12) * 200.0) - 0.5) / 6.5, 0.0, 1.0);
+    vec3 color = lut[uint(t * (LUT_SIZE - 1) + 0.5)].rgb;
+
+    float shade = magnitude > 0.0 ? 0.85 + 0.15 * cos(atan(force.y, force.x)) : 1.0;
+    outColor = vec4(color * shade, 1.0);
+}
@@ -5,12 +5,20 @@ layout(location = 0) in vec2 inPosition;
 
 layout(location = 0) out vec3 fragColor;
 
+// ViewUniforms in renderer.h, this frame's slice
+layout(std140, binding = 4) uniform View {
+    mat4 viewProjection;
+    vec2 viewMin;
+    vec2 viewMax;
+    float pixelSize;
+    uint bodyCount;
+} view;
+
 layout(push_constant) uniform Push {
-    mat4 mvp;
     vec3 color;
 } push;
 
 void main() {
-    gl_Position = push.mvp * vec4(inPosition, 0.0, 1.0);
+    gl_Position = view.viewProjection * vec4(inPosition, 0.0, 1.0);
     fragColor = push.color;
 }
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../common/snapshot.h"
+
+// gravity snapshot arrays, one SoA array per body field. arrays are looked up by id and unknown ones are skipped,
+// so adding or dropping an array keeps the layout. GRAVITY_LAYOUT_VERSION changes when an id changes meaning or type
+#define GRAVITY_LAYOUT_VERSION 1
+enum GravitySnapshotArray : uint32_t {
+  GRAVITY_SNAPSHOT_CIRCLE_POSITION = 0, // glm::vec2
+  GRAVITY_SNAPSHOT_CIRCLE_VELOCITY,     // glm::vec2
+  GRAVITY_SNAPSHOT_CIRCLE_COLOR,        // glm::vec3
+  GRAVITY_SNAPSHOT_CIRCLE_MASS,         // float
+  GRAVITY_SNAPSHOT_CIRCLE_RADIUS,       // float
+  GRAVITY_SNAPSHOT_RECT_POSITION,       // glm::vec2, no longer written (the field lives on the GPU)
+  GRAVITY_SNAPSHOT_RECT_NET_FORCE,      // glm::vec2, no longer written
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <functional>
+#include <vector>
+
+// Synchronization state of a buffer as seen from outside a graph : its last write and the queue family owning it.
+// VK_PIPELINE_STAGE_2_NONE : nothing to wait for (already made visible, e.g. by a semaphore wait)
+struct FrameGraphState {
+    VkPipelineStageFlags2KHR stages = VK_PIPELINE_STAGE_2_NONE_KHR;
+    VkAccessFlags2KHR access = VK_ACCESS_2_NONE_KHR;
+    uint32_t queueFamily = VK_QUEUE_FAMILY_IGNORED;
+};
+
+// One buffer access of a pass. write : the access writes (read-modify-write included)
+struct FrameGraphUse {
+    uint32_t resource;
+    VkPipelineStageFlags2KHR stages;
+    VkAccessFlags2KHR access;
+    bool write;
+};
+
+// Passes of one command buffer, recorded in declaration order. Passes only declare the buffers they read and
+// write, the graph records the barriers in between : one vkCmdPipelineBarrier2 per pass carrying every buffer
+// that needs one, nothing for a read after a read or for a read already made visible to its stages.
+// A buffer owned by another queue family is acquired on its first use and released to the family it is
+// exported to, the other queue's graph records the matching half.
+//
+// Transient buffers only live inside the graph. placeTransients packs them into one allocation, buffers whose
+// pass ranges do not overlap share memory. Their first use waits for everything before it on the queue.
+class FrameGraph {
+public:
+    FrameGraph(VkDevice device, uint32_t queueFamily, PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2);
+
+    // state : last use before this command buffer. importing a buffer twice returns the same resource
+    uint32_t importBuffer(VkBuffer buffer, FrameGraphState state);
+    uint32_t transientBuffer(VkBuffer buffer);
+    // handed to queueFamily after the last pass
+    void exportBuffer(uint32_t resource, uint32_t queueFamily);
+    VkBuffer buffer(uint32_t resource) const;
+
+    void addPass(const std::vector<FrameGraphUse> &uses, std::function<void(VkCommandBuffer)> record);
+
+    // offsets of the transients (in transientBuffer order) into one allocation, returns its size
+    VkDeviceSize placeTransients(std::vector<VkDeviceSize> &offsets, uint32_t &memoryTypeBits) const;
+    void bindTransients(VkDeviceMemory memory, const std::vector<VkDeviceSize> &offsets) const;
+
+    void execute(VkCommandBuffer commandBuffer);
+
+private:
+    struct Resource {
+        VkBuffer buffer;
+        bool transient;
+        VkMemoryRequirements memReqs;
+        uint32_t owner;
+        uint32_t exportFamily = VK_QUEUE_FAMILY_IGNORED;
+        // execute : last write, stages read since then, what the barriers since then made visible
+        VkPipelineStageFlags2KHR writeStages;
+        VkAccessFlags2KHR writeAccess;
+        VkPipelineStageFlags2KHR readStages = VK_PIPELINE_STAGE_2_NONE_KHR;
+        VkPipelineStageFlags2KHR visibleStages = VK_PIPELINE_STAGE_2_NONE_KHR;
+        VkAccessFlags2KHR visibleAccess = VK_ACCESS_2_NONE_KHR;
+        bool used = false;
+    };
+
+    struct Pass {
+        std::vector<FrameGraphUse> uses; // one per resource
+        std::function<void(VkCommandBuffer)> record;
+    };
+
+    VkDevice device;
+    uint32_t queueFamily;
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2;
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+
+// without VK_EXT_memory_budget : the part of a heap assumed to be ours
+#define MEMORY_BUDGET_FALLBACK_FRACTION 0.8
+
+enum MemoryPurpose {
+    MEMORY_SSBO,      // particle buffers and counters
+    MEMORY_UBO,
+    MEMORY_STAGING,
+    MEMORY_MESH,      // vertex / index buffers, overlay points
+    MEMORY_READBACK,  // snapshot and stats readback
+    MEMORY_TRANSIENT, // frame graph transients
+    MEMORY_SWAPCHAIN, // driver owned, estimated
+    MEMORY_PURPOSE_COUNT
+};
+
+// Every device allocation goes through allocate / free and is counted per (heap, purpose).
+// Budget and usage per heap come from VK_EXT_memory_budget when the device has it : usage there includes other
+// processes and driver allocations. Without it the budget is MEMORY_BUDGET_FALLBACK_FRACTION of the heap and
+// usage what was counted here.
+// allocate / free / refreshBudget run on the render thread, the counters can be read from any thread.
+class MemoryTracker {
+public:
+    void init(VkPhysicalDevice physDev, VkDevice device, bool budgetSupported);
+
+    // the result is returned, running out of memory is for the caller to handle
+    VkResult allocate(const VkMemoryAllocateInfo &info, MemoryPurpose purpose, VkDeviceMemory &memory);
+    void free(VkDeviceMemory memory);
+    // memory we never allocate ourselves (swapchain images), replaces the previous estimate
+    void setEstimate(MemoryPurpose purpose, uint32_t heap, VkDeviceSize size);
+
+    void refreshBudget();
+    void report() const;
+
+    uint32_t heapCount() const { return memProps.memoryHeapCount; }
+    VkDeviceSize heapSize(uint32_t heap) const { return memProps.memoryHeaps[heap].size; }
+    uint32_t heapOf(uint32_t memoryTypeIndex) const { return memProps.memoryTypes[memoryTypeIndex].heapIndex; }
+    uint32_t deviceLocalHeap() const;
+    bool budgetQueried() const { return budgetSupported; }
+
+    uint64_t allocated(uint32_t heap, MemoryPurpose purpose) const { return bytes[heap][purpose].load(std::memory_order_relaxed); }
+    uint64_t budget(uint32_t heap) const { return heapBudget[heap].load(std::memory_order_relaxed); }
+    uint64_t usage(uint32_t heap) const { return heapUsage[heap].load(std::memory_order_relaxed); }
+    // budget - usage, 0 when over
+    uint64_t available(uint32_t heap) const;
+
+    static const char *purposeName(MemoryPurpose purpose);
+
+private:
+    struct Allocation {
+        uint32_t heap;
+        MemoryPurpose purpose;
+        VkDeviceSize size;
+    };
+
+    VkPhysicalDevice physDev = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    bool budgetSupported = false;
+    VkPhysicalDeviceMemoryProperties memProps{};
+    std::unordered_map<VkDeviceMemory, Allocation> allocations;
+    std::array<uint32_t, MEMORY_PURPOSE_COUNT> estimateHeaps{};
+    std::array<VkDeviceSize, MEMORY_PURPOSE_COUNT> estimates{};
+    std::array<std::array<std::atomic<uint64_t>, MEMORY_PURPOSE_COUNT>, VK_MAX_MEMORY_HEAPS> bytes{};
+    std::array<std::atomic<uint64_t>, VK_MAX_MEMORY_HEAPS> heapBudget{};
+    std::array<std::atomic<uint64_t>, VK_MAX_MEMORY_HEAPS> heapUsage{};
+};
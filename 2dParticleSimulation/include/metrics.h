@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Log-linear buckets over nanoseconds : values below 2^HDR_SUB_BUCKET_BITS are exact, every power of two above
+// is split into 2^HDR_SUB_BUCKET_BITS sub-buckets (3 % relative error), up to 2^(HDR_MAX_EXPONENT + 1) ns (~36 min)
+#define HDR_SUB_BUCKET_BITS 5
+#define HDR_SUB_BUCKETS (1 << HDR_SUB_BUCKET_BITS)
+#define HDR_MAX_EXPONENT 40
+#define HDR_BUCKET_COUNT ((HDR_MAX_EXPONENT - HDR_SUB_BUCKET_BITS + 2) * HDR_SUB_BUCKETS)
+
+#define METRICS_REPORT_INTERVAL 1.0 // s, window of the overlay percentiles and of one CSV row per phase
+
+// Counts only ever grow, record is one relaxed fetch_add. Readers on any thread copy the counts with snapshot,
+// a sample racing the copy is either in it or in the next one
+class HdrHistogram {
+public:
+    HdrHistogram();
+
+    void record(uint64_t value) { counts[bucket(value)].fetch_add(1, std::memory_order_relaxed); }
+    void snapshot(std::vector<uint64_t> &out) const;
+
+    static size_t bucket(uint64_t value);
+    static uint64_t bucketValue(size_t index); // middle of the bucket
+
+private:
+    std::array<std::atomic<uint64_t>, HDR_BUCKET_COUNT> counts;
+};
+
+// value below which percentile (0..1) of the samples lie, 0 without samples
+uint64_t histogramPercentile(const std::vector<uint64_t> &counts, double percentile);
+
+// CPU phases of one frame. the SIM_ phases are the CPU side of the simulation step. WAIT : the frame pacing wait
+// on the timelines (the fence wait of a fenced loop) and the readbacks of the frame it retired
+enum MetricsPhase {
+    PHASE_POLL,
+    PHASE_SIM_UNIFORMS,
+    PHASE_SIM_RECORD,
+    PHASE_SIM_SUBMIT,
+    PHASE_WAIT,
+    PHASE_ACQUIRE,
+    PHASE_RECORD,
+    PHASE_SUBMIT,
+    PHASE_PRESENT,
+    PHASE_FRAME,
+    PHASE_COUNT
+};
+
+// Always-on CPU timings of the frame loop, one histogram per phase. Phases are timed back to back, record
+// returns its end time as the start of the next phase, one clock read per phase.
+// report computes p50 / p99 / p99.9 of the last window from the difference of two snapshots, appends them to
+// the CSV file and formats the overlay lines. The cost of the instrumentation itself is estimated from a
+// calibration at startup and reported as a fraction of the frame time.
+class FrameMetrics {
+public:
+    FrameMetrics();
+    ~FrameMetrics();
+    FrameMetrics(const FrameMetrics &) = delete;
+    FrameMetrics &operator=(const FrameMetrics &) = delete;
+
+    // nullptr : no CSV
+    void openCsv(const char *path);
+
+    static uint64_t now(); // ns, steady clock
+    uint64_t record(MetricsPhase phase, uint64_t start) {
+        uint64_t end = now();
+        histograms[phase].record(end - start);
+        return end;
+    }
+
+    // at most once per METRICS_REPORT_INTERVAL, true when new overlay lines were formatted
+    bool report();
+    const std::vector<std::string> &overlayLines() const { return lines; }
+    const HdrHistogram &histogram(MetricsPhase phase) const { return histograms[phase]; }
+    static const char *phaseName(MetricsPhase phase);
+
+private:
+    std::array<HdrHistogram, PHASE_COUNT> histograms;
+    std::array<std::vector<uint64_t>, PHASE_COUNT> reportedCounts; // at the last report
+    uint64_t lastReport;
+    uint64_t startTime;
+    double sampleCost = 0.0; // ns per record, calibrated
+    uint64_t reportCost = 0; // ns spent in the last report
+    FILE *csv = nullptr;
+    std::vector<std::string> lines;
+};
+
+// 3x5 pixel glyph, rows top to bottom, 3 bits per row (MSB left). 0 : blank or unknown character
+uint16_t overlayGlyph(char c);
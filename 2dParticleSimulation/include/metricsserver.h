@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "2dParticleSimulation/include/metrics.h"
+#include "2dParticleSimulation/include/memorytracker.h"
+
+#define METRICS_POLL_INTERVAL_MS 100 // how fast the server thread notices the renderer shutting down
+#define METRICS_REQUEST_TIMEOUT_S 1
+
+// Renderer side values of the metrics endpoint. The render loop only does relaxed stores / adds,
+// the server thread loads them while serializing
+struct RendererStats {
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> simulationSteps{0};
+    std::atomic<uint64_t> uploadBytes{0};    // host writes the GPU reads : uniforms, overlay, staging copies
+    std::atomic<uint32_t> particleCount{0};  // live count of the last retired frame
+    std::atomic<uint64_t> gpuComputeNs{0};   // last timed frame
+    std::atomic<uint64_t> gpuGraphicsNs{0};
+    std::atomic<uint64_t> gpuSpanNs{0};
+    std::atomic<uint64_t> physicsStepNs{0};  // GPU compute time per simulation step
+};
+
+// Serves the metrics in the Prometheus text format over HTTP/1.0, on a Unix domain socket (socketPath) or
+// 127.0.0.1:port. One thread accepts and answers every request itself, the render loop is never touched :
+// phase percentiles come from snapshots of the FrameMetrics histograms, memory from the MemoryTracker counters,
+// everything else from RendererStats.
+class MetricsServer {
+public:
+    MetricsServer(const FrameMetrics &metrics, const RendererStats &stats, const MemoryTracker &memory, const char *socketPath, uint16_t port);
+    ~MetricsServer();
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+private:
+    const FrameMetrics &metrics;
+    const RendererStats &stats;
+    const MemoryTracker &memory;
+    std::string socketPath;
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread server;
+
+    void run();
+    void serve(int client);
+    std::string render() const;
+};
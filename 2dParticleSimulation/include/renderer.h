@@ -4,8 +4,16 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <deque>
+#include <functional>
+#include <memory>
 
-static void framebufferSizeCallback(GLFWwindow* window, int width, int height);
+#include "2dParticleSimulation/include/framegraph.h"
+#include "2dParticleSimulation/include/metrics.h"
+#include "2dParticleSimulation/include/metricsserver.h"
+#include "2dParticleSimulation/include/memorytracker.h"
 
 struct Vertex {
     glm::vec2 pos;
@@ -35,6 +43,9 @@ struct Particle {
     glm::vec2 position;
     glm::vec2 velocity;
     glm::vec4 color;
+    float age;
+    float lifetime; // lifetime <= 0 : particle never dies
+    glm::vec2 padding; // std140 array stride (48 bytes)
 
     static VkVertexInputBindingDescription getBindingDesc() {
         VkVertexInputBindingDescription bindDesc{};
@@ -63,8 +74,59 @@ struct Particle {
     }
 };
 
+#define MAX_EMITTERS 4
+
+// GPU side emitter. Spawned particles start at position and leave inside the cone (direction +- spread).
+struct Emitter {
+    glm::vec2 position;
+    glm::vec2 direction;
+    glm::vec4 color;
+    float spread;
+    float speed;
+    float lifetime;
+    float rate; // particles per dt unit
+};
+
 struct UniformBufferObject {
     float dt = 1.0f;
+    uint32_t seed = 0;
+    uint32_t emitterCount = 0;
+    uint32_t spawnTotal = 0;
+    glm::uvec4 spawnOffsets{0}; // exclusive prefix sum of the per emitter spawn counts
+    Emitter emitters[MAX_EMITTERS];
+    uint32_t ringBegin = 0;  // in place mode : first slot of the emitter ring
+    uint32_t ringCursor = 0; // in place mode : next ring slot to overwrite (relative to ringBegin)
+    // emit.comp workgroups for spawnTotal, read by vkCmdDispatchIndirect only (not declared in the shaders)
+    VkDispatchIndirectCommand emitDispatch{0, 1, 1};
+};
+
+// Push constants of the seeding pass (seed.comp). Particle i is a pure function of (seed, i).
+struct SeedPushConstants {
+    uint32_t seed;
+    uint32_t count;
+    float aspect;
+    float speed;
+};
+
+// Written by the compute passes, consumed by vkCmdDispatchIndirect / vkCmdDrawIndirect.
+// The CPU never reads the live count back.
+struct ParticleCounter {
+    VkDispatchIndirectCommand dispatch;
+    VkDrawIndirectCommand draw;
+    uint32_t aliveCount;
+};
+
+struct RendererSettings {
+    bool asyncCompute = true;   // prefer a compute only queue family
+    bool fixedTimestep = false; // integrate with a fixed dt, several substeps per frame
+    bool inPlaceUpdate = false; // one particle buffer updated in place instead of the buffer ring
+    uint32_t seed = 0;          // initial particles are reproducible from this alone
+    const char *restorePath = nullptr;                  // start from a snapshot instead of seeding
+    const char *snapshotPath = "particle_snapshot.bin"; // written on F5
+    const char *metricsCsvPath = nullptr;               // per phase CPU percentiles, appended every METRICS_REPORT_INTERVAL
+    const char *metricsSocketPath = nullptr;            // metrics endpoint on a Unix domain socket
+    uint16_t metricsPort = 0;                           // or on 127.0.0.1:metricsPort. neither : no endpoint
+    uint32_t particleCapacity = 0;                      // 0 : MAX_PARTICLE_COUNT. lowered (or in place) when it does not fit
 };
 
 class Renderer {
@@ -74,9 +136,11 @@ public:
     GLFWwindow *window;
     bool framebufferResized = false;
 
-    Renderer();
+    Renderer(const RendererSettings &settings = {});
     ~Renderer();
     void run();
+    void burst(uint32_t emitterIndex, uint32_t count);
+    void requestSnapshot();
 
 private:
 
@@ -86,13 +150,16 @@ private:
 
     VkPhysicalDevice physDev;
     VkDevice device;
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2 = nullptr;
     VkQueue graphicsQueue;
     VkQueue computeQueue;
     VkQueue presentQueue;
     uint32_t graphicsAndComputeFamilyIndex;
+    uint32_t computeFamilyIndex;
     uint32_t presentFamilyIndex;
+    RendererSettings settings;
 
-    VkSwapchainKHR swapchain;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
     VkFormat swapchainImageFormat;
     VkExtent2D swapchainImageExtent;
     std::vector<VkImage> swapchainImages;
@@ -103,16 +170,122 @@ private:
     VkPipeline graphicsPipeline;
     VkPipelineLayout computePipelineLayout;
     VkPipeline computePipeline;
+    VkPipeline emitPipeline;
+    VkPipeline indirectArgsPipeline;
+    VkPipeline seedPipeline;
     std::vector<VkFramebuffer> framebuffers;
     VkCommandPool commandPool;
+    VkCommandPool computeCommandPool;
+    // recorded once and resubmitted. graphics : per (frame in flight, swapchain image, drawn slot),
+    // compute : per (frame in flight, particle slot, substep count), recorded again when computeRecordKey changes
     std::vector<VkCommandBuffer> commandBuffers;
     std::vector<VkCommandBuffer> computeCommandBuffers;
+    std::vector<bool> commandBufferRecorded;
+    std::vector<uint32_t> computeRecordKeys;
+    uint32_t commandBufferRecords = 0; // since the last report
+    uint32_t lastRecordRate = UINT32_MAX;
+    double lastRecordReport = 0.0;
     
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkFence> inFlightFences;
-    std::vector<VkSemaphore> computeFinishedSemaphores;
-    std::vector<VkFence> computeInFlightFences;
+    // timeline semaphores, frame k signals k + 1 on both. compute(k) waits for graphics(k - 1),
+    // graphics(k) for compute(k - 1) (in place : compute(k))
+    VkSemaphore computeTimeline;
+    VkSemaphore graphicsTimeline;
+    uint64_t frameNumber = 0; // frames submitted
+
+    // retired swapchain resources, destroyed once the graphics timeline reaches frame
+    struct DeferredDeletion {
+        uint64_t frame;
+        std::function<void()> destroy;
+    };
+    std::deque<DeferredDeletion> deletionQueue;
+
+    // retired swapchains and their render finished semaphores. a retired submission does not mean the present waiting
+    // on the semaphore is done : they go once every present to the swapchain signalled its present fence
+    // (VK_EXT_swapchain_maintenance1), otherwise once later swapchains acquired as many images as it had
+    struct RetiredSwapchain {
+        VkSwapchainKHR swapchain;
+        std::vector<VkSemaphore> renderFinishedSemaphores;
+        std::vector<VkFence> presentFences;
+        uint64_t acquireCount;
+        uint64_t frame; // after the views and framebuffers deferred with it
+    };
+    std::deque<RetiredSwapchain> retiredSwapchains;
+    bool surfaceMaintenance = false; // VK_EXT_surface_maintenance1 enabled on the instance
+    bool presentFencesEnabled = false;
+    std::vector<VkFence> presentFences; // presents to the current swapchain
+    std::vector<VkFence> freePresentFences;
+    uint64_t acquireCount = 0; // images acquired, across swapchains
+
+    // particle buffer ring : compute(k) reads slot k-1, writes slot k, graphics(k) draws slot k-2
+    // in place mode : every slot maps to the single buffer, graphics(k) draws what compute(k) wrote
+    uint32_t particleSlot = 0;
+    std::vector<bool> particleSlotReadyToDraw;   // released by compute, not yet acquired by graphics
+    std::vector<bool> particleSlotOnGraphics;    // released by graphics, not yet acquired by compute
+
+    // fixed timestep : substeps ping-pong between the frame's slot and this scratch slot inside one submission
+    VkBuffer substepParticleBuffer = VK_NULL_HANDLE;
+    VkBuffer substepCounterBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory transientMemory = VK_NULL_HANDLE; // frame graph transients (the scratch slot), see createSubstepBuffers
+    VkDeviceSize transientMemorySize = 0;
+    std::vector<VkDescriptorSet> substepDescriptorSets; // per slot : prev -> scratch, cur -> scratch, scratch -> cur
+    float simulationTimeAccumulator = 0.0f;
+    uint32_t simulationSubsteps = 1;
+    uint32_t simulationStepsSinceReport = 0;
+
+    // snapshot : compute copies one slot into the readback buffer, a worker thread writes the file once
+    // the frame's compute timeline value is reached. the frame loop never waits for either
+    enum SnapshotState { SNAPSHOT_IDLE, SNAPSHOT_REQUESTED, SNAPSHOT_COPYING, SNAPSHOT_WRITING };
+    std::atomic<int> snapshotState{SNAPSHOT_IDLE};
+    uint32_t snapshotFrame = UINT32_MAX;
+    uint64_t snapshotStep = 0;
+    float snapshotDt = 0.0f;
+    VkBuffer snapshotReadbackBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory snapshotReadbackBufferMemory = VK_NULL_HANDLE;
+    void *snapshotReadbackMapped = nullptr;
+    std::thread snapshotWriter;
+    bool snapshotKeyDown = false;
+    uint64_t simulationStepCount = 0;
+    float simulationDt = 0.0f;
+
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+    float timestampPeriod = 0.0f;
+    std::vector<bool> timestampsWritten;
+    double gpuComputeTime = 0.0;
+    double gpuGraphicsTime = 0.0;
+    double gpuFrameSpan = 0.0;
+    uint32_t gpuTimedFrames = 0;
+    double lastTimingReport = 0.0;
+
+    // CPU phase timings, phaseStart : end of the last timed phase
+    FrameMetrics metrics;
+    uint64_t phaseStart = 0;
+
+    // served by metricsServer (declared last : stopped before what it reads)
+    RendererStats stats;
+    // live count of each frame in flight, copied after the simulation step
+    VkBuffer statsReadbackBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory statsReadbackBufferMemory = VK_NULL_HANDLE;
+    uint32_t *statsReadbackMapped = nullptr;
+    std::vector<uint32_t> timedSubsteps; // per frame in flight, simulation steps behind its compute timestamps
+
+    // every device allocation, by heap and purpose
+    MemoryTracker memoryTracker;
+    // chosen by admitParticleMemory
+    uint32_t particleCapacity = 0;
+    uint32_t initialParticleCount = 0;
+
+    // metrics overlay : text pixels drawn as points by the particle pipeline, per frame in flight.
+    // the draw count sits in front of the points (vkCmdDrawIndirect), new text never records the command buffers again
+    std::vector<VkBuffer> overlayBuffers;
+    std::vector<VkDeviceMemory> overlayBuffersMemory;
+    std::vector<void*> overlayBuffersMapped;
+    std::vector<Particle> overlayPoints;
+    uint64_t overlayVersion = 1;
+    std::vector<uint64_t> overlayUploadedVersions;
+    bool overlayEnabled = true;
+    bool overlayKeyDown = false;
     
     // std::vector<Vertex> vertices;
     // std::vector<uint16_t> indices;
@@ -126,11 +299,21 @@ private:
     std::vector<void*> uniformBuffersMapped;
     std::vector<VkBuffer> shaderStorageBuffers;
     std::vector<VkDeviceMemory> shaderStorageBuffersMemory;
+    std::vector<VkBuffer> particleCounterBuffers;
+    std::vector<VkDeviceMemory> particleCounterBuffersMemory;
+
+    std::vector<Emitter> emitters;
+    std::vector<float> emitterAccumulators;
+    std::vector<uint32_t> emitterBursts;
+    uint32_t spawnTotal = 0;
+    uint32_t spawnRingCursor = 0;
 
     VkDescriptorPool descriptorPool;
     VkDescriptorSetLayout computeDescriptorSetLayout;
     std::vector<VkDescriptorSet> computeDesciptorSets;
 
+    std::unique_ptr<MetricsServer> metricsServer;
+
     void drawFrame();
 
     void initWindow();
@@ -138,31 +321,58 @@ private:
     void setupDebugMessenger();
     void createSurface();
     void selectPhysicalDevice();
+    bool deviceSupportsRequirements(VkPhysicalDevice device, const VkPhysicalDeviceProperties &props);
     void createLogicalDevice();
     void createSwapchain();
     void createImageViews();
     void createRenderpass();
     void createGraphicsPipeline();
     void createComputePipeline();
+    VkPipeline createComputeShaderPipeline(const char* filename);
     void createFramebuffers();
     void createCommandPool();
+    void createTimestampQueryPool();
+    void collectTimestamps(uint32_t frame);
     void createCommandBuffers();
     void createComputeCommandBuffers();
     void createSyncObjects();
-    void recordCommandbuffer(VkCommandBuffer &commandBuffer, uint32_t imageIndex);
-    void recordComputeCommandbuffer(VkCommandBuffer &commandbuffer);
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memProps, VkBuffer &buffer, VkDeviceMemory &bufferMemory);
+    void recordCommandbuffer(VkCommandBuffer &commandBuffer, uint32_t imageIndex, uint32_t drawSlot, bool drawParticles);
+    void recordComputeCommandbuffer(VkCommandBuffer &commandbuffer, bool snapshot, bool acquire);
+    uint32_t computeRecordKey(bool snapshot, bool acquire);
+    void reportCommandBufferRecords();
+    void buildComputeGraph(FrameGraph &graph, uint32_t substeps, bool snapshot, bool acquire);
+    void addSimulationStep(FrameGraph &graph, std::vector<VkDescriptorSet> &sets, uint32_t setIndex, uint32_t particlesIn, uint32_t counterIn, uint32_t particlesOut, uint32_t counterOut, bool emit);
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memProps, VkBuffer &buffer, VkDeviceMemory &bufferMemory, MemoryPurpose purpose);
     void createVertexBuffer(std::vector<Vertex> &vertices);
     void createIndexBuffer(std::vector<uint16_t> &indices);
     void createUniformBuffers();
     void updateUniformBuffer(uint32_t currentImage);
+    void createOverlayBuffers();
+    void buildOverlay();
+    void uploadOverlay(uint32_t frame);
     void createShaderStorageBuffers();
+    void createSubstepBuffers();
+    void createParticleCounterBuffers();
+    void seedParticles();
+    void restoreParticles();
+    void addSnapshotCopy(FrameGraph &graph, uint32_t particles, uint32_t counter);
+    void addStatsCopy(FrameGraph &graph, uint32_t counter);
+    VkDeviceSize particleMemoryRequirement(uint32_t capacity, bool inPlace) const;
+    void admitParticleMemory();
+    void collectSnapshot(uint32_t frame);
+    void reportParticleMemory();
+    uint32_t particleBufferIndex(uint32_t slot);
+    void createEmitters();
     void createDescriptorPool();
     void createDescriptorSetLayout();
     void createDescriptorSets();
+    void writeComputeDescriptorSet(VkDescriptorSet descriptorSet, VkBuffer uniformBuffer, VkBuffer particlesIn, VkBuffer counterIn, VkBuffer particlesOut, VkBuffer counterOut);
     
-    void cleanupSwapchain();
-    void recreateSwapchain(uint32_t imageIndex);
+    void recreateSwapchain();
+    void deferDeletion(std::function<void()> destroy);
+    void collectDeletions();
+    VkFence takePresentFence();
+    void destroyRetiredSwapchain(RetiredSwapchain &retired);
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
     void copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size);
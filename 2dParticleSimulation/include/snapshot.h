@@ -0,0 +1,9 @@
+#pragma once
+
+#include "common/snapshot.h"
+
+// particle snapshot arrays. PARTICLE_LAYOUT_VERSION changes whenever struct Particle does
+#define PARTICLE_LAYOUT_VERSION 1
+enum ParticleSnapshotArray : uint32_t {
+    PARTICLE_SNAPSHOT_PARTICLES = 0, // Particle[aliveCount], same layout as the SSBO
+};
@@ -6,7 +6,8 @@ layout(location = 1) in vec4 inColor;
 layout(location = 0) out vec3 fragColor;
 
 void main() {
-    gl_PointSize = 14.0;
+    // metrics overlay pixels carry their point size as a negative alpha
+    gl_PointSize = inColor.a < 0.0 ? -inColor.a : 14.0;
     gl_Position = vec4(inPosition.xy, 0.0, 1.0);
     fragColor = inColor.rgb;
 }
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include "2dParticleSimulation/include/framegraph.h"
+#include "2dParticleSimulation/include/utils.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+// only these need flushing, a read never has to be made available
+#define FRAME_GRAPH_WRITE_ACCESS (VK_ACCESS_2_SHADER_WRITE_BIT_KHR | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR | \
+                                  VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR | VK_ACCESS_2_HOST_WRITE_BIT_KHR |          \
+                                  VK_ACCESS_2_MEMORY_WRITE_BIT_KHR | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR)
+
+FrameGraph::FrameGraph(VkDevice device, uint32_t queueFamily, PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2)
+    : device(device), queueFamily(queueFamily), cmdPipelineBarrier2(cmdPipelineBarrier2) {}
+
+uint32_t FrameGraph::importBuffer(VkBuffer buffer, FrameGraphState state) {
+    for (uint32_t i = 0; i < resources.size(); i++) {
+        if (resources[i].buffer == buffer) {
+            return i;
+        }
+    }
+
+    Resource resource{};
+    resource.buffer = buffer;
+    resource.transient = false;
+    resource.owner = state.queueFamily;
+    resource.writeStages = state.stages;
+    resource.writeAccess = state.access & FRAME_GRAPH_WRITE_ACCESS;
+    resources.push_back(resource);
+    return resources.size() - 1;
+}
+
+uint32_t FrameGraph::transientBuffer(VkBuffer buffer) {
+    Resource resource{};
+    resource.buffer = buffer;
+    resource.transient = true;
+    resource.owner = VK_QUEUE_FAMILY_IGNORED;
+    resource.writeStages = VK_PIPELINE_STAGE_2_NONE_KHR;
+    resource.writeAccess = VK_ACCESS_2_NONE_KHR;
+    if (buffer != VK_NULL_HANDLE) {
+        vkGetBufferMemoryRequirements(device, buffer, &resource.memReqs);
+    }
+    resources.push_back(resource);
+    return resources.size() - 1;
+}
+
+void FrameGraph::exportBuffer(uint32_t resource, uint32_t queueFamily) {
+    resources.at(resource).exportFamily = queueFamily;
+}
+
+VkBuffer FrameGraph::buffer(uint32_t resource) const {
+    return resources.at(resource).buffer;
+}
+
+void FrameGraph::addPass(const std::vector<FrameGraphUse> &uses, std::function<void(VkCommandBuffer)> record) {
+    // several uses of one buffer (e.g. indirect args + storage read) become one
+    Pass pass;
+    for (const FrameGraphUse &use : uses) {
+        if (use.resource >= resources.size()) {
+            throw std::runtime_error("Frame graph pass uses an unknown resource!");
+        }
+
+        auto merged = std::find_if(pass.uses.begin(), pass.uses.end(),
+                                   [&](const FrameGraphUse &other) { return other.resource == use.resource; });
+        if (merged == pass.uses.end()) {
+            pass.uses.push_back(use);
+        } else {
+            merged->stages |= use.stages;
+            merged->access |= use.access;
+            merged->write = merged->write || use.write;
+        }
+    }
+    pass.record = std::move(record);
+    passes.push_back(std::move(pass));
+}
+
+// Largest transient first, each at the lowest offset clear of the transients live during one of its passes
+VkDeviceSize FrameGraph::placeTransients(std::vector<VkDeviceSize> &offsets, uint32_t &memoryTypeBits) const {
+    std::vector<uint32_t> transients;
+    std::vector<int> transientIndex(resources.size(), -1);
+    for (uint32_t i = 0; i < resources.size(); i++) {
+        if (resources[i].transient) {
+            transientIndex[i] = transients.size();
+            transients.push_back(i);
+        }
+    }
+
+    // pass range of each transient. never used : empty range, shares memory with anything
+    std::vector<uint32_t> first(transients.size(), UINT32_MAX);
+    std::vector<uint32_t> last(transients.size(), 0);
+    for (uint32_t p = 0; p < passes.size(); p++) {
+        for (const FrameGraphUse &use : passes[p].uses) {
+            int t = transientIndex[use.resource];
+            if (t != -1) {
+                first[t] = std::min(first[t], p);
+                last[t] = std::max(last[t], p);
+            }
+        }
+    }
+
+    std::vector<uint32_t> order(transients.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return resources[transients[a]].memReqs.size > resources[transients[b]].memReqs.size;
+    });
+
+    offsets.assign(transients.size(), 0);
+    memoryTypeBits = ~0u;
+    VkDeviceSize totalSize = 0;
+    std::vector<uint32_t> placed;
+    for (uint32_t t : order) {
+        const VkMemoryRequirements &memReqs = resources[transients[t]].memReqs;
+        memoryTypeBits &= memReqs.memoryTypeBits;
+
+        VkDeviceSize offset = 0;
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            for (uint32_t other : placed) {
+                VkDeviceSize otherEnd = offsets[other] + resources[transients[other]].memReqs.size;
+                bool live = first[t] <= last[other] && first[other] <= last[t];
+                bool overlaps = offset < otherEnd && offsets[other] < offset + memReqs.size;
+                if (live && overlaps) {
+                    offset = (otherEnd + memReqs.alignment - 1) / memReqs.alignment * memReqs.alignment;
+                    moved = true;
+                }
+            }
+        }
+
+        offsets[t] = offset;
+        placed.push_back(t);
+        totalSize = std::max(totalSize, offset + memReqs.size);
+    }
+
+    return totalSize;
+}
+
+void FrameGraph::bindTransients(VkDeviceMemory memory, const std::vector<VkDeviceSize> &offsets) const {
+    uint32_t t = 0;
+    for (const Resource &resource : resources) {
+        if (resource.transient) {
+            chk(vkBindBufferMemory(device, resource.buffer, memory, offsets.at(t++)), "vkBindBufferMemory");
+        }
+    }
+}
+
+void FrameGraph::execute(VkCommandBuffer commandBuffer) {
+    std::vector<VkBufferMemoryBarrier2KHR> bufferBarriers;
+    std::vector<VkMemoryBarrier2KHR> memoryBarriers;
+
+    auto flush = [&]() {
+        if (bufferBarriers.empty() && memoryBarriers.empty()) {
+            return;
+        }
+
+        VkDependencyInfoKHR dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+        dependencyInfo.memoryBarrierCount = memoryBarriers.size();
+        dependencyInfo.pMemoryBarriers = memoryBarriers.data();
+        dependencyInfo.bufferMemoryBarrierCount = bufferBarriers.size();
+        dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+        cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+        bufferBarriers.clear();
+        memoryBarriers.clear();
+    };
+
+    for (const Pass &pass : passes) {
+        for (const FrameGraphUse &use : pass.uses) {
+            Resource &resource = resources[use.resource];
+
+            VkBufferMemoryBarrier2KHR barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+            barrier.dstStageMask = use.stages;
+            barrier.dstAccessMask = use.access;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.buffer = resource.buffer;
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+
+            if (resource.transient && !resource.used) {
+                // the memory may still be in use by an aliasing transient or an earlier submission of this graph
+                VkMemoryBarrier2KHR memoryBarrier{};
+                memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+                memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR;
+                memoryBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR;
+                memoryBarrier.dstStageMask = use.stages;
+                memoryBarrier.dstAccessMask = use.access;
+                memoryBarriers.push_back(memoryBarrier);
+            } else if (resource.owner != VK_QUEUE_FAMILY_IGNORED && resource.owner != queueFamily) {
+                // acquire, the release recorded on the owning queue made its writes available
+                barrier.srcQueueFamilyIndex = resource.owner;
+                barrier.dstQueueFamilyIndex = queueFamily;
+                bufferBarriers.push_back(barrier);
+                resource.owner = queueFamily;
+            } else if (use.write) {
+                // after a write or a read : wait for both, only the write needs flushing
+                barrier.srcStageMask = resource.writeStages | resource.readStages;
+                barrier.srcAccessMask = resource.writeAccess;
+                if (barrier.srcStageMask != VK_PIPELINE_STAGE_2_NONE_KHR) {
+                    bufferBarriers.push_back(barrier);
+                }
+            } else {
+                bool visible = (use.stages & ~resource.visibleStages) == 0 && (use.access & ~resource.visibleAccess) == 0;
+                barrier.srcStageMask = resource.writeStages;
+                barrier.srcAccessMask = resource.writeAccess;
+                if (resource.writeStages != VK_PIPELINE_STAGE_2_NONE_KHR && !visible) {
+                    bufferBarriers.push_back(barrier);
+                }
+            }
+            resource.used = true;
+
+            if (use.write) {
+                resource.writeStages = use.stages;
+                resource.writeAccess = use.access & FRAME_GRAPH_WRITE_ACCESS;
+                resource.readStages = VK_PIPELINE_STAGE_2_NONE_KHR;
+                resource.visibleStages = VK_PIPELINE_STAGE_2_NONE_KHR;
+                resource.visibleAccess = VK_ACCESS_2_NONE_KHR;
+            } else {
+                resource.readStages |= use.stages;
+                resource.visibleStages |= use.stages;
+                resource.visibleAccess |= use.access;
+            }
+        }
+
+        flush();
+        pass.record(commandBuffer);
+    }
+
+    // release, the graph of the receiving queue records the acquire
+    for (Resource &resource : resources) {
+        if (resource.exportFamily == VK_QUEUE_FAMILY_IGNORED || resource.owner != queueFamily || resource.exportFamily == queueFamily) {
+            continue;
+        }
+
+        VkBufferMemoryBarrier2KHR barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+        barrier.srcStageMask = resource.writeStages | resource.readStages;
+        barrier.srcAccessMask = resource.writeAccess;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE_KHR;
+        barrier.dstAccessMask = VK_ACCESS_2_NONE_KHR;
+        barrier.srcQueueFamilyIndex = queueFamily;
+        barrier.dstQueueFamilyIndex = resource.exportFamily;
+        barrier.buffer = resource.buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        bufferBarriers.push_back(barrier);
+        resource.owner = resource.exportFamily;
+    }
+    flush();
+}
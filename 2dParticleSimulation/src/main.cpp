@@ -1,10 +1,46 @@
 #include "2dParticleSimulation/include/renderer.h"
 
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
 
+int main(int argc, char **argv) {
+    // --no-async-compute : keep compute on the graphics queue family (to compare GPU timings)
+    // --fixed-step : integrate with a fixed dt, several substeps per frame in one submission
+    // --in-place : single particle buffer updated in place (no buffer ring, no compaction)
+    // --seed <n> : seed of the initial particles (default : current time)
+    // --restore <file> : start from a snapshot, --snapshot <file> : where F5 writes one
+    // --metrics-csv <file> : per phase CPU percentiles every second (F3 toggles the overlay)
+    // --metrics-socket <path> / --metrics-port <port> : Prometheus text over http on a Unix socket / 127.0.0.1
+    // --capacity <n> : particle buffer capacity, lowered when it does not fit into the device memory budget
+    RendererSettings settings{};
+    settings.seed = (uint32_t)time(nullptr);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-async-compute") == 0) {
+            settings.asyncCompute = false;
+        } else if (strcmp(argv[i], "--fixed-step") == 0) {
+            settings.fixedTimestep = true;
+        } else if (strcmp(argv[i], "--in-place") == 0) {
+            settings.inPlaceUpdate = true;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            settings.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            settings.restorePath = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            settings.snapshotPath = argv[++i];
+        } else if (strcmp(argv[i], "--metrics-csv") == 0 && i + 1 < argc) {
+            settings.metricsCsvPath = argv[++i];
+        } else if (strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc) {
+            settings.metricsSocketPath = argv[++i];
+        } else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc) {
+            settings.metricsPort = (uint16_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--capacity") == 0 && i + 1 < argc) {
+            settings.particleCapacity = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+    }
 
-int main() {
-    Renderer renderer;
+    Renderer renderer(settings);
 
     renderer.run();
    
-}
\ No newline at end of file
+}
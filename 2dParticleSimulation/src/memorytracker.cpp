@@ -0,0 +1,121 @@
+#include "2dParticleSimulation/include/memorytracker.h"
+
+#include <stdio.h>
+
+void MemoryTracker::init(VkPhysicalDevice physDev, VkDevice device, bool budgetSupported) {
+    this->physDev = physDev;
+    this->device = device;
+    this->budgetSupported = budgetSupported;
+    vkGetPhysicalDeviceMemoryProperties(physDev, &memProps);
+    refreshBudget();
+}
+
+VkResult MemoryTracker::allocate(const VkMemoryAllocateInfo &info, MemoryPurpose purpose, VkDeviceMemory &memory) {
+    VkResult res = vkAllocateMemory(device, &info, nullptr, &memory);
+    uint32_t heap = heapOf(info.memoryTypeIndex);
+    if (res != VK_SUCCESS) {
+        printf("[Error] | %.2f MiB of %s memory on heap %u failed\n", info.allocationSize / (1024.0 * 1024.0), purposeName(purpose), heap);
+        refreshBudget();
+        report();
+        return res;
+    }
+
+    allocations[memory] = {heap, purpose, info.allocationSize};
+    bytes[heap][purpose].fetch_add(info.allocationSize, std::memory_order_relaxed);
+    if (!budgetSupported) {
+        heapUsage[heap].fetch_add(info.allocationSize, std::memory_order_relaxed);
+    }
+    return res;
+}
+
+void MemoryTracker::free(VkDeviceMemory memory) {
+    auto allocation = allocations.find(memory);
+    if (allocation != allocations.end()) {
+        const Allocation &a = allocation->second;
+        bytes[a.heap][a.purpose].fetch_sub(a.size, std::memory_order_relaxed);
+        if (!budgetSupported) {
+            heapUsage[a.heap].fetch_sub(a.size, std::memory_order_relaxed);
+        }
+        allocations.erase(allocation);
+    }
+    vkFreeMemory(device, memory, nullptr);
+}
+
+void MemoryTracker::setEstimate(MemoryPurpose purpose, uint32_t heap, VkDeviceSize size) {
+    bytes[estimateHeaps[purpose]][purpose].fetch_sub(estimates[purpose], std::memory_order_relaxed);
+    if (!budgetSupported) {
+        heapUsage[estimateHeaps[purpose]].fetch_sub(estimates[purpose], std::memory_order_relaxed);
+        heapUsage[heap].fetch_add(size, std::memory_order_relaxed);
+    }
+    bytes[heap][purpose].fetch_add(size, std::memory_order_relaxed);
+    estimateHeaps[purpose] = heap;
+    estimates[purpose] = size;
+}
+
+void MemoryTracker::refreshBudget() {
+    if (!budgetSupported) {
+        for (uint32_t heap = 0; heap < memProps.memoryHeapCount; heap++) {
+            heapBudget[heap].store(memProps.memoryHeaps[heap].size * MEMORY_BUDGET_FALLBACK_FRACTION, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps{};
+    budgetProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    VkPhysicalDeviceMemoryProperties2 memProps2{};
+    memProps2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    memProps2.pNext = &budgetProps;
+    vkGetPhysicalDeviceMemoryProperties2(physDev, &memProps2);
+
+    for (uint32_t heap = 0; heap < memProps.memoryHeapCount; heap++) {
+        heapBudget[heap].store(budgetProps.heapBudget[heap], std::memory_order_relaxed);
+        heapUsage[heap].store(budgetProps.heapUsage[heap], std::memory_order_relaxed);
+    }
+}
+
+uint32_t MemoryTracker::deviceLocalHeap() const {
+    for (uint32_t heap = 0; heap < memProps.memoryHeapCount; heap++) {
+        if (memProps.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            return heap;
+        }
+    }
+    return 0;
+}
+
+uint64_t MemoryTracker::available(uint32_t heap) const {
+    uint64_t b = budget(heap);
+    uint64_t u = usage(heap);
+    return b > u ? b - u : 0;
+}
+
+void MemoryTracker::report() const {
+    double toMiB = 1.0 / (1024.0 * 1024.0);
+    printf("[Info] | Device memory (%s) :\n", budgetSupported ? "VK_EXT_memory_budget" : "no budget extension, counted allocations");
+    for (uint32_t heap = 0; heap < memProps.memoryHeapCount; heap++) {
+        uint64_t b = budget(heap);
+        uint64_t u = usage(heap);
+        printf("[Info] |   heap %u%s : %.2f / %.2f MiB budget (%.1f %%), heap %.2f MiB |", heap,
+               memProps.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ? " (device local)" : "",
+               u * toMiB, b * toMiB, b > 0 ? 100.0 * u / b : 0.0, memProps.memoryHeaps[heap].size * toMiB);
+        for (int purpose = 0; purpose < MEMORY_PURPOSE_COUNT; purpose++) {
+            uint64_t size = allocated(heap, static_cast<MemoryPurpose>(purpose));
+            if (size > 0) {
+                printf(" %s %.2f", purposeName(static_cast<MemoryPurpose>(purpose)), size * toMiB);
+            }
+        }
+        printf("\n");
+    }
+}
+
+const char *MemoryTracker::purposeName(MemoryPurpose purpose) {
+    switch (purpose) {
+    case MEMORY_SSBO: return "ssbo";
+    case MEMORY_UBO: return "ubo";
+    case MEMORY_STAGING: return "staging";
+    case MEMORY_MESH: return "mesh";
+    case MEMORY_READBACK: return "readback";
+    case MEMORY_TRANSIENT: return "transient";
+    case MEMORY_SWAPCHAIN: return "swapchain";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,220 @@
+#include "2dParticleSimulation/include/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <stdexcept>
+
+HdrHistogram::HdrHistogram() {
+    for (std::atomic<uint64_t> &count : counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void HdrHistogram::snapshot(std::vector<uint64_t> &out) const {
+    out.resize(HDR_BUCKET_COUNT);
+    for (size_t i = 0; i < HDR_BUCKET_COUNT; i++) {
+        out[i] = counts[i].load(std::memory_order_relaxed);
+    }
+}
+
+size_t HdrHistogram::bucket(uint64_t value) {
+    if (value < HDR_SUB_BUCKETS) {
+        return value;
+    }
+    value = std::min<uint64_t>(value, (2ull << HDR_MAX_EXPONENT) - 1);
+
+    // the HDR_SUB_BUCKET_BITS bits below the leading one pick the sub-bucket
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    uint32_t shift = exponent - HDR_SUB_BUCKET_BITS;
+    return (shift + 1) * HDR_SUB_BUCKETS + ((value >> shift) - HDR_SUB_BUCKETS);
+}
+
+uint64_t HdrHistogram::bucketValue(size_t index) {
+    if (index < HDR_SUB_BUCKETS) {
+        return index;
+    }
+
+    uint32_t shift = index / HDR_SUB_BUCKETS - 1;
+    uint64_t lower = (HDR_SUB_BUCKETS + index % HDR_SUB_BUCKETS) << shift;
+    return lower + ((1ull << shift) >> 1);
+}
+
+uint64_t histogramPercentile(const std::vector<uint64_t> &counts, double percentile) {
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    // rank of the sample, 1 based
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(percentile * total + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return HdrHistogram::bucketValue(i);
+        }
+    }
+    return HdrHistogram::bucketValue(counts.size() - 1);
+}
+
+FrameMetrics::FrameMetrics() {
+    for (std::vector<uint64_t> &counts : reportedCounts) {
+        counts.assign(HDR_BUCKET_COUNT, 0);
+    }
+
+    // cost of one record : a clock read and a relaxed add, measured on a histogram nobody reports
+    HdrHistogram calibration;
+    const int samples = 1024;
+    uint64_t begin = now();
+    uint64_t start = begin;
+    for (int i = 0; i < samples; i++) {
+        uint64_t end = now();
+        calibration.record(end - start);
+        start = end;
+    }
+    sampleCost = static_cast<double>(now() - begin) / samples;
+
+    startTime = now();
+    lastReport = startTime;
+}
+
+FrameMetrics::~FrameMetrics() {
+    if (csv != nullptr) {
+        fclose(csv);
+    }
+}
+
+void FrameMetrics::openCsv(const char *path) {
+    if (path == nullptr) {
+        return;
+    }
+
+    csv = fopen(path, "w");
+    if (csv == nullptr) {
+        throw std::runtime_error("Failed to open the metrics CSV file!");
+    }
+    fprintf(csv, "time_s,phase,count,p50_us,p99_us,p99.9_us,max_us\n");
+    printf("[Info] | Frame metrics : CSV every %.1f s to %s\n", METRICS_REPORT_INTERVAL, path);
+}
+
+uint64_t FrameMetrics::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char *FrameMetrics::phaseName(MetricsPhase phase) {
+    switch (phase) {
+    case PHASE_POLL: return "poll";
+    case PHASE_SIM_UNIFORMS: return "sim uniforms";
+    case PHASE_SIM_RECORD: return "sim record";
+    case PHASE_SIM_SUBMIT: return "sim submit";
+    case PHASE_WAIT: return "wait";
+    case PHASE_ACQUIRE: return "acquire";
+    case PHASE_RECORD: return "record";
+    case PHASE_SUBMIT: return "submit";
+    case PHASE_PRESENT: return "present";
+    case PHASE_FRAME: return "frame";
+    default: return "unknown";
+    }
+}
+
+bool FrameMetrics::report() {
+    uint64_t start = now();
+    double window = (start - lastReport) * 1e-9;
+    if (window < METRICS_REPORT_INTERVAL) {
+        return false;
+    }
+
+    std::vector<uint64_t> counts;
+    uint64_t samples = 0;
+    uint64_t frames = 0;
+    uint64_t frameTime = 0;
+    char line[64];
+    snprintf(line, sizeof(line), "%-12s %6s %6s %6s", "CPU MS", "P50", "P99", "P99.9");
+    lines.assign(1, line);
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        // samples of this window only
+        histograms[phase].snapshot(counts);
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        size_t last = 0;
+        for (size_t i = 0; i < HDR_BUCKET_COUNT; i++) {
+            uint64_t current = counts[i];
+            counts[i] -= reportedCounts[phase][i];
+            reportedCounts[phase][i] = current;
+            count += counts[i];
+            sum += counts[i] * HdrHistogram::bucketValue(i);
+            if (counts[i] > 0) {
+                last = i;
+            }
+        }
+        samples += count;
+        if (phase == PHASE_FRAME) {
+            frames = count;
+            frameTime = sum;
+        }
+
+        double p50 = histogramPercentile(counts, 0.50) * 1e-3;
+        double p99 = histogramPercentile(counts, 0.99) * 1e-3;
+        double p999 = histogramPercentile(counts, 0.999) * 1e-3;
+        double max = count > 0 ? HdrHistogram::bucketValue(last) * 1e-3 : 0.0;
+        if (csv != nullptr) {
+            fprintf(csv, "%.3f,%s,%llu,%.2f,%.2f,%.2f,%.2f\n", (start - startTime) * 1e-9, phaseName(static_cast<MetricsPhase>(phase)),
+                    (unsigned long long)count, p50, p99, p999, max);
+        }
+
+        std::string name = phaseName(static_cast<MetricsPhase>(phase));
+        std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+        snprintf(line, sizeof(line), "%-12s %6.3f %6.3f %6.3f", name.c_str(), p50 * 1e-3, p99 * 1e-3, p999 * 1e-3);
+        lines.push_back(line);
+    }
+
+    double overhead = frameTime > 0 ? (samples * sampleCost + reportCost) / frameTime * 100.0 : 0.0;
+    snprintf(line, sizeof(line), "FPS %.0f  OVERHEAD %.3f%%", frames / window, overhead);
+    lines.push_back(line);
+    if (csv != nullptr) {
+        fflush(csv);
+    }
+
+    lastReport = start;
+    reportCost = now() - start;
+    return true;
+}
+
+uint16_t overlayGlyph(char c) {
+    static const uint16_t digits[10] = {
+        0b111'101'101'101'111, 0b010'110'010'010'111, 0b111'001'111'100'111, 0b111'001'111'001'111,
+        0b101'101'111'001'001, 0b111'100'111'001'111, 0b111'100'111'101'111, 0b111'001'001'001'001,
+        0b111'101'111'101'111, 0b111'101'111'001'111,
+    };
+    static const uint16_t letters[26] = {
+        0b010'101'111'101'101, 0b110'101'110'101'110, 0b011'100'100'100'011, 0b110'101'101'101'110, // A B C D
+        0b111'100'110'100'111, 0b111'100'110'100'100, 0b011'100'101'101'011, 0b101'101'111'101'101, // E F G H
+        0b111'010'010'010'111, 0b001'001'001'101'010, 0b101'101'110'101'101, 0b100'100'100'100'111, // I J K L
+        0b101'111'111'101'101, 0b110'101'101'101'101, 0b010'101'101'101'010, 0b110'101'110'100'100, // M N O P
+        0b010'101'101'110'011, 0b110'101'110'101'101, 0b011'100'010'001'110, 0b111'010'010'010'010, // Q R S T
+        0b101'101'101'101'111, 0b101'101'101'101'010, 0b101'101'111'111'101, 0b101'101'010'101'101, // U V W X
+        0b101'101'010'010'010, 0b111'001'010'100'111,                                               // Y Z
+    };
+
+    if (c >= '0' && c <= '9') {
+        return digits[c - '0'];
+    } else if (c >= 'A' && c <= 'Z') {
+        return letters[c - 'A'];
+    } else if (c >= 'a' && c <= 'z') {
+        return letters[c - 'a'];
+    }
+
+    switch (c) {
+    case '.': return 0b000'000'000'000'010;
+    case ':': return 0b000'010'000'010'000;
+    case '%': return 0b101'001'010'100'101;
+    case '-': return 0b000'000'111'000'000;
+    case '/': return 0b001'001'010'100'100;
+    default: return 0;
+    }
+}
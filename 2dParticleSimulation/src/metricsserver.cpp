@@ -0,0 +1,219 @@
+#include "2dParticleSimulation/include/metricsserver.h"
+
+#include <stdio.h>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef MSG_NOSIGNAL
+#define METRICS_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define METRICS_SEND_FLAGS 0
+#endif
+
+MetricsServer::MetricsServer(const FrameMetrics &metrics, const RendererStats &stats, const MemoryTracker &memory, const char *socketPath, uint16_t port)
+    : metrics(metrics), stats(stats), memory(memory) {
+    if (socketPath != nullptr) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (strlen(socketPath) >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Metrics socket path is too long!");
+        }
+        strcpy(address.sun_path, socketPath);
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) {
+            throw std::runtime_error("Failed to create the metrics socket!");
+        }
+        unlink(socketPath); // left behind by a previous run
+        if (bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+            close(listenFd);
+            throw std::runtime_error("Failed to bind the metrics socket!");
+        }
+        this->socketPath = socketPath;
+    } else {
+        // loopback only, nothing is exposed to the network
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd < 0) {
+            throw std::runtime_error("Failed to create the metrics socket!");
+        }
+        int reuse = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+            close(listenFd);
+            throw std::runtime_error("Failed to bind the metrics port!");
+        }
+    }
+
+    if (listen(listenFd, 4) != 0) {
+        close(listenFd);
+        throw std::runtime_error("Failed to listen on the metrics socket!");
+    }
+
+    if (socketPath != nullptr) {
+        printf("[Info] | Metrics : http over unix socket %s\n", socketPath);
+    } else {
+        printf("[Info] | Metrics : http://127.0.0.1:%u/metrics\n", port);
+    }
+    server = std::thread(&MetricsServer::run, this);
+}
+
+MetricsServer::~MetricsServer() {
+    stopping = true;
+    server.join();
+    close(listenFd);
+    if (!socketPath.empty()) {
+        unlink(socketPath.c_str());
+    }
+}
+
+void MetricsServer::run() {
+    while (!stopping) {
+        pollfd listener{listenFd, POLLIN, 0};
+        if (poll(&listener, 1, METRICS_POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+
+        int client = accept(listenFd, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+        serve(client);
+        close(client);
+    }
+}
+
+// Any request gets the metrics, only the end of the headers is waited for. A stalled client costs at most
+// METRICS_REQUEST_TIMEOUT_S of this thread
+void MetricsServer::serve(int client) {
+    timeval timeout{METRICS_REQUEST_TIMEOUT_S, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+    int noSigpipe = 1;
+    setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSigpipe, sizeof(noSigpipe));
+#endif
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            return;
+        }
+        request.append(buffer, received);
+    }
+
+    std::string body = render();
+    std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t written = send(client, response.data() + sent, response.size() - sent, METRICS_SEND_FLAGS);
+        if (written <= 0) {
+            return;
+        }
+        sent += written;
+    }
+}
+
+std::string MetricsServer::render() const {
+    std::string out;
+    char line[256];
+    auto metric = [&](const char *name, const char *type, const char *help) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+        out += line;
+    };
+    auto value = [&](const char *name, const char *labels, double v) {
+        snprintf(line, sizeof(line), "%s%s %.9g\n", name, labels, v);
+        out += line;
+    };
+    // counters and byte counts are printed exactly, a double would round them above 2^53 and %g above 1e9
+    auto integer = [&](const char *name, const char *labels, uint64_t v) {
+        snprintf(line, sizeof(line), "%s%s %llu\n", name, labels, static_cast<unsigned long long>(v));
+        out += line;
+    };
+    const std::memory_order relaxed = std::memory_order_relaxed;
+
+    metric("particle_frames_total", "counter", "Frames submitted.");
+    integer("particle_frames_total", "", stats.frames.load(relaxed));
+    metric("particle_simulation_steps_total", "counter", "Simulation steps integrated.");
+    integer("particle_simulation_steps_total", "", stats.simulationSteps.load(relaxed));
+    metric("particle_upload_bytes_total", "counter", "Bytes written by the host for the GPU.");
+    integer("particle_upload_bytes_total", "", stats.uploadBytes.load(relaxed));
+    metric("particle_count", "gauge", "Live particles of the last retired frame.");
+    integer("particle_count", "", stats.particleCount.load(relaxed));
+
+    metric("particle_gpu_pass_seconds", "gauge", "GPU time of the last timed frame per submission.");
+    value("particle_gpu_pass_seconds", "{pass=\"compute\"}", stats.gpuComputeNs.load(relaxed) * 1e-9);
+    value("particle_gpu_pass_seconds", "{pass=\"graphics\"}", stats.gpuGraphicsNs.load(relaxed) * 1e-9);
+    value("particle_gpu_pass_seconds", "{pass=\"span\"}", stats.gpuSpanNs.load(relaxed) * 1e-9);
+    metric("particle_physics_step_seconds", "gauge", "GPU compute time per simulation step, last timed frame.");
+    value("particle_physics_step_seconds", "", stats.physicsStepNs.load(relaxed) * 1e-9);
+
+    // per heap. budget / usage : VK_EXT_memory_budget when available, refreshed by the render loop once per second
+    const char *heapMetrics[][2] = {{"particle_device_heap_size_bytes", "Size of each device memory heap."},
+                                    {"particle_device_heap_budget_bytes", "Memory budget of each heap."},
+                                    {"particle_device_heap_usage_bytes", "Memory in use on each heap."}};
+    for (int m = 0; m < 3; m++) {
+        metric(heapMetrics[m][0], "gauge", heapMetrics[m][1]);
+        for (uint32_t heap = 0; heap < memory.heapCount(); heap++) {
+            snprintf(line, sizeof(line), "{heap=\"%u\"}", heap);
+            std::string labels = line;
+            uint64_t bytes = m == 0 ? memory.heapSize(heap) : m == 1 ? memory.budget(heap) : memory.usage(heap);
+            integer(heapMetrics[m][0], labels.c_str(), bytes);
+        }
+    }
+    metric("particle_device_memory_allocated_bytes", "gauge", "Device memory allocated by the renderer per heap and purpose.");
+    for (uint32_t heap = 0; heap < memory.heapCount(); heap++) {
+        for (int purpose = 0; purpose < MEMORY_PURPOSE_COUNT; purpose++) {
+            snprintf(line, sizeof(line), "{heap=\"%u\",purpose=\"%s\"}", heap, MemoryTracker::purposeName(static_cast<MemoryPurpose>(purpose)));
+            std::string labels = line;
+            integer("particle_device_memory_allocated_bytes", labels.c_str(), memory.allocated(heap, static_cast<MemoryPurpose>(purpose)));
+        }
+    }
+
+    // whole run. frame : frame time, wait : the frame pacing wait
+    metric("particle_cpu_phase_seconds", "summary", "CPU time per frame phase since start.");
+    std::vector<uint64_t> counts;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        metrics.histogram(static_cast<MetricsPhase>(phase)).snapshot(counts);
+        std::string name = FrameMetrics::phaseName(static_cast<MetricsPhase>(phase));
+        for (char &c : name) {
+            c = c == ' ' ? '_' : c;
+        }
+
+        for (double quantile : {0.5, 0.99, 0.999}) {
+            snprintf(line, sizeof(line), "{phase=\"%s\",quantile=\"%g\"}", name.c_str(), quantile);
+            std::string labels = line;
+            value("particle_cpu_phase_seconds", labels.c_str(), histogramPercentile(counts, quantile) * 1e-9);
+        }
+
+        uint64_t count = 0;
+        double sum = 0.0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            count += counts[i];
+            sum += counts[i] * static_cast<double>(HdrHistogram::bucketValue(i));
+        }
+        snprintf(line, sizeof(line), "{phase=\"%s\"}", name.c_str());
+        std::string labels = line;
+        value("particle_cpu_phase_seconds_sum", labels.c_str(), sum * 1e-9);
+        integer("particle_cpu_phase_seconds_count", labels.c_str(), count);
+    }
+
+    return out;
+}
@@ -10,17 +10,44 @@
 #include <limits>
 #include <algorithm>
 #include <set>
-#include <random>
 #include <cstring>
 #include "2dParticleSimulation/include/renderer.h"
 #include "2dParticleSimulation/include/utils.h"
+#include "2dParticleSimulation/include/snapshot.h"
+#include "2dParticleSimulation/include/framegraph.h"
 
 #define DEFAULT_WIDTH 800
 #define DEFAULT_HEIGHT 600
 #define WINDOW_TITLE "2D particle simulation"
 
 #define MAX_FRAME_IN_FLIGHT 2
+// one more particle buffer than frames in flight so compute(k) never writes the slot graphics(k) draws
+#define PARTICLE_BUFFER_COUNT (MAX_FRAME_IN_FLIGHT + 1)
 #define PARTICLE_COUNT 1024
+#define MAX_PARTICLE_COUNT 8192
+// memory admission : lowest capacity tried, part of the available budget the particle state may take
+#define MIN_PARTICLE_CAPACITY 256
+#define MEMORY_ADMISSION_FRACTION 0.9
+
+static void framebufferSizeCallback(GLFWwindow* window, int width, int height);
+
+// fixed timestep mode. dt is in the same unit as ubo.dt (lastFrameTime * 2)
+#define FIXED_DT 8.0f
+#define MAX_SUBSTEPS 8
+
+// snapshot readback buffer : ParticleCounter at 0, particles from here
+#define SNAPSHOT_PARTICLE_OFFSET 256
+
+// graphics command buffers per (frame in flight, swapchain image) : one per particle buffer drawn, one drawing nothing
+#define GRAPHICS_DRAW_VARIANTS (PARTICLE_BUFFER_COUNT + 1)
+// compute command buffers per (frame in flight, particle slot) : one per substep count
+#define COMPUTE_SUBSTEP_VARIANTS MAX_SUBSTEPS
+
+// metrics overlay : VkDrawIndirectCommand at 0, points from OVERLAY_VERTEX_OFFSET. one glyph pixel per point
+#define OVERLAY_MAX_POINTS 8192
+#define OVERLAY_VERTEX_OFFSET 256
+#define OVERLAY_PIXEL_SIZE 2.0f
+#define OVERLAY_MARGIN 8.0f
 
 int currentFrame = 0;
 float lastFrameTime = 0.0f;
@@ -36,13 +63,14 @@ std::vector<const char*> validationLayers = {"VK_LAYER_KHRONOS_validation"};
 
 std::vector<const char*> deviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+    VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME, // frame graph barriers
 
     #ifdef __APPLE__
     "VK_KHR_portability_subset"
     #endif
 };
 
-Renderer::Renderer() {
+Renderer::Renderer(const RendererSettings &settings) : settings(settings) {
     initWindow();
     createInstance();
     setupDebugMessenger();
@@ -51,36 +79,116 @@ Renderer::Renderer() {
     createLogicalDevice();
     createSwapchain();
     createImageViews();
+    admitParticleMemory();
     createRenderpass();
     createDescriptorSetLayout();
     createGraphicsPipeline();
     createComputePipeline();
     createFramebuffers();
     createCommandPool();
+    createTimestampQueryPool();
     createCommandBuffers();
     createComputeCommandBuffers();
     createSyncObjects();
     createUniformBuffers();
+    createOverlayBuffers();
     createShaderStorageBuffers();
+    createParticleCounterBuffers();
+    createSubstepBuffers();
+    reportParticleMemory();
+    createEmitters();
     createDescriptorPool();
     createDescriptorSets();
+    if (settings.restorePath != nullptr) {
+        restoreParticles();
+    } else {
+        seedParticles();
+    }
+    metrics.openCsv(settings.metricsCsvPath);
+
+    memoryTracker.refreshBudget();
+    memoryTracker.report();
+
+    if (settings.metricsSocketPath != nullptr || settings.metricsPort != 0) {
+        metricsServer = std::make_unique<MetricsServer>(metrics, stats, memoryTracker, settings.metricsSocketPath, settings.metricsPort);
+    }
 }
 
 Renderer::~Renderer() {
 
     vkDeviceWaitIdle(device);
 
+    for (DeferredDeletion &deletion : deletionQueue) {
+        deletion.destroy();
+    }
+    deletionQueue.clear();
+
+    // an idle device does not mean the present engine is done with the render finished semaphores
+    if (presentFencesEnabled) {
+        std::vector<VkFence> pending = presentFences;
+        for (RetiredSwapchain &retired : retiredSwapchains) {
+            pending.insert(pending.end(), retired.presentFences.begin(), retired.presentFences.end());
+        }
+        if (!pending.empty()) {
+            vkWaitForFences(device, pending.size(), pending.data(), VK_TRUE, UINT64_MAX);
+        }
+    }
+    for (RetiredSwapchain &retired : retiredSwapchains) {
+        destroyRetiredSwapchain(retired);
+    }
+    retiredSwapchains.clear();
+    for (VkFence fence : presentFences) {
+        vkDestroyFence(device, fence, nullptr);
+    }
+    for (VkFence fence : freePresentFences) {
+        vkDestroyFence(device, fence, nullptr);
+    }
+
+    if (statsReadbackBuffer != VK_NULL_HANDLE) {
+        memoryTracker.free(statsReadbackBufferMemory);
+        vkDestroyBuffer(device, statsReadbackBuffer, nullptr);
+    }
+
+    // a snapshot still being written keeps the readback buffer mapped
+    if (snapshotWriter.joinable()) {
+        snapshotWriter.join();
+    }
+    if (snapshotReadbackBuffer != VK_NULL_HANDLE) {
+        memoryTracker.free(snapshotReadbackBufferMemory);
+        vkDestroyBuffer(device, snapshotReadbackBuffer, nullptr);
+    }
+
+    // destroy particle counter buffer
+    for (VkDeviceMemory &counterMem : particleCounterBuffersMemory) {
+        memoryTracker.free(counterMem);
+    }
+    for (VkBuffer &counter : particleCounterBuffers) {
+        vkDestroyBuffer(device, counter, nullptr);
+    }
+
+    // destroy substep scratch buffer
+    if (substepParticleBuffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device, substepParticleBuffer, nullptr);
+        vkDestroyBuffer(device, substepCounterBuffer, nullptr);
+        memoryTracker.free(transientMemory);
+    }
+
     // destroy shader storage buffer
     for (VkDeviceMemory &ssbMem : shaderStorageBuffersMemory) {
-        vkFreeMemory(device, ssbMem, nullptr);
+        memoryTracker.free(ssbMem);
     }
     for (VkBuffer &ssb : shaderStorageBuffers) {
         vkDestroyBuffer(device, ssb, nullptr);
     }
 
+    for (size_t i = 0; i < overlayBuffers.size(); i++) {
+        memoryTracker.free(overlayBuffersMemory[i]);
+        vkDestroyBuffer(device, overlayBuffers[i], nullptr);
+    }
+
     // destory uniform buffer
     for (VkDeviceMemory &ubMem : uniformBuffersMemory) {
-        vkFreeMemory(device, ubMem, nullptr);
+        memoryTracker.free(ubMem);
     }
     for (VkBuffer &ub : uniformBuffers) {
         vkDestroyBuffer(device, ub, nullptr);
@@ -88,18 +196,24 @@ Renderer::~Renderer() {
 
     for (int i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
         vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-        vkDestroyFence(device, inFlightFences[i], nullptr);
-        vkDestroySemaphore(device, computeFinishedSemaphores[i], nullptr);
-        vkDestroyFence(device, computeInFlightFences[i], nullptr);
     }
-    for (int i = 0; i < swapchainImages.size(); i++) {
+    vkDestroySemaphore(device, computeTimeline, nullptr);
+    vkDestroySemaphore(device, graphicsTimeline, nullptr);
+    for (size_t i = 0; i < swapchainImages.size(); i++) {
         vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
     }
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+    }
+    vkDestroyCommandPool(device, computeCommandPool, nullptr);
     vkDestroyCommandPool(device, commandPool, nullptr);
     for (VkFramebuffer &framebuffer : framebuffers) {
         vkDestroyFramebuffer(device, framebuffer, nullptr);
     }
     vkDestroyPipeline(device, computePipeline, nullptr);
+    vkDestroyPipeline(device, emitPipeline, nullptr);
+    vkDestroyPipeline(device, indirectArgsPipeline, nullptr);
+    vkDestroyPipeline(device, seedPipeline, nullptr);
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(device, computePipelineLayout, nullptr);
     vkDestroyPipelineLayout(device, graphicsPipelineLayout, nullptr);
@@ -122,8 +236,30 @@ Renderer::~Renderer() {
 
  void Renderer::run() {
     while (!glfwWindowShouldClose(window)) {
+        uint64_t frameStart = FrameMetrics::now();
         glfwPollEvents();
+
+        bool snapshotKey = glfwGetKey(window, GLFW_KEY_F5) == GLFW_PRESS;
+        if (snapshotKey && !snapshotKeyDown) {
+            requestSnapshot();
+        }
+        snapshotKeyDown = snapshotKey;
+
+        bool overlayKey = glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS;
+        if (overlayKey && !overlayKeyDown) {
+            overlayEnabled = !overlayEnabled;
+            buildOverlay();
+        }
+        overlayKeyDown = overlayKey;
+        phaseStart = metrics.record(PHASE_POLL, frameStart);
+
         drawFrame();
+        metrics.record(PHASE_FRAME, frameStart);
+        if (metrics.report()) {
+            buildOverlay();
+            memoryTracker.refreshBudget();
+        }
+
         // We want to animate the particle system using the last frames time to get smooth, frame-rate independent animation
         double currentTime = glfwGetTime();
         lastFrameTime = (currentTime - lastTime) * 1000.0;
@@ -137,60 +273,159 @@ void Renderer::drawFrame() {
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    // compute submission
-    vkWaitForFences(device, 1, &computeInFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-
-    updateUniformBuffer(currentFrame);
-
-    vkResetFences(device, 1, &computeInFlightFences[currentFrame]);
-    vkResetCommandBuffer(computeCommandBuffers[currentFrame], 0);
-
-    recordComputeCommandbuffer(computeCommandBuffers[currentFrame]);
-
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &computeCommandBuffers[currentFrame];
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &computeFinishedSemaphores[currentFrame];
-    vkQueueSubmit(computeQueue, 1, &submitInfo, computeInFlightFences[currentFrame]);
-
-    // graphics submission
-    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    // frame k signals k + 1 on both timelines. The CPU only blocks when it is MAX_FRAME_IN_FLIGHT frames ahead,
+    // frame k - MAX_FRAME_IN_FLIGHT still holding this slot's command buffers, uniform buffer and queries
+    if (frameNumber >= MAX_FRAME_IN_FLIGHT) {
+        uint64_t slotFree = frameNumber - MAX_FRAME_IN_FLIGHT + 1;
+        uint64_t computeDone, graphicsDone;
+        vkGetSemaphoreCounterValue(device, computeTimeline, &computeDone);
+        vkGetSemaphoreCounterValue(device, graphicsTimeline, &graphicsDone);
+        if (computeDone < slotFree || graphicsDone < slotFree) {
+            VkSemaphore timelines[] = {computeTimeline, graphicsTimeline};
+            uint64_t values[] = {slotFree, slotFree};
+
+            VkSemaphoreWaitInfo waitInfo{};
+            waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+            waitInfo.semaphoreCount = 2;
+            waitInfo.pSemaphores = timelines;
+            waitInfo.pValues = values;
+            chk(vkWaitSemaphores(device, &waitInfo, UINT64_MAX), "vkWaitSemaphores");
+        }
+    }
+    collectDeletions();
+
+    // both submissions of this slot are done -> timestamps / snapshot readback are available without stalling
+    collectTimestamps(currentFrame);
+    collectSnapshot(currentFrame);
+    uploadOverlay(currentFrame);
+    if (frameNumber >= MAX_FRAME_IN_FLIGHT) {
+        stats.particleCount.store(statsReadbackMapped[currentFrame], std::memory_order_relaxed);
+    }
+    phaseStart = metrics.record(PHASE_WAIT, phaseStart);
 
+    // acquire before any submission : when the swapchain is out of date nothing is submitted and the particle ring stays put
     uint32_t imageIndex;
     VkResult res = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+    phaseStart = metrics.record(PHASE_ACQUIRE, phaseStart);
     if (res == VK_ERROR_OUT_OF_DATE_KHR) {
-        recreateSwapchain(-1);
+        recreateSwapchain();
         return;
     } else if (res != VK_SUBOPTIMAL_KHR && res != VK_SUCCESS) {
         throw std::runtime_error("Failed to acquired swapchain image!");
     }
+    acquireCount++;
 
-    vkResetFences(device, 1, &inFlightFences[currentFrame]);
+    // compute submission
+    updateUniformBuffer(particleSlot);
+    phaseStart = metrics.record(PHASE_SIM_UNIFORMS, phaseStart);
+
+    // recorded once per (frame in flight, particle slot, substep count). dt and the spawn counts are read from the
+    // uniform buffer, only a change of what the recording depends on records it again. a fixed step frame picks the
+    // recording of its substep count, alternating counts record nothing once each was seen
+    uint32_t slotBuffer = particleBufferIndex(particleSlot);
+    bool snapshot = snapshotState == SNAPSHOT_REQUESTED;
+    bool acquire = particleSlotOnGraphics[slotBuffer];
+    uint32_t substeps = std::max<uint32_t>(1, simulationSubsteps);
+    uint32_t computeIndex = (currentFrame * PARTICLE_BUFFER_COUNT + particleSlot) * COMPUTE_SUBSTEP_VARIANTS + substeps - 1;
+    uint32_t computeKey = computeRecordKey(snapshot, acquire);
+    if (computeRecordKeys[computeIndex] != computeKey) {
+        vkResetCommandBuffer(computeCommandBuffers[computeIndex], 0);
+        recordComputeCommandbuffer(computeCommandBuffers[computeIndex], snapshot, acquire);
+        computeRecordKeys[computeIndex] = computeKey;
+        commandBufferRecords++;
+    }
+    phaseStart = metrics.record(PHASE_SIM_RECORD, phaseStart);
+
+    // the slot written this step is back on compute, the one it read goes to graphics (in place : the one just written)
+    particleSlotOnGraphics[slotBuffer] = false;
+    uint32_t releaseSlot = settings.inPlaceUpdate ? slotBuffer : (particleSlot + PARTICLE_BUFFER_COUNT - 1) % PARTICLE_BUFFER_COUNT;
+    particleSlotReadyToDraw[releaseSlot] = true;
+    if (snapshot) {
+        snapshotFrame = currentFrame;
+        snapshotStep = simulationStepCount;
+        snapshotDt = simulationDt;
+        snapshotState = SNAPSHOT_COPYING;
+    }
 
-    vkResetCommandBuffer(commandBuffers[currentFrame], 0);
-    recordCommandbuffer(commandBuffers[currentFrame], imageIndex);
+    // compute(k) only waits for graphics(k-1), which hands back the slot compute(k) overwrites. value 0 : frame 0 waits for nothing
+    VkPipelineStageFlags computeWaitStage = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    uint64_t computeWaitValue = frameNumber;
+    uint64_t computeSignalValue = frameNumber + 1;
 
-    // **각 세마포어는 같은 인덱스의 stage에서 대기함!!**
-    VkSemaphore waitSemaphores[] = {computeFinishedSemaphores[currentFrame], imageAvailableSemaphores[currentFrame]};
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &computeWaitValue;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &computeSignalValue;
 
+    submitInfo.pNext = &timelineInfo;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+    submitInfo.pCommandBuffers = &computeCommandBuffers[computeIndex];
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &graphicsTimeline;
+    submitInfo.pWaitDstStageMask = &computeWaitStage;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &computeTimeline;
+    chk(vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE), "Failed at vkQueueSubmit!");
+    phaseStart = metrics.record(PHASE_SIM_SUBMIT, phaseStart);
+
+    // graphics submission
+
+    // slot written two steps ago. nothing to draw until the ring is filled
+    uint32_t drawSlot = settings.inPlaceUpdate ? slotBuffer : (particleSlot + PARTICLE_BUFFER_COUNT - 2) % PARTICLE_BUFFER_COUNT;
+    bool drawParticles = particleSlotReadyToDraw[drawSlot];
+    uint32_t graphicsIndex = (currentFrame * swapchainImages.size() + imageIndex) * GRAPHICS_DRAW_VARIANTS +
+                             (drawParticles ? drawSlot : GRAPHICS_DRAW_VARIANTS - 1);
+    if (!commandBufferRecorded[graphicsIndex]) {
+        vkResetCommandBuffer(commandBuffers[graphicsIndex], 0);
+        recordCommandbuffer(commandBuffers[graphicsIndex], imageIndex, drawSlot, drawParticles);
+        commandBufferRecorded[graphicsIndex] = true;
+        commandBufferRecords++;
+    }
+    if (drawParticles) {
+        particleSlotReadyToDraw[drawSlot] = false;
+        particleSlotOnGraphics[drawSlot] = true;
+    }
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        timestampsWritten[currentFrame] = true;
+        timedSubsteps[currentFrame] = settings.fixedTimestep ? simulationSubsteps : 1;
+    }
+    reportCommandBufferRecords();
+    phaseStart = metrics.record(PHASE_RECORD, phaseStart);
+
+    // graphics(k) draws what compute(k-1) produced, so it does not wait for compute(k) submitted above
+    // in place : there is only one buffer, graphics(k) has to wait for compute(k) and draws its result
+    // **각 세마포어는 같은 인덱스의 stage에서 대기함!!** (binary semaphore values are ignored)
+    VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame], computeTimeline};
+    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT};
+    uint64_t waitValues[] = {0, settings.inPlaceUpdate ? frameNumber + 1 : frameNumber};
+    VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[imageIndex], graphicsTimeline};
+    uint64_t signalValues[] = {0, frameNumber + 1};
+
+    timelineInfo.waitSemaphoreValueCount = 2;
+    timelineInfo.pWaitSemaphoreValues = waitValues;
+    timelineInfo.signalSemaphoreValueCount = 2;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
+
+    submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffers[graphicsIndex];
     submitInfo.waitSemaphoreCount = 2;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &renderFinishedSemaphores[imageIndex];
+    submitInfo.signalSemaphoreCount = 2;
+    submitInfo.pSignalSemaphores = signalSemaphores;
 
-    res = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]);
-    if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR || framebufferResized) {
-        framebufferResized = false;
+    chk(vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE), "Failed at vkQueueSubmit!");
+    phaseStart = metrics.record(PHASE_SUBMIT, phaseStart);
 
-        recreateSwapchain(imageIndex);
-        return;
-    } else if (res != VK_SUCCESS) {
-        throw std::runtime_error("Failed at vkQueueSubmit!");
-    }
+    frameNumber++;
+    stats.frames.store(frameNumber, std::memory_order_relaxed);
+    particleSlot = (particleSlot + 1) % PARTICLE_BUFFER_COUNT;
 
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -199,9 +434,32 @@ void Renderer::drawFrame() {
     presentInfo.pSwapchains = &swapchain;
     presentInfo.waitSemaphoreCount = 1;
     presentInfo.pWaitSemaphores = &renderFinishedSemaphores[imageIndex];
-    vkQueuePresentKHR(presentQueue, &presentInfo);
+
+    // signalled once the present engine is done with the render finished semaphore
+    VkFence presentFence = VK_NULL_HANDLE;
+    VkSwapchainPresentFenceInfoEXT presentFenceInfo{};
+    if (presentFencesEnabled) {
+        presentFence = takePresentFence();
+        presentFenceInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT;
+        presentFenceInfo.swapchainCount = 1;
+        presentFenceInfo.pFences = &presentFence;
+        presentInfo.pNext = &presentFenceInfo;
+    }
+    res = vkQueuePresentKHR(presentQueue, &presentInfo);
+    if (presentFence != VK_NULL_HANDLE) {
+        presentFences.push_back(presentFence); // out of date presents still signal it
+    }
+    phaseStart = metrics.record(PHASE_PRESENT, phaseStart);
 
     currentFrame = (currentFrame + 1) % MAX_FRAME_IN_FLIGHT;
+
+    // presented first : the render finished semaphore is always waited on, the swapchain is only retired
+    if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR || framebufferResized) {
+        framebufferResized = false;
+        recreateSwapchain();
+    } else if (res != VK_SUCCESS) {
+        throw std::runtime_error("Failed to present swapchain image!");
+    }
 }
 
 void Renderer::initWindow() {
@@ -240,6 +498,22 @@ void Renderer::createInstance() {
         instanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     }
 
+    // optional : required by VK_EXT_swapchain_maintenance1 (present fences)
+    uint32_t availableCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(availableCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, availableExtensions.data());
+    auto hasExtension = [&](const char *name) {
+        return std::any_of(availableExtensions.begin(), availableExtensions.end(), [&](const VkExtensionProperties &extension) {
+            return strcmp(extension.extensionName, name) == 0;
+        });
+    };
+    surfaceMaintenance = hasExtension(VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME) && hasExtension(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME);
+    if (surfaceMaintenance) {
+        instanceExtensions.push_back(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME);
+        instanceExtensions.push_back(VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME);
+    }
+
     VkDebugUtilsMessengerCreateInfoEXT messengerCI{};
     populateDebugMessenger(messengerCI);
 
@@ -287,63 +561,158 @@ void Renderer::selectPhysicalDevice() {
     for (const VkPhysicalDevice &device : devices) {
         VkPhysicalDeviceProperties devProps{};
         vkGetPhysicalDeviceProperties(device, &devProps);
+        if (!deviceSupportsRequirements(device, devProps)) {
+            continue;
+        }
 
         uint32_t qPropsCnt;
         vkGetPhysicalDeviceQueueFamilyProperties(device, &qPropsCnt, nullptr);
         std::vector<VkQueueFamilyProperties> qFamilyProps(qPropsCnt);
         vkGetPhysicalDeviceQueueFamilyProperties(device, &qPropsCnt, qFamilyProps.data());
 
-        graphicsAndComputeFamilyIndex = -1;
-        presentFamilyIndex = -1;
-        int i = 0;
-        for (const VkQueueFamilyProperties &props : qFamilyProps) {
-            if (qFamilyProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT && qFamilyProps[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+        graphicsAndComputeFamilyIndex = UINT32_MAX;
+        computeFamilyIndex = UINT32_MAX;
+        presentFamilyIndex = UINT32_MAX;
+        for (uint32_t i = 0; i < qPropsCnt; i++) {
+            VkQueueFlags flags = qFamilyProps[i].queueFlags;
+            if (flags & VK_QUEUE_GRAPHICS_BIT && flags & VK_QUEUE_COMPUTE_BIT && graphicsAndComputeFamilyIndex == UINT32_MAX) {
                 graphicsAndComputeFamilyIndex = i;
             }
 
+            // compute only family -> its queue runs next to the graphics queue instead of being serialized with it
+            if (settings.asyncCompute && flags & VK_QUEUE_COMPUTE_BIT && !(flags & VK_QUEUE_GRAPHICS_BIT) && computeFamilyIndex == UINT32_MAX) {
+                computeFamilyIndex = i;
+            }
+
             VkBool32 presentSupport = VK_FALSE;
             vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-            if (presentSupport) {
+            if (presentSupport && (presentFamilyIndex == UINT32_MAX || i == graphicsAndComputeFamilyIndex)) {
                 presentFamilyIndex = i;
             }
+        }
 
-            if (graphicsAndComputeFamilyIndex != -1 && presentFamilyIndex != -1) {
-                physDev = device;
-                printf("\n[Info] | Device selected : %s\n", devProps.deviceName);
-                printf("[Info] | Graphics Family : %d, Present Family : %d\n", graphicsAndComputeFamilyIndex, presentFamilyIndex);
-                return;
+        if (graphicsAndComputeFamilyIndex != UINT32_MAX && presentFamilyIndex != UINT32_MAX) {
+            if (computeFamilyIndex == UINT32_MAX) {
+                computeFamilyIndex = graphicsAndComputeFamilyIndex;
             }
 
-            ++i;
+            physDev = device;
+            printf("\n[Info] | Device selected : %s\n", devProps.deviceName);
+            printf("[Info] | Graphics Family : %d, Compute Family : %d, Present Family : %d\n", graphicsAndComputeFamilyIndex, computeFamilyIndex, presentFamilyIndex);
+            printf("[Info] | Async compute : %s\n", computeFamilyIndex != graphicsAndComputeFamilyIndex ? "on" : "off");
+            return;
         }
     }
     throw std::runtime_error("There is no available physical device supporting vulkan!");
 }
 
+// Everything createLogicalDevice enables unconditionally. A device missing one is skipped with the reason instead of
+// failing later in vkCreateDevice with VK_ERROR_EXTENSION_NOT_PRESENT / VK_ERROR_FEATURE_NOT_PRESENT
+bool Renderer::deviceSupportsRequirements(VkPhysicalDevice device, const VkPhysicalDeviceProperties &props) {
+    // the instance asks for 1.2 : timeline semaphores are core there, and vkGetPhysicalDeviceFeatures2 below is valid
+    if (props.apiVersion < VK_API_VERSION_1_2) {
+        printf("[Info] | Skipping %s : Vulkan %u.%u, 1.2 required\n", props.deviceName,
+               VK_API_VERSION_MAJOR(props.apiVersion), VK_API_VERSION_MINOR(props.apiVersion));
+        return false;
+    }
+
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    // frame graph barriers. older drivers (MoltenVK before 1.2) do not have it
+    bool sync2Extension = std::any_of(availableExtensions.begin(), availableExtensions.end(), [](const VkExtensionProperties &extension) {
+        return strcmp(extension.extensionName, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) == 0;
+    });
+    if (!sync2Extension) {
+        printf("[Info] | Skipping %s : %s not supported\n", props.deviceName, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+        return false;
+    }
+
+    // frame pacing, one timeline per queue
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeats{};
+    timelineFeats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+
+    VkPhysicalDeviceSynchronization2FeaturesKHR sync2Feats{};
+    sync2Feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+    sync2Feats.pNext = &timelineFeats;
+
+    VkPhysicalDeviceFeatures2 feats{};
+    feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    feats.pNext = &sync2Feats;
+    vkGetPhysicalDeviceFeatures2(device, &feats);
+
+    if (!sync2Feats.synchronization2) {
+        printf("[Info] | Skipping %s : synchronization2 not supported\n", props.deviceName);
+        return false;
+    }
+    if (!timelineFeats.timelineSemaphore) {
+        printf("[Info] | Skipping %s : timelineSemaphore not supported\n", props.deviceName);
+        return false;
+    }
+    return true;
+}
+
 void Renderer::createLogicalDevice() {
 
     std::vector<VkDeviceQueueCreateInfo> qCIs;
     float priorities = 1.0f;
 
-    VkDeviceQueueCreateInfo qInfo{};
-    qInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    qInfo.queueFamilyIndex = graphicsAndComputeFamilyIndex;
-    qInfo.queueCount = 1;
-    qInfo.pQueuePriorities = &priorities;
-    qCIs.push_back(qInfo);
-
-    if (graphicsAndComputeFamilyIndex != presentFamilyIndex) {
+    std::set<uint32_t> families = {graphicsAndComputeFamilyIndex, computeFamilyIndex, presentFamilyIndex};
+    for (uint32_t family : families) {
+        VkDeviceQueueCreateInfo qInfo{};
         qInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        qInfo.queueFamilyIndex = presentFamilyIndex;
+        qInfo.queueFamilyIndex = family;
         qInfo.queueCount = 1;
         qInfo.pQueuePriorities = &priorities;
         qCIs.push_back(qInfo);
     }
 
+    // optional : per heap budget and usage including other processes
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physDev, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physDev, nullptr, &extensionCount, availableExtensions.data());
+    bool memoryBudget = std::any_of(availableExtensions.begin(), availableExtensions.end(), [](const VkExtensionProperties &extension) {
+        return strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+    });
+    if (memoryBudget) {
+        deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+
+    // optional : present fences tell when a retired swapchain and its semaphores can go, see collectDeletions
+    VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT swapchainMaintenanceFeats{};
+    swapchainMaintenanceFeats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+    bool swapchainMaintenance = surfaceMaintenance && std::any_of(availableExtensions.begin(), availableExtensions.end(), [](const VkExtensionProperties &extension) {
+        return strcmp(extension.extensionName, VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME) == 0;
+    });
+    if (swapchainMaintenance) {
+        VkPhysicalDeviceFeatures2 supportedFeats{};
+        supportedFeats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeats.pNext = &swapchainMaintenanceFeats;
+        vkGetPhysicalDeviceFeatures2(physDev, &supportedFeats);
+        presentFencesEnabled = swapchainMaintenanceFeats.swapchainMaintenance1;
+    }
+    if (presentFencesEnabled) {
+        deviceExtensions.push_back(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME);
+    }
+
     VkPhysicalDeviceFeatures devFeats{};
 
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeats{};
+    timelineFeats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timelineFeats.timelineSemaphore = VK_TRUE;
+    timelineFeats.pNext = presentFencesEnabled ? &swapchainMaintenanceFeats : nullptr; // read back as VK_TRUE
+
+    VkPhysicalDeviceSynchronization2FeaturesKHR sync2Feats{};
+    sync2Feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+    sync2Feats.pNext = &timelineFeats;
+    sync2Feats.synchronization2 = VK_TRUE;
+
     VkDeviceCreateInfo info{};
     info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    info.pNext = &sync2Feats;
     info.queueCreateInfoCount = qCIs.size();
     info.pQueueCreateInfos = qCIs.data();
     info.enabledExtensionCount = deviceExtensions.size();
@@ -361,9 +730,17 @@ void Renderer::createLogicalDevice() {
    
     chk(vkCreateDevice(physDev, &info, nullptr, &device), "vkCreateDevice");
 
+    // Vulkan 1.2 : the extension entry point is not exported by the loader
+    cmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2KHR)vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR");
+    if (cmdPipelineBarrier2 == nullptr) {
+        throw std::runtime_error("vkCmdPipelineBarrier2KHR not available!");
+    }
+
     vkGetDeviceQueue(device, graphicsAndComputeFamilyIndex, 0, &graphicsQueue);
-    vkGetDeviceQueue(device, graphicsAndComputeFamilyIndex, 0, &computeQueue);
+    vkGetDeviceQueue(device, computeFamilyIndex, 0, &computeQueue);
     vkGetDeviceQueue(device, presentFamilyIndex, 0, &presentQueue);
+
+    memoryTracker.init(physDev, device, memoryBudget);
 }
 
 void Renderer::createSwapchain() {
@@ -454,7 +831,7 @@ void Renderer::createSwapchain() {
         .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
         .presentMode = presentMode,
         .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE
+        .oldSwapchain = swapchain // retired, frames in flight still present from it
     };
 
     chk(vkCreateSwapchainKHR(device, &swapInfo, nullptr, &swapchain), "vkCreateSwapchainKHR");
@@ -462,12 +839,16 @@ void Renderer::createSwapchain() {
     vkGetSwapchainImagesKHR(device, swapchain, &minImgs, nullptr);
     swapchainImages.resize(minImgs);
     vkGetSwapchainImagesKHR(device, swapchain, &minImgs, swapchainImages.data());
+
+    // allocated by the driver, 4 bytes per pixel assumed
+    memoryTracker.setEstimate(MEMORY_SWAPCHAIN, memoryTracker.deviceLocalHeap(),
+                              static_cast<VkDeviceSize>(imageExtent.width) * imageExtent.height * 4 * swapchainImages.size());
 }
 
 void Renderer::createImageViews() {
     swapchainImageViews.resize(swapchainImages.size());
 
-    for (int i = 0; i < swapchainImages.size(); i++) {
+    for (size_t i = 0; i < swapchainImages.size(); i++) {
         VkImageViewCreateInfo viewInfo{};
         viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
         viewInfo.image = swapchainImages[i];
@@ -706,7 +1087,30 @@ void Renderer::createGraphicsPipeline() {
 
 void Renderer::createComputePipeline() {
 
-    VkShaderModule computeShaderModule = createShader("2dParticleSimulation/shaders/spv/comp.spv");
+    // only the seeding pass uses the push constants
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(SeedPushConstants);
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &computeDescriptorSetLayout; // descriptor set layout here
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstantRange;
+    vkCreatePipelineLayout(device, &layoutInfo, nullptr, &computePipelineLayout);
+
+    // simulate + compact / spawn / write indirect arguments / initial seeding. all four share one layout
+    computePipeline = createComputeShaderPipeline("2dParticleSimulation/shaders/spv/comp.spv");
+    emitPipeline = createComputeShaderPipeline("2dParticleSimulation/shaders/spv/emit.spv");
+    indirectArgsPipeline = createComputeShaderPipeline("2dParticleSimulation/shaders/spv/indirect.spv");
+    seedPipeline = createComputeShaderPipeline("2dParticleSimulation/shaders/spv/seed.spv");
+}
+
+VkPipeline Renderer::createComputeShaderPipeline(const char* filename) {
+
+    VkShaderModule computeShaderModule = createShader(filename);
 
     VkPipelineShaderStageCreateInfo computeShaderCI{};
     computeShaderCI.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -714,25 +1118,43 @@ void Renderer::createComputePipeline() {
     computeShaderCI.module = computeShaderModule;
     computeShaderCI.pName = "main";
 
-    VkPipelineLayoutCreateInfo layoutInfo{};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    layoutInfo.setLayoutCount = 1;
-    layoutInfo.pSetLayouts = &computeDescriptorSetLayout; // descriptor set layout here
-    vkCreatePipelineLayout(device, &layoutInfo, nullptr, &computePipelineLayout);
+    // constant_id 0 : particle capacity of the SSBO, constant_id 1 : in place update
+    struct {
+        uint32_t maxParticleCount;
+        VkBool32 inPlace;
+    } specData = {particleCapacity, settings.inPlaceUpdate ? VK_TRUE : VK_FALSE};
+
+    std::array<VkSpecializationMapEntry, 2> specEntries{};
+    specEntries[0].constantID = 0;
+    specEntries[0].offset = offsetof(decltype(specData), maxParticleCount);
+    specEntries[0].size = sizeof(uint32_t);
+    specEntries[1].constantID = 1;
+    specEntries[1].offset = offsetof(decltype(specData), inPlace);
+    specEntries[1].size = sizeof(VkBool32);
+
+    VkSpecializationInfo specInfo{};
+    specInfo.mapEntryCount = specEntries.size();
+    specInfo.pMapEntries = specEntries.data();
+    specInfo.dataSize = sizeof(specData);
+    specInfo.pData = &specData;
+    computeShaderCI.pSpecializationInfo = &specInfo;
 
     VkComputePipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
     pipelineInfo.layout = computePipelineLayout;
     pipelineInfo.stage = computeShaderCI;
-    vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline);
+
+    VkPipeline pipeline;
+    chk(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline), "vkCreateComputePipelines");
 
     vkDestroyShaderModule(device, computeShaderModule, nullptr);
+    return pipeline;
 }
 
 void Renderer::createFramebuffers() {
     framebuffers.resize(swapchainImages.size());
 
-    for (int i = 0; i < swapchainImages.size(); i++) {
+    for (size_t i = 0; i < swapchainImages.size(); i++) {
         VkFramebufferCreateInfo info{};
         info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         info.width = swapchainImageExtent.width;
@@ -752,10 +1174,87 @@ void Renderer::createCommandPool() {
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     poolInfo.queueFamilyIndex = graphicsAndComputeFamilyIndex;
     chk(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool), "vkCreateCommandPool");
+
+    // compute command buffers (and uploads to the particle buffers, which the compute family owns) come from here
+    poolInfo.queueFamilyIndex = computeFamilyIndex;
+    chk(vkCreateCommandPool(device, &poolInfo, nullptr, &computeCommandPool), "vkCreateCommandPool");
+}
+
+void Renderer::createTimestampQueryPool() {
+    VkPhysicalDeviceProperties devProps{};
+    vkGetPhysicalDeviceProperties(physDev, &devProps);
+
+    uint32_t qPropsCnt;
+    vkGetPhysicalDeviceQueueFamilyProperties(physDev, &qPropsCnt, nullptr);
+    std::vector<VkQueueFamilyProperties> qFamilyProps(qPropsCnt);
+    vkGetPhysicalDeviceQueueFamilyProperties(physDev, &qPropsCnt, qFamilyProps.data());
+
+    if (qFamilyProps[graphicsAndComputeFamilyIndex].timestampValidBits == 0 || qFamilyProps[computeFamilyIndex].timestampValidBits == 0) {
+        printf("[Info] | Timestamp queries not supported, GPU timings disabled\n");
+        return;
+    }
+    timestampPeriod = devProps.limits.timestampPeriod;
+
+    // per frame in flight : compute begin / end, graphics begin / end
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = MAX_FRAME_IN_FLIGHT * 4;
+    chk(vkCreateQueryPool(device, &poolInfo, nullptr, &timestampQueryPool), "vkCreateQueryPool");
+
+    timestampsWritten.resize(MAX_FRAME_IN_FLIGHT, false);
+    timedSubsteps.resize(MAX_FRAME_IN_FLIGHT, 1);
+    lastTimingReport = glfwGetTime();
+}
+
+void Renderer::collectTimestamps(uint32_t frame) {
+    if (timestampQueryPool == VK_NULL_HANDLE || !timestampsWritten[frame]) {
+        return;
+    }
+
+    uint64_t timestamps[4];
+    VkResult res = vkGetQueryPoolResults(device, timestampQueryPool, frame * 4, 4, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (res != VK_SUCCESS) {
+        return;
+    }
+
+    double toMs = timestampPeriod / 1000000.0;
+    double computeTime = (timestamps[1] - timestamps[0]) * toMs;
+    double graphicsTime = (timestamps[3] - timestamps[2]) * toMs;
+    double span = (std::max(timestamps[1], timestamps[3]) - std::min(timestamps[0], timestamps[2])) * toMs;
+
+    stats.gpuComputeNs.store(computeTime * 1e6, std::memory_order_relaxed);
+    stats.gpuGraphicsNs.store(graphicsTime * 1e6, std::memory_order_relaxed);
+    stats.gpuSpanNs.store(span * 1e6, std::memory_order_relaxed);
+    stats.physicsStepNs.store(timedSubsteps[frame] > 0 ? computeTime * 1e6 / timedSubsteps[frame] : 0.0, std::memory_order_relaxed);
+
+    gpuComputeTime += computeTime;
+    gpuGraphicsTime += graphicsTime;
+    gpuFrameSpan += span;
+    gpuTimedFrames++;
+
+    double now = glfwGetTime();
+    if (now - lastTimingReport >= 1.0) {
+        double n = gpuTimedFrames;
+        // overlap : how much of compute + graphics ran at the same time
+        double overlap = std::max(0.0, (gpuComputeTime + gpuGraphicsTime - gpuFrameSpan) / n);
+        printf("[Info] | async compute : %s | compute %.3f ms, graphics %.3f ms, span %.3f ms, overlap %.3f ms | %.1f frames/s, %.1f steps/s\n",
+               computeFamilyIndex != graphicsAndComputeFamilyIndex ? "on" : "off",
+               gpuComputeTime / n, gpuGraphicsTime / n, gpuFrameSpan / n, overlap, n / (now - lastTimingReport),
+               simulationStepsSinceReport / (now - lastTimingReport));
+
+        gpuComputeTime = 0.0;
+        gpuGraphicsTime = 0.0;
+        gpuFrameSpan = 0.0;
+        gpuTimedFrames = 0;
+        simulationStepsSinceReport = 0;
+        lastTimingReport = now;
+    }
 }
 
 void Renderer::createCommandBuffers() {
-    commandBuffers.resize(MAX_FRAME_IN_FLIGHT);
+    commandBuffers.resize(MAX_FRAME_IN_FLIGHT * swapchainImages.size() * GRAPHICS_DRAW_VARIANTS);
+    commandBufferRecorded.assign(commandBuffers.size(), false);
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -767,13 +1266,14 @@ void Renderer::createCommandBuffers() {
 }
 
 void Renderer::createComputeCommandBuffers() {
-    computeCommandBuffers.resize(MAX_FRAME_IN_FLIGHT);
+    computeCommandBuffers.resize(MAX_FRAME_IN_FLIGHT * PARTICLE_BUFFER_COUNT * COMPUTE_SUBSTEP_VARIANTS);
+    computeRecordKeys.assign(computeCommandBuffers.size(), 0);
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = computeCommandBuffers.size();
-    allocInfo.commandPool = commandPool;
+    allocInfo.commandPool = computeCommandPool;
 
     chk(vkAllocateCommandBuffers(device, &allocInfo, computeCommandBuffers.data()), "vkAllocateCommandBuffers");
 }
@@ -782,90 +1282,271 @@ void Renderer::createSyncObjects() {
 
     imageAvailableSemaphores.resize(MAX_FRAME_IN_FLIGHT);
     renderFinishedSemaphores.resize(swapchainImages.size());
-    inFlightFences.resize(MAX_FRAME_IN_FLIGHT);
-    computeFinishedSemaphores.resize(MAX_FRAME_IN_FLIGHT);
-    computeInFlightFences.resize(MAX_FRAME_IN_FLIGHT);
 
     VkSemaphoreCreateInfo semaInfo{};
     semaInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    semaInfo.flags = VK_SEMAPHORE_TYPE_BINARY;
-
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
+    // swapchain acquire / present only take binary semaphores
     for (int i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
-        vkCreateSemaphore(device, &semaInfo, nullptr, &imageAvailableSemaphores[i]);
-        vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]);
-
-        vkCreateSemaphore(device, &semaInfo, nullptr, &computeFinishedSemaphores[i]);
-        vkCreateFence(device, &fenceInfo, nullptr, &computeInFlightFences[i]);
-    } 
-    for (int i = 0; i < swapchainImages.size(); i++) {
+        chk(vkCreateSemaphore(device, &semaInfo, nullptr, &imageAvailableSemaphores[i]), "vkCreateSemaphore");
+    }
+    for (size_t i = 0; i < swapchainImages.size(); i++) {
         chk(vkCreateSemaphore(device, &semaInfo, nullptr, &renderFinishedSemaphores[i]), "vkCreateSemaphore");
     }
+
+    // one counter per queue : frame k signals k + 1
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+    semaInfo.pNext = &typeInfo;
+    chk(vkCreateSemaphore(device, &semaInfo, nullptr, &computeTimeline), "vkCreateSemaphore");
+    chk(vkCreateSemaphore(device, &semaInfo, nullptr, &graphicsTimeline), "vkCreateSemaphore");
+}
+
+// What a compute command buffer was recorded for, 0 : not recorded yet. The substep count picks the buffer
+uint32_t Renderer::computeRecordKey(bool snapshot, bool acquire) {
+    return 1u | (snapshot ? 1u << 1 : 0) | (acquire ? 1u << 2 : 0);
+}
+
+// Command buffer recordings per second, printed when the rate changes. Stays at 0 while nothing changes
+void Renderer::reportCommandBufferRecords() {
+    double now = glfwGetTime();
+    if (now - lastRecordReport < 1.0) {
+        return;
+    }
+
+    uint32_t rate = static_cast<uint32_t>(commandBufferRecords / (now - lastRecordReport) + 0.5);
+    if (rate != lastRecordRate) {
+        printf("[Info] | command buffer records : %u/s\n", rate);
+        lastRecordRate = rate;
+    }
+    commandBufferRecords = 0;
+    lastRecordReport = now;
 }
 
-void Renderer::recordCommandbuffer(VkCommandBuffer &commandBuffer, uint32_t imageIndex) {
+// Recorded once per (frame in flight, swapchain image, drawn slot) and resubmitted, nothing in here changes per frame.
+// The ring bookkeeping is done by drawFrame
+void Renderer::recordCommandbuffer(VkCommandBuffer &commandBuffer, uint32_t imageIndex, uint32_t drawSlot, bool drawParticles) {
 
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-    VkClearValue clearColor = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, timestampQueryPool, currentFrame * 4 + 2, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, currentFrame * 4 + 2);
+    }
 
-    VkRenderPassBeginInfo renderBeginInfo{};
-    renderBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderBeginInfo.renderPass = renderpass;
-    renderBeginInfo.renderArea = {.offset = {0, 0}, .extent = swapchainImageExtent};
-    renderBeginInfo.framebuffer = framebuffers[imageIndex];
-    renderBeginInfo.clearValueCount = 1;
-    renderBeginInfo.pClearValues = &clearColor;
-    vkCmdBeginRenderPass(commandBuffer, &renderBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    FrameGraph graph(device, graphicsAndComputeFamilyIndex, cmdPipelineBarrier2);
+
+    // released by compute, the semaphore wait made its writes visible. handed back once drawn
+    std::vector<FrameGraphUse> uses;
+    VkBuffer particles = VK_NULL_HANDLE;
+    VkBuffer counter = VK_NULL_HANDLE;
+    if (drawParticles) {
+        FrameGraphState released{VK_PIPELINE_STAGE_2_NONE_KHR, VK_ACCESS_2_NONE_KHR, computeFamilyIndex};
+        uint32_t particleResource = graph.importBuffer(shaderStorageBuffers[drawSlot], released);
+        uint32_t counterResource = graph.importBuffer(particleCounterBuffers[drawSlot], released);
+        graph.exportBuffer(particleResource, computeFamilyIndex);
+        graph.exportBuffer(counterResource, computeFamilyIndex);
+
+        uses = {{counterResource, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR, false},
+                {particleResource, VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT_KHR, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT_KHR, false}};
+        particles = shaderStorageBuffers[drawSlot];
+        counter = particleCounterBuffers[drawSlot];
+    }
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    graph.addPass(uses, [this, imageIndex, particles, counter](VkCommandBuffer commandBuffer) {
+        VkClearValue clearColor = {{0.0f, 0.0f, 0.0f, 1.0f}};
+
+        VkRenderPassBeginInfo renderBeginInfo{};
+        renderBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderBeginInfo.renderPass = renderpass;
+        renderBeginInfo.renderArea = {.offset = {0, 0}, .extent = swapchainImageExtent};
+        renderBeginInfo.framebuffer = framebuffers[imageIndex];
+        renderBeginInfo.clearValueCount = 1;
+        renderBeginInfo.pClearValues = &clearColor;
+        vkCmdBeginRenderPass(commandBuffer, &renderBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = swapchainImageExtent.width;
+        viewport.height = swapchainImageExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D scissor{};
+        scissor.extent = swapchainImageExtent;
+        scissor.offset = {0, 0};
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        if (particles != VK_NULL_HANDLE) {
+            // SSB를 vertex buffer처럼 bind
+            VkDeviceSize offsets[] = {0};
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &particles, offsets);
+
+            // live count is written by the compute pass, dead particles are never drawn
+            vkCmdDrawIndirect(commandBuffer, counter, offsetof(ParticleCounter, draw), 1, sizeof(VkDrawIndirectCommand));
+        }
 
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = swapchainImageExtent.width;
-    viewport.height = swapchainImageExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        // metrics overlay, host written before the submission
+        VkDeviceSize overlayOffset = OVERLAY_VERTEX_OFFSET;
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &overlayBuffers[currentFrame], &overlayOffset);
+        vkCmdDrawIndirect(commandBuffer, overlayBuffers[currentFrame], 0, 1, sizeof(VkDrawIndirectCommand));
 
-    VkRect2D scissor{};
-    scissor.extent = swapchainImageExtent;
-    scissor.offset = {0, 0};
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        vkCmdEndRenderPass(commandBuffer);
+    });
 
-    // SSB를 vertex buffer처럼 bind
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &shaderStorageBuffers[currentFrame], offsets);
+    graph.execute(commandBuffer);
 
-    vkCmdDraw(commandBuffer, PARTICLE_COUNT, 1, 0, 0);
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, currentFrame * 4 + 3);
+    }
 
-    vkCmdEndRenderPass(commandBuffer);
     vkEndCommandBuffer(commandBuffer);
 }
 
-void Renderer::recordComputeCommandbuffer(VkCommandBuffer &commandbuffer) {
-    
+// Recorded once per (frame in flight, particle slot, substep count) for snapshot and acquire, see computeRecordKey
+void Renderer::recordComputeCommandbuffer(VkCommandBuffer &commandbuffer, bool snapshot, bool acquire) {
+
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     vkBeginCommandBuffer(commandbuffer, &beginInfo);
-    
-    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-    vkCmdBindDescriptorSets(commandbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &computeDesciptorSets[currentFrame], 0, nullptr);
 
-    // 1개의 work group에 256 x 1 x 1의 invocation이 있으니, 그 work group이 PARTICLE_COUNT / 256개 있으면 모든 파티클을 계산 가능 (1개의 work group 내의 invocation은 동시에 계산하지만, work group 간의 순서는 알 수 없음(GPU 내부 스케쥴링))
-    // 마지막 3개의 인자는 얼마큼의 work group를 dispatch(호출) 할 지 결정
-    // As our particles array is linear, we leave the other two dimensions at one, resulting in a one-dimensional dispatch
-    vkCmdDispatch(commandbuffer, PARTICLE_COUNT / 256, 1, 1);
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandbuffer, timestampQueryPool, currentFrame * 4, 2);
+        vkCmdWriteTimestamp(commandbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, currentFrame * 4);
+    }
+
+    FrameGraph graph(device, computeFamilyIndex, cmdPipelineBarrier2);
+    buildComputeGraph(graph, std::max<uint32_t>(1, simulationSubsteps), snapshot, acquire);
+    graph.execute(commandbuffer);
+
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(commandbuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, currentFrame * 4 + 1);
+    }
 
     vkEndCommandBuffer(commandbuffer);
 }
 
+// Passes of the compute submission of the current particle slot. Also built once with every optional pass,
+// before anything is recorded, to place the substep scratch buffers (see createSubstepBuffers)
+void Renderer::buildComputeGraph(FrameGraph &graph, uint32_t substeps, bool snapshot, bool acquire) {
+    uint32_t prevSlot = (particleSlot + PARTICLE_BUFFER_COUNT - 1) % PARTICLE_BUFFER_COUNT;
+    uint32_t slotBuffer = particleBufferIndex(particleSlot);
+
+    // every slot was last written by a compute submission on this queue. the slot written this step was drawn
+    // by graphics(k-1), take it back. in place : the current slot is the previous one too, imported first
+    FrameGraphState written{VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR, computeFamilyIndex};
+    FrameGraphState drawn{written.stages, written.access, graphicsAndComputeFamilyIndex};
+    uint32_t particles = graph.importBuffer(shaderStorageBuffers[slotBuffer], acquire ? drawn : written);
+    uint32_t counter = graph.importBuffer(particleCounterBuffers[slotBuffer], acquire ? drawn : written);
+    uint32_t prevParticles = graph.importBuffer(shaderStorageBuffers[particleBufferIndex(prevSlot)], written);
+    uint32_t prevCounter = graph.importBuffer(particleCounterBuffers[particleBufferIndex(prevSlot)], written);
+
+    // in place : every substep reads and writes the single buffer
+    for (uint32_t step = 0; step < substeps && settings.inPlaceUpdate; step++) {
+        addSimulationStep(graph, computeDesciptorSets, particleSlot, particles, counter, particles, counter, step == substeps - 1);
+    }
+
+    // K substeps in one submission. input / output ping-pong between this frame's slot and the scratch slot,
+    // arranged so that the last substep writes this frame's slot (first substep reads the previous slot)
+    uint32_t scratchParticles = 0;
+    uint32_t scratchCounter = 0;
+    if (substepParticleBuffer != VK_NULL_HANDLE) {
+        scratchParticles = graph.transientBuffer(substepParticleBuffer);
+        scratchCounter = graph.transientBuffer(substepCounterBuffer);
+    }
+    bool outputIsScratch = (substeps - 1) % 2 == 1;
+    for (uint32_t step = 0; step < substeps && !settings.inPlaceUpdate; step++) {
+        uint32_t setIndex;
+        uint32_t particlesIn, counterIn;
+        if (step == 0) {
+            setIndex = outputIsScratch ? particleSlot * 3 + 0 : particleSlot;
+            particlesIn = prevParticles;
+            counterIn = prevCounter;
+        } else {
+            setIndex = outputIsScratch ? particleSlot * 3 + 1 : particleSlot * 3 + 2;
+            particlesIn = outputIsScratch ? particles : scratchParticles;
+            counterIn = outputIsScratch ? counter : scratchCounter;
+        }
+        std::vector<VkDescriptorSet> &sets = step == 0 && !outputIsScratch ? computeDesciptorSets : substepDescriptorSets;
+
+        // new particles are spawned once per frame, after the last substep
+        addSimulationStep(graph, sets, setIndex, particlesIn, counterIn,
+                          outputIsScratch ? scratchParticles : particles, outputIsScratch ? scratchCounter : counter,
+                          step == substeps - 1);
+
+        outputIsScratch = !outputIsScratch;
+    }
+
+    if (snapshot) {
+        addSnapshotCopy(graph, particles, counter);
+    }
+    addStatsCopy(graph, counter);
+
+    // previous slot is not read by compute anymore -> graphics(k+1) draws it
+    // in place : the buffer just written goes straight to graphics(k)
+    graph.exportBuffer(settings.inPlaceUpdate ? particles : prevParticles, graphicsAndComputeFamilyIndex);
+    graph.exportBuffer(settings.inPlaceUpdate ? counter : prevCounter, graphicsAndComputeFamilyIndex);
+}
+
+// One simulation step : reset the output count, simulate + compact, optionally spawn, write indirect args.
+// The descriptor set is looked up when the pass is recorded, the placement graph is built before the sets exist
+void Renderer::addSimulationStep(FrameGraph &graph, std::vector<VkDescriptorSet> &sets, uint32_t setIndex, uint32_t particlesIn, uint32_t counterIn, uint32_t particlesOut, uint32_t counterOut, bool emit) {
+    const VkPipelineStageFlags2KHR compute = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    const VkAccessFlags2KHR read = VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR;
+    const VkAccessFlags2KHR readWrite = VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR;
+    VkBuffer counterInBuffer = graph.buffer(counterIn);
+    VkBuffer counterOutBuffer = graph.buffer(counterOut);
+
+    // reset live count of the output, simulate pass appends survivors with atomicAdd
+    // in place : nothing is compacted, the count only grows through the emitter ring
+    if (!settings.inPlaceUpdate) {
+        graph.addPass({{counterOut, VK_PIPELINE_STAGE_2_CLEAR_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, true}},
+                      [counterOutBuffer](VkCommandBuffer commandBuffer) {
+            vkCmdFillBuffer(commandBuffer, counterOutBuffer, offsetof(ParticleCounter, aliveCount), sizeof(uint32_t), 0);
+        });
+    }
+
+    // 1개의 work group에 256 x 1 x 1의 invocation이 있으니, 그 work group이 aliveCount / 256개 있으면 모든 파티클을 계산 가능 (1개의 work group 내의 invocation은 동시에 계산하지만, work group 간의 순서는 알 수 없음(GPU 내부 스케쥴링))
+    // work group 개수는 입력 버퍼를 쓴 indirect.comp가 살아있는 파티클 수로 기록해 둠
+    graph.addPass({{counterIn, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR, false},
+                   {counterIn, compute, read, false},
+                   {particlesIn, compute, read, false},
+                   {particlesOut, compute, readWrite, true},
+                   {counterOut, compute, readWrite, true}},
+                  [this, &sets, setIndex, counterInBuffer](VkCommandBuffer commandBuffer) {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &sets[setIndex], 0, nullptr);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+        vkCmdDispatchIndirect(commandBuffer, counterInBuffer, offsetof(ParticleCounter, dispatch));
+    });
+
+    // workgroups for this frame's spawn count, written by the host into the slot's uniform buffer next to spawnTotal.
+    // a frame without spawns dispatches nothing, and the recording does not depend on the spawn count
+    if (emit && !emitters.empty()) {
+        uint32_t slot = particleSlot;
+        graph.addPass({{particlesOut, compute, readWrite, true}, {counterOut, compute, readWrite, true}},
+                      [this, &sets, setIndex, slot](VkCommandBuffer commandBuffer) {
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &sets[setIndex], 0, nullptr);
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, emitPipeline);
+            vkCmdDispatchIndirect(commandBuffer, uniformBuffers[slot], offsetof(UniformBufferObject, emitDispatch));
+        });
+    }
+
+    graph.addPass({{counterOut, compute, readWrite, true}},
+                  [this, &sets, setIndex](VkCommandBuffer commandBuffer) {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &sets[setIndex], 0, nullptr);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, indirectArgsPipeline);
+        vkCmdDispatch(commandBuffer, 1, 1, 1);
+    });
+}
+
 uint32_t Renderer::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
     VkPhysicalDeviceMemoryProperties memProps;
     vkGetPhysicalDeviceMemoryProperties(physDev, &memProps);
@@ -879,7 +1560,7 @@ uint32_t Renderer::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags pro
     throw std::runtime_error("Failed to find suitable memory type!");
 }
 
-void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &bufferMemory) {
+void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &bufferMemory, MemoryPurpose purpose) {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
@@ -894,7 +1575,7 @@ void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, Vk
     mallocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     mallocInfo.allocationSize = size;
     mallocInfo.memoryTypeIndex = findMemoryType(memReqs.memoryTypeBits, properties);
-    vkAllocateMemory(device, &mallocInfo, nullptr, &bufferMemory);
+    chk(memoryTracker.allocate(mallocInfo, purpose, bufferMemory), "Failed to allocate buffer memory!");
 
     vkBindBufferMemory(device, buffer, bufferMemory, 0);
 }
@@ -903,7 +1584,7 @@ VkCommandBuffer Renderer::beginSingleTimeCommands() {
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
+    allocInfo.commandPool = computeCommandPool;
     allocInfo.commandBufferCount = 1;
 
     VkCommandBuffer cmdbuf;
@@ -924,10 +1605,10 @@ void Renderer::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
 
     vkDeviceWaitIdle(device);
-    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    vkFreeCommandBuffers(device, computeCommandPool, 1, &commandBuffer);
 }
 
 void Renderer::copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size) {
@@ -940,6 +1621,7 @@ void Renderer::copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size) {
     vkCmdCopyBuffer(cmdbuf, src, dst, 1, &region);
 
     endSingleTimeCommands(cmdbuf);
+    stats.uploadBytes.fetch_add(size, std::memory_order_relaxed); // staging uploads only
 }
 
 void Renderer::createVertexBuffer(std::vector<Vertex> &vertices) {
@@ -949,7 +1631,7 @@ void Renderer::createVertexBuffer(std::vector<Vertex> &vertices) {
     VkDeviceMemory stagingBufferMemory;
     createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                stagingBuffer, stagingBufferMemory);
+                stagingBuffer, stagingBufferMemory, MEMORY_STAGING);
     
     void *data;
     vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
@@ -958,12 +1640,12 @@ void Renderer::createVertexBuffer(std::vector<Vertex> &vertices) {
 
     createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                vertexBuffer, vertexBufferMemory);
+                vertexBuffer, vertexBufferMemory, MEMORY_MESH);
 
     copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
 
     vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    memoryTracker.free(stagingBufferMemory);
 }
 
 void Renderer::createIndexBuffer(std::vector<uint16_t> &indices) {
@@ -973,7 +1655,7 @@ void Renderer::createIndexBuffer(std::vector<uint16_t> &indices) {
     VkDeviceMemory stagingBufferMemory;
     createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                stagingBuffer, stagingBufferMemory);
+                stagingBuffer, stagingBufferMemory, MEMORY_STAGING);
     
     void *data;
     vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
@@ -982,100 +1664,522 @@ void Renderer::createIndexBuffer(std::vector<uint16_t> &indices) {
 
     createBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                indexBuffer, indexBufferMemory);
+                indexBuffer, indexBufferMemory, MEMORY_MESH);
 
     copyBuffer(stagingBuffer, indexBuffer, bufferSize);
 
     vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    memoryTracker.free(stagingBufferMemory);
 }
 
 void Renderer::createUniformBuffers() {
     VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-    uniformBuffers.resize(MAX_FRAME_IN_FLIGHT);
-    uniformBuffersMemory.resize(MAX_FRAME_IN_FLIGHT);
-    uniformBuffersMapped.resize(MAX_FRAME_IN_FLIGHT);
+    uniformBuffers.resize(PARTICLE_BUFFER_COUNT);
+    uniformBuffersMemory.resize(PARTICLE_BUFFER_COUNT);
+    uniformBuffersMapped.resize(PARTICLE_BUFFER_COUNT);
 
-    for (size_t i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
-        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+    for (size_t i = 0; i < PARTICLE_BUFFER_COUNT; i++) {
+        // also the emit pass' indirect dispatch arguments
+        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                    uniformBuffers[i], uniformBuffersMemory[i]);
+                    uniformBuffers[i], uniformBuffersMemory[i], MEMORY_UBO);
 
         vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
     }
 }
 
-void Renderer::updateUniformBuffer(uint32_t currentFrame) {
+void Renderer::updateUniformBuffer(uint32_t slot) {
     UniformBufferObject ubo{};
     ubo.dt = lastFrameTime * 2.0f;
 
-    memcpy(uniformBuffersMapped[currentFrame], &ubo, sizeof(ubo));
+    float frameDt = ubo.dt;
+    simulationSubsteps = 1;
+    if (settings.fixedTimestep) {
+        // number of fixed steps that fit into the accumulated real time. hitches are capped at MAX_SUBSTEPS
+        simulationTimeAccumulator = std::min(simulationTimeAccumulator + ubo.dt, FIXED_DT * MAX_SUBSTEPS);
+        simulationSubsteps = static_cast<uint32_t>(simulationTimeAccumulator / FIXED_DT);
+        simulationTimeAccumulator -= simulationSubsteps * FIXED_DT;
+        frameDt = simulationSubsteps * FIXED_DT;
+
+        // no step due this frame : one dt = 0 pass still carries the state into this frame's slot
+        ubo.dt = simulationSubsteps > 0 ? FIXED_DT : 0.0f;
+    }
+    simulationStepsSinceReport += settings.fixedTimestep ? simulationSubsteps : 1;
+    simulationStepCount += settings.fixedTimestep ? simulationSubsteps : 1;
+    simulationDt = ubo.dt;
+
+    ubo.seed = static_cast<uint32_t>(glfwGetTime() * 1000.0);
+    ubo.emitterCount = emitters.size();
+
+    // only the number of particles to spawn is decided here. positions / velocities are generated on the GPU
+    spawnTotal = 0;
+    for (uint32_t i = 0; i < emitters.size(); i++) {
+        emitterAccumulators[i] += emitters[i].rate * frameDt;
+        uint32_t spawnCount = static_cast<uint32_t>(emitterAccumulators[i]);
+        emitterAccumulators[i] -= spawnCount;
+        spawnCount += emitterBursts[i];
+        emitterBursts[i] = 0;
+
+        ubo.spawnOffsets[i] = spawnTotal;
+        ubo.emitters[i] = emitters[i];
+        spawnTotal += spawnCount;
+    }
+    spawnTotal = std::min<uint32_t>(spawnTotal, particleCapacity);
+
+    // in place : spawned particles overwrite the ring behind the initial particles, never more than one lap per step
+    if (settings.inPlaceUpdate) {
+        uint32_t ringSize = particleCapacity - initialParticleCount;
+        spawnTotal = std::min(spawnTotal, ringSize);
+        ubo.ringBegin = initialParticleCount;
+        ubo.ringCursor = spawnRingCursor;
+        spawnRingCursor = (spawnRingCursor + spawnTotal) % ringSize;
+    }
+    ubo.spawnTotal = spawnTotal;
+    ubo.emitDispatch = {(spawnTotal + 255) / 256, 1, 1};
+
+    memcpy(uniformBuffersMapped[slot], &ubo, sizeof(ubo));
+    stats.uploadBytes.fetch_add(sizeof(ubo), std::memory_order_relaxed);
+    stats.simulationSteps.store(simulationStepCount, std::memory_order_relaxed);
+}
+
+void Renderer::createOverlayBuffers() {
+    VkDeviceSize bufferSize = OVERLAY_VERTEX_OFFSET + OVERLAY_MAX_POINTS * sizeof(Particle);
+
+    overlayBuffers.resize(MAX_FRAME_IN_FLIGHT);
+    overlayBuffersMemory.resize(MAX_FRAME_IN_FLIGHT);
+    overlayBuffersMapped.resize(MAX_FRAME_IN_FLIGHT);
+    overlayUploadedVersions.assign(MAX_FRAME_IN_FLIGHT, 0);
+
+    for (size_t i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     overlayBuffers[i], overlayBuffersMemory[i], MEMORY_MESH);
+
+        vkMapMemory(device, overlayBuffersMemory[i], 0, bufferSize, 0, &overlayBuffersMapped[i]);
+    }
+    buildOverlay();
+}
+
+// One point per lit glyph pixel. A negative alpha is the point size to the vertex shader
+void Renderer::buildOverlay() {
+    overlayPoints.clear();
+    overlayVersion++;
+    if (!overlayEnabled) {
+        return;
+    }
+
+    const float size = OVERLAY_PIXEL_SIZE;
+    for (size_t line = 0; line < metrics.overlayLines().size(); line++) {
+        const std::string &text = metrics.overlayLines()[line];
+        for (size_t column = 0; column < text.size(); column++) {
+            uint16_t glyph = overlayGlyph(text[column]);
+            for (int bit = 0; bit < 15 && glyph != 0; bit++) {
+                if ((glyph & (1 << (14 - bit))) == 0 || overlayPoints.size() == OVERLAY_MAX_POINTS) {
+                    continue;
+                }
+
+                // 3x5 glyph in a 4x7 cell
+                float x = OVERLAY_MARGIN + (column * 4 + bit % 3) * size + size * 0.5f;
+                float y = OVERLAY_MARGIN + (line * 7 + bit / 3) * size + size * 0.5f;
+
+                Particle point{};
+                point.position = glm::vec2(x / swapchainImageExtent.width * 2.0f - 1.0f, y / swapchainImageExtent.height * 2.0f - 1.0f);
+                point.color = glm::vec4(0.9f, 0.9f, 0.9f, -size);
+                overlayPoints.push_back(point);
+            }
+        }
+    }
+}
+
+// the slot of frame (frame in flight) is retired, its copy of the text can be replaced
+void Renderer::uploadOverlay(uint32_t frame) {
+    if (overlayUploadedVersions[frame] == overlayVersion) {
+        return;
+    }
+
+    VkDrawIndirectCommand draw{};
+    draw.vertexCount = overlayPoints.size();
+    draw.instanceCount = 1;
+    uint8_t *mapped = static_cast<uint8_t*>(overlayBuffersMapped[frame]);
+    memcpy(mapped, &draw, sizeof(draw));
+    memcpy(mapped + OVERLAY_VERTEX_OFFSET, overlayPoints.data(), overlayPoints.size() * sizeof(Particle));
+    stats.uploadBytes.fetch_add(OVERLAY_VERTEX_OFFSET + overlayPoints.size() * sizeof(Particle), std::memory_order_relaxed);
+    overlayUploadedVersions[frame] = overlayVersion;
 }
 
 void Renderer::createShaderStorageBuffers() {
-    shaderStorageBuffers.resize(MAX_FRAME_IN_FLIGHT);
-    shaderStorageBuffersMemory.resize(MAX_FRAME_IN_FLIGHT);
+    // in place : a single copy of the particles instead of one per ring slot
+    uint32_t bufferCount = settings.inPlaceUpdate ? 1 : PARTICLE_BUFFER_COUNT;
+    shaderStorageBuffers.resize(bufferCount);
+    shaderStorageBuffersMemory.resize(bufferCount);
+    particleSlotReadyToDraw.resize(bufferCount, false);
+    particleSlotOnGraphics.resize(bufferCount, false);
+
+    // contents are written on the GPU by seedParticles (or copied from a snapshot by restoreParticles)
+    for (size_t i = 0; i < shaderStorageBuffers.size(); i++) {
+        createBuffer(sizeof(Particle) * particleCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    shaderStorageBuffers[i], shaderStorageBuffersMemory[i], MEMORY_SSBO);
+    }
+}
+
+void Renderer::createSubstepBuffers() {
+    // in place substeps need no scratch slot
+    if (!settings.fixedTimestep || settings.inPlaceUpdate) {
+        return;
+    }
+
+    // only ever touched by the compute queue, contents never outlive one submission : frame graph transients
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = sizeof(Particle) * particleCapacity;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    chk(vkCreateBuffer(device, &bufferInfo, nullptr, &substepParticleBuffer), "vkCreateBuffer");
+    bufferInfo.size = sizeof(ParticleCounter);
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    chk(vkCreateBuffer(device, &bufferInfo, nullptr, &substepCounterBuffer), "vkCreateBuffer");
+
+    // placed once against the largest graph (every optional pass, most substeps) : transients sharing memory
+    // there never live at the same time in a smaller one
+    FrameGraph graph(device, computeFamilyIndex, cmdPipelineBarrier2);
+    buildComputeGraph(graph, MAX_SUBSTEPS, true, true);
+
+    std::vector<VkDeviceSize> offsets;
+    uint32_t memoryTypeBits;
+    transientMemorySize = graph.placeTransients(offsets, memoryTypeBits);
+
+    VkMemoryAllocateInfo mallocInfo{};
+    mallocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    mallocInfo.allocationSize = transientMemorySize;
+    mallocInfo.memoryTypeIndex = findMemoryType(memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    chk(memoryTracker.allocate(mallocInfo, MEMORY_TRANSIENT, transientMemory), "vkAllocateMemory");
+    graph.bindTransients(transientMemory, offsets);
+
+    printf("[Info] | Frame graph transients : %zu buffer(s) in %.2f MiB\n", offsets.size(), transientMemorySize / (1024.0 * 1024.0));
+}
+
+void Renderer::createParticleCounterBuffers() {
+    particleCounterBuffers.resize(shaderStorageBuffers.size());
+    particleCounterBuffersMemory.resize(shaderStorageBuffers.size());
+
+    for (size_t i = 0; i < particleCounterBuffers.size(); i++) {
+        createBuffer(sizeof(ParticleCounter), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    particleCounterBuffers[i], particleCounterBuffersMemory[i], MEMORY_SSBO);
+    }
+
+    // live counts for the metrics, one per frame in flight (see addStatsCopy)
+    createBuffer(MAX_FRAME_IN_FLIGHT * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 statsReadbackBuffer, statsReadbackBufferMemory, MEMORY_READBACK);
+    vkMapMemory(device, statsReadbackBufferMemory, 0, MAX_FRAME_IN_FLIGHT * sizeof(uint32_t), 0, reinterpret_cast<void **>(&statsReadbackMapped));
+    memset(statsReadbackMapped, 0, MAX_FRAME_IN_FLIGHT * sizeof(uint32_t));
+}
+
+// Initial particles are generated by seed.comp straight into the device local SSBOs,
+// counters are written inline. One submission for every buffer.
+void Renderer::seedParticles() {
+    ParticleCounter counter{};
+    counter.dispatch = {(initialParticleCount + 255) / 256, 1, 1};
+    counter.draw = {initialParticleCount, 1, 0, 0};
+    counter.aliveCount = initialParticleCount;
+
+    SeedPushConstants pushConstants{};
+    pushConstants.seed = settings.seed;
+    pushConstants.count = initialParticleCount;
+    pushConstants.aspect = (float)DEFAULT_HEIGHT / DEFAULT_WIDTH;
+    pushConstants.speed = 0.00025f;
+
+    auto cmdbuf = beginSingleTimeCommands();
+
+    vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, seedPipeline);
+    vkCmdPushConstants(cmdbuf, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
 
-    std::default_random_engine rndEngine((unsigned)time(nullptr));
-    std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
+    // descriptor set i writes buffer i (binding 2)
+    for (uint32_t i = 0; i < shaderStorageBuffers.size(); i++) {
+        vkCmdUpdateBuffer(cmdbuf, particleCounterBuffers[i], 0, sizeof(counter), &counter);
 
-    std::vector<Particle> particles(PARTICLE_COUNT);
-    for (Particle &particle : particles) {
-        float r = 0.25f * sqrt(rndDist(rndEngine));
-        float theta = rndDist(rndEngine) * 2 * 3.14159265358979323846; // 0 ~ 2pi
-        float x = r * cos(theta) * DEFAULT_HEIGHT / DEFAULT_WIDTH;
-        float y = r * sin(theta);
-        particle.position = glm::vec2(x, y);
-        particle.velocity = glm::normalize(glm::vec2(x, y)) * 0.00025f;
-        particle.color = glm::vec4(rndDist(rndEngine), rndDist(rndEngine), rndDist(rndEngine), 1.0f);
+        vkCmdBindDescriptorSets(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &computeDesciptorSets[i], 0, nullptr);
+        vkCmdDispatch(cmdbuf, (initialParticleCount + 255) / 256, 1, 1);
     }
 
-    VkDeviceSize bufferSize = sizeof(Particle) * PARTICLE_COUNT;
+    endSingleTimeCommands(cmdbuf);
+
+    printf("[Info] | Seeded %u particles on the GPU, seed : %u\n", initialParticleCount, settings.seed);
+}
+
+// Initial particles come from a snapshot file. The mapped particle array is copied as is into
+// a staging buffer, then into every particle buffer.
+void Renderer::restoreParticles() {
+    MappedSnapshot snapshot(settings.restorePath, SNAPSHOT_KIND_PARTICLES, PARTICLE_LAYOUT_VERSION);
+
+    uint64_t count;
+    const void *particles = snapshot.array(PARTICLE_SNAPSHOT_PARTICLES, sizeof(Particle), count);
+    if (particles == nullptr || count == 0 || count > particleCapacity) {
+        throw std::runtime_error("Snapshot has no usable particle array!");
+    }
+    // in place : the spawn ring starts behind the restored particles, not behind the seeded ones
+    if (settings.inPlaceUpdate) {
+        if (count >= particleCapacity) {
+            throw std::runtime_error("Snapshot leaves no room for the in place spawn ring, raise --capacity!");
+        }
+        initialParticleCount = static_cast<uint32_t>(count);
+        spawnRingCursor = 0;
+    }
+
+    ParticleCounter counter{};
+    counter.dispatch = {static_cast<uint32_t>((count + 255) / 256), 1, 1};
+    counter.draw = {static_cast<uint32_t>(count), 1, 0, 0};
+    counter.aliveCount = count;
+
+    VkDeviceSize bufferSize = sizeof(Particle) * count;
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingBufferMemory;
     createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                stagingBuffer, stagingBufferMemory);
-    
+                stagingBuffer, stagingBufferMemory, MEMORY_STAGING);
+
     void *data;
     vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, particles.data(), (size_t)bufferSize);
+    memcpy(data, particles, (size_t)bufferSize);
     vkUnmapMemory(device, stagingBufferMemory);
 
-    for (int i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
-        createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                    shaderStorageBuffers[i], shaderStorageBuffersMemory[i]);
+    auto cmdbuf = beginSingleTimeCommands();
 
-        copyBuffer(stagingBuffer, shaderStorageBuffers[i], bufferSize);
+    VkBufferCopy region{};
+    region.size = bufferSize;
+    for (uint32_t i = 0; i < shaderStorageBuffers.size(); i++) {
+        vkCmdCopyBuffer(cmdbuf, stagingBuffer, shaderStorageBuffers[i], 1, &region);
+        vkCmdUpdateBuffer(cmdbuf, particleCounterBuffers[i], 0, sizeof(counter), &counter);
     }
 
+    endSingleTimeCommands(cmdbuf);
+
     vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    memoryTracker.free(stagingBufferMemory);
+
+    settings.seed = snapshot.header().seed;
+    simulationStepCount = snapshot.header().step;
+    printf("[Info] | Restored %llu particles from %s (step %llu, seed %u)\n",
+           (unsigned long long)count, settings.restorePath, (unsigned long long)simulationStepCount, settings.seed);
+}
+
+void Renderer::requestSnapshot() {
+    if (snapshotState != SNAPSHOT_IDLE) {
+        printf("[Info] | Snapshot already in progress\n");
+        return;
+    }
+
+    if (snapshotReadbackBuffer == VK_NULL_HANDLE) {
+        VkDeviceSize bufferSize = SNAPSHOT_PARTICLE_OFFSET + sizeof(Particle) * particleCapacity;
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    snapshotReadbackBuffer, snapshotReadbackBufferMemory, MEMORY_READBACK);
+        vkMapMemory(device, snapshotReadbackBufferMemory, 0, bufferSize, 0, &snapshotReadbackMapped);
+    }
+
+    // the next compute submission records the copy
+    snapshotState = SNAPSHOT_REQUESTED;
+}
+
+// Copies the slot compute just wrote into the readback buffer. Added before the slot is released to graphics.
+void Renderer::addSnapshotCopy(FrameGraph &graph, uint32_t particles, uint32_t counter) {
+    uint32_t readback = graph.importBuffer(snapshotReadbackBuffer, {});
+    VkBuffer particleBuffer = graph.buffer(particles);
+    VkBuffer counterBuffer = graph.buffer(counter);
+
+    // whole capacity : the live count is only known on the GPU
+    graph.addPass({{particles, VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR, false},
+                   {counter, VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR, false},
+                   {readback, VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, true}},
+                  [this, particleBuffer, counterBuffer](VkCommandBuffer commandBuffer) {
+        VkBufferCopy counterRegion{0, 0, sizeof(ParticleCounter)};
+        VkBufferCopy particleRegion{0, SNAPSHOT_PARTICLE_OFFSET, sizeof(Particle) * particleCapacity};
+        vkCmdCopyBuffer(commandBuffer, counterBuffer, snapshotReadbackBuffer, 1, &counterRegion);
+        vkCmdCopyBuffer(commandBuffer, particleBuffer, snapshotReadbackBuffer, 1, &particleRegion);
+    });
+
+    // read by the host once the frame's compute timeline value is reached, only the barrier is recorded
+    graph.addPass({{readback, VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_READ_BIT_KHR, false}},
+                  [](VkCommandBuffer) {});
+}
+
+// Live count of the step into this frame's word of the stats readback, read once the frame's timeline values are reached
+void Renderer::addStatsCopy(FrameGraph &graph, uint32_t counter) {
+    uint32_t readback = graph.importBuffer(statsReadbackBuffer, {});
+    VkBuffer counterBuffer = graph.buffer(counter);
+    VkDeviceSize offset = currentFrame * sizeof(uint32_t);
+
+    graph.addPass({{counter, VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR, false},
+                   {readback, VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, true}},
+                  [this, counterBuffer, offset](VkCommandBuffer commandBuffer) {
+        VkBufferCopy region{offsetof(ParticleCounter, aliveCount), offset, sizeof(uint32_t)};
+        vkCmdCopyBuffer(commandBuffer, counterBuffer, statsReadbackBuffer, 1, &region);
+    });
+    graph.addPass({{readback, VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_READ_BIT_KHR, false}},
+                  [](VkCommandBuffer) {});
+}
+
+// Called once the frame's timeline values are reached : the copy is done, hand the mapped data to the writer thread.
+void Renderer::collectSnapshot(uint32_t frame) {
+    if (snapshotState != SNAPSHOT_COPYING || snapshotFrame != frame) {
+        return;
+    }
+
+    if (snapshotWriter.joinable()) {
+        snapshotWriter.join(); // previous writer already set SNAPSHOT_IDLE, returns immediately
+    }
+
+    snapshotState = SNAPSHOT_WRITING;
+
+    SnapshotHeader header{};
+    header.kind = SNAPSHOT_KIND_PARTICLES;
+    header.layoutVersion = PARTICLE_LAYOUT_VERSION;
+    header.step = snapshotStep;
+    header.seed = settings.seed;
+    header.dt = snapshotDt;
+    const char *path = settings.snapshotPath;
+    const char *mapped = static_cast<const char *>(snapshotReadbackMapped);
+
+    snapshotWriter = std::thread([this, header, path, mapped]() {
+        ParticleCounter counter;
+        memcpy(&counter, mapped, sizeof(counter));
+        uint32_t count = std::min<uint32_t>(counter.aliveCount, particleCapacity);
+
+        try {
+            writeSnapshot(path, header, {{PARTICLE_SNAPSHOT_PARTICLES, sizeof(Particle), count, mapped + SNAPSHOT_PARTICLE_OFFSET}});
+        } catch (const std::exception &e) {
+            printf("[Error] | %s\n", e.what());
+        }
+        snapshotState = SNAPSHOT_IDLE;
+    });
+}
+
+// Device local bytes of the particle state, see createShaderStorageBuffers, createParticleCounterBuffers and
+// createSubstepBuffers. alignment padding is left to MEMORY_ADMISSION_FRACTION
+VkDeviceSize Renderer::particleMemoryRequirement(uint32_t capacity, bool inPlace) const {
+    VkDeviceSize slot = sizeof(Particle) * capacity + sizeof(ParticleCounter);
+    VkDeviceSize slots = inPlace ? 1 : PARTICLE_BUFFER_COUNT;
+    VkDeviceSize scratch = settings.fixedTimestep && !inPlace ? slot : 0;
+    return slots * slot + scratch;
+}
+
+// Runs before anything depending on the capacity or the update mode is created. When the particle state does not fit
+// into what is left of the device local budget : the single buffer in place layout, then half the capacity down to
+// MIN_PARTICLE_CAPACITY, instead of failing at VK_ERROR_OUT_OF_DEVICE_MEMORY
+void Renderer::admitParticleMemory() {
+    particleCapacity = settings.particleCapacity != 0 ? settings.particleCapacity : MAX_PARTICLE_COUNT;
+    uint32_t requestedCapacity = particleCapacity;
+    bool requestedInPlace = settings.inPlaceUpdate;
+
+    uint32_t heap = memoryTracker.deviceLocalHeap();
+    VkDeviceSize requested = particleMemoryRequirement(particleCapacity, settings.inPlaceUpdate);
+    // budget and usage are only as fresh as the last query : re-read them now that the swapchain images exist,
+    // the decision below must not run on the numbers of init or of the last once-per-second refresh
+    memoryTracker.refreshBudget();
+    VkDeviceSize available = memoryTracker.available(heap) * MEMORY_ADMISSION_FRACTION;
+
+    while (particleMemoryRequirement(particleCapacity, settings.inPlaceUpdate) > available) {
+        if (!settings.inPlaceUpdate) {
+            settings.inPlaceUpdate = true;
+        } else if (particleCapacity / 2 >= MIN_PARTICLE_CAPACITY) {
+            particleCapacity /= 2;
+        } else {
+            memoryTracker.report();
+            throw std::runtime_error("Not enough device memory for the particle buffers!");
+        }
+    }
+    // the in place spawn ring needs room behind the initial particles
+    initialParticleCount = std::min<uint32_t>(PARTICLE_COUNT, particleCapacity / 2);
+
+    if (particleCapacity != requestedCapacity || settings.inPlaceUpdate != requestedInPlace) {
+        double toMiB = 1.0 / (1024.0 * 1024.0);
+        printf("[Info] | Memory admission : %.2f MiB requested, %.2f MiB available on heap %u -> %s, %u particles max (requested %u)\n",
+               requested * toMiB, available * toMiB, heap, settings.inPlaceUpdate ? "in place" : "buffer ring", particleCapacity, requestedCapacity);
+    }
+}
+
+// Device memory held by the particle state, next to what the other update mode would take.
+void Renderer::reportParticleMemory() {
+    VkDeviceSize particleBytes = 0;
+    VkDeviceSize copyBytes = 0;
+    VkMemoryRequirements memReqs;
+
+    for (size_t i = 0; i < shaderStorageBuffers.size(); i++) {
+        vkGetBufferMemoryRequirements(device, shaderStorageBuffers[i], &memReqs);
+        copyBytes = memReqs.size;
+        particleBytes += memReqs.size;
+        vkGetBufferMemoryRequirements(device, particleCounterBuffers[i], &memReqs);
+        particleBytes += memReqs.size;
+    }
+    particleBytes += transientMemorySize;
+
+    double toMiB = 1.0 / (1024.0 * 1024.0);
+    printf("[Info] | Particle update : %s | %zu particle buffer(s) x %.2f MiB, %.2f MiB total\n",
+           settings.inPlaceUpdate ? "in place" : "buffer ring", shaderStorageBuffers.size(), copyBytes * toMiB, particleBytes * toMiB);
+    if (settings.inPlaceUpdate) {
+        printf("[Info] | Buffer ring would hold %d particle buffers (%.2f MiB saved)\n",
+               PARTICLE_BUFFER_COUNT, (PARTICLE_BUFFER_COUNT - 1) * copyBytes * toMiB);
+    }
+}
+
+uint32_t Renderer::particleBufferIndex(uint32_t slot) {
+    return slot % shaderStorageBuffers.size();
+}
+
+void Renderer::createEmitters() {
+    // fountain at the bottom of the window, shooting upward (vulkan NDC : +y is down)
+    Emitter fountain{};
+    fountain.position = glm::vec2(0.0f, 0.9f);
+    fountain.direction = glm::vec2(0.0f, -1.0f);
+    fountain.color = glm::vec4(0.3f, 0.6f, 1.0f, 1.0f);
+    fountain.spread = 0.3f;
+    fountain.speed = 0.0008f;
+    fountain.lifetime = 4000.0f;
+    fountain.rate = 0.05f;
+    emitters.push_back(fountain);
+
+    if (emitters.size() > MAX_EMITTERS) {
+        throw std::runtime_error("Too many emitters!");
+    }
+
+    emitterAccumulators.resize(emitters.size(), 0.0f);
+    emitterBursts.resize(emitters.size(), 0);
+}
+
+void Renderer::burst(uint32_t emitterIndex, uint32_t count) {
+    if (emitterIndex >= emitters.size()) {
+        throw std::runtime_error("Invalid emitter index!");
+    }
+    emitterBursts[emitterIndex] += count;
 }
 
 void Renderer::createDescriptorPool() {
+    // one set per slot, plus 3 substep sets per slot in fixed timestep mode
+    uint32_t setCount = substepParticleBuffer != VK_NULL_HANDLE ? PARTICLE_BUFFER_COUNT * 4 : PARTICLE_BUFFER_COUNT;
+
     std::array<VkDescriptorPoolSize, 2> poolSizes;
     // UBO in compute shader
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = MAX_FRAME_IN_FLIGHT;
+    poolSizes[0].descriptorCount = setCount;
 
-    // SSBO
+    // SSBO (particles in / out, counter prev / cur)
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    poolSizes[1].descriptorCount = MAX_FRAME_IN_FLIGHT * 2;
+    poolSizes[1].descriptorCount = setCount * 4;
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = poolSizes.size();
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = MAX_FRAME_IN_FLIGHT;
+    poolInfo.maxSets = setCount;
     vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
 }
 
 void Renderer::createDescriptorSetLayout() {
 
-    std::array<VkDescriptorSetLayoutBinding, 3> bindings;
+    std::array<VkDescriptorSetLayoutBinding, 5> bindings;
     bindings[0].binding = 0;
     bindings[0].descriptorCount = 1;
     bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -1094,6 +2198,19 @@ void Renderer::createDescriptorSetLayout() {
     bindings[2].pImmutableSamplers = nullptr;
     bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
+    // particle counter of previous / current frame
+    bindings[3].binding = 3;
+    bindings[3].descriptorCount = 1;
+    bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[3].pImmutableSamplers = nullptr;
+    bindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    bindings[4].binding = 4;
+    bindings[4].descriptorCount = 1;
+    bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[4].pImmutableSamplers = nullptr;
+    bindings[4].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
     VkDescriptorSetLayoutCreateInfo info{};
     info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     info.bindingCount = bindings.size();
@@ -1103,7 +2220,7 @@ void Renderer::createDescriptorSetLayout() {
 }
 
 void Renderer::createDescriptorSets() {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAME_IN_FLIGHT, computeDescriptorSetLayout);
+    std::vector<VkDescriptorSetLayout> layouts(PARTICLE_BUFFER_COUNT, computeDescriptorSetLayout);
 
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -1111,68 +2228,164 @@ void Renderer::createDescriptorSets() {
     allocInfo.descriptorSetCount = layouts.size();
     allocInfo.pSetLayouts = layouts.data();
 
-    computeDesciptorSets.resize(MAX_FRAME_IN_FLIGHT);
+    computeDesciptorSets.resize(PARTICLE_BUFFER_COUNT);
     vkAllocateDescriptorSets(device, &allocInfo, computeDesciptorSets.data());
 
-    for (size_t i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
+    // set i : reads slot i-1, writes slot i (in place : both are the single buffer, only the UBO differs)
+    for (size_t i = 0; i < PARTICLE_BUFFER_COUNT; i++) {
+        size_t prev = particleBufferIndex((i + PARTICLE_BUFFER_COUNT - 1) % PARTICLE_BUFFER_COUNT);
+        size_t cur = particleBufferIndex(i);
+        writeComputeDescriptorSet(computeDesciptorSets[i], uniformBuffers[i],
+                                  shaderStorageBuffers[prev], particleCounterBuffers[prev],
+                                  shaderStorageBuffers[cur], particleCounterBuffers[cur]);
+    }
 
-        VkDescriptorBufferInfo uboInfo{};
-        uboInfo.buffer = uniformBuffers[i];
-        uboInfo.offset = 0;
-        uboInfo.range = sizeof(UniformBufferObject);
+    if (substepParticleBuffer == VK_NULL_HANDLE) {
+        return;
+    }
 
-        VkDescriptorBufferInfo sbInfoPrevFrame{};
-        sbInfoPrevFrame.buffer = shaderStorageBuffers[(i - 1) % MAX_FRAME_IN_FLIGHT];
-        sbInfoPrevFrame.offset = 0;
-        sbInfoPrevFrame.range = sizeof(Particle) * PARTICLE_COUNT;
+    layouts.resize(PARTICLE_BUFFER_COUNT * 3, computeDescriptorSetLayout);
+    allocInfo.descriptorSetCount = layouts.size();
+    allocInfo.pSetLayouts = layouts.data();
+
+    substepDescriptorSets.resize(PARTICLE_BUFFER_COUNT * 3);
+    vkAllocateDescriptorSets(device, &allocInfo, substepDescriptorSets.data());
+
+    // per slot i : prev -> scratch, i -> scratch, scratch -> i
+    for (size_t i = 0; i < PARTICLE_BUFFER_COUNT; i++) {
+        size_t prev = (i + PARTICLE_BUFFER_COUNT - 1) % PARTICLE_BUFFER_COUNT;
+        writeComputeDescriptorSet(substepDescriptorSets[i * 3 + 0], uniformBuffers[i],
+                                  shaderStorageBuffers[prev], particleCounterBuffers[prev],
+                                  substepParticleBuffer, substepCounterBuffer);
+        writeComputeDescriptorSet(substepDescriptorSets[i * 3 + 1], uniformBuffers[i],
+                                  shaderStorageBuffers[i], particleCounterBuffers[i],
+                                  substepParticleBuffer, substepCounterBuffer);
+        writeComputeDescriptorSet(substepDescriptorSets[i * 3 + 2], uniformBuffers[i],
+                                  substepParticleBuffer, substepCounterBuffer,
+                                  shaderStorageBuffers[i], particleCounterBuffers[i]);
+    }
+}
+
+void Renderer::writeComputeDescriptorSet(VkDescriptorSet descriptorSet, VkBuffer uniformBuffer, VkBuffer particlesIn, VkBuffer counterIn, VkBuffer particlesOut, VkBuffer counterOut) {
+
+    VkDescriptorBufferInfo uboInfo{};
+    uboInfo.buffer = uniformBuffer;
+    uboInfo.offset = 0;
+    uboInfo.range = sizeof(UniformBufferObject);
+
+    VkDescriptorBufferInfo sbInfoIn{};
+    sbInfoIn.buffer = particlesIn;
+    sbInfoIn.offset = 0;
+    sbInfoIn.range = sizeof(Particle) * particleCapacity;
+
+    VkDescriptorBufferInfo sbInfoOut{};
+    sbInfoOut.buffer = particlesOut;
+    sbInfoOut.offset = 0;
+    sbInfoOut.range = sizeof(Particle) * particleCapacity;
+
+    VkDescriptorBufferInfo counterInfoIn{};
+    counterInfoIn.buffer = counterIn;
+    counterInfoIn.offset = 0;
+    counterInfoIn.range = sizeof(ParticleCounter);
+
+    VkDescriptorBufferInfo counterInfoOut{};
+    counterInfoOut.buffer = counterOut;
+    counterInfoOut.offset = 0;
+    counterInfoOut.range = sizeof(ParticleCounter);
+
+    std::array<VkDescriptorBufferInfo*, 5> infos = {&uboInfo, &sbInfoIn, &sbInfoOut, &counterInfoIn, &counterInfoOut};
+
+    std::array<VkWriteDescriptorSet, 5> descriptorWrites{};
+    for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+        descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[binding].descriptorCount = 1;
+        descriptorWrites[binding].dstSet = descriptorSet;
+        descriptorWrites[binding].dstBinding = binding;
+        descriptorWrites[binding].dstArrayElement = 0;
+        descriptorWrites[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[binding].pBufferInfo = infos[binding];
+    }
 
-        VkDescriptorBufferInfo sbInfoCurFrame{};
-        sbInfoCurFrame.buffer = shaderStorageBuffers[i];
-        sbInfoCurFrame.offset = 0;
-        sbInfoCurFrame.range = sizeof(Particle) * PARTICLE_COUNT;
+    vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+}
 
-        std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].dstSet = computeDesciptorSets[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].pBufferInfo = &uboInfo;
+// Destroyed once every frame submitted so far has retired (graphics timeline). Nothing submitted later uses it
+void Renderer::deferDeletion(std::function<void()> destroy) {
+    deletionQueue.push_back({frameNumber, std::move(destroy)});
+}
+
+void Renderer::collectDeletions() {
+    if (deletionQueue.empty() && retiredSwapchains.empty() && presentFences.empty()) {
+        return;
+    }
 
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].descriptorCount = 1;
-        descriptorWrites[1].dstSet = computeDesciptorSets[i];
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        descriptorWrites[1].pBufferInfo = &sbInfoPrevFrame;
+    uint64_t graphicsDone;
+    vkGetSemaphoreCounterValue(device, graphicsTimeline, &graphicsDone);
+    while (!deletionQueue.empty() && deletionQueue.front().frame <= graphicsDone) {
+        deletionQueue.front().destroy();
+        deletionQueue.pop_front();
+    }
 
-        descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[2].descriptorCount = 1;
-        descriptorWrites[2].dstSet = computeDesciptorSets[i];
-        descriptorWrites[2].dstBinding = 2;
-        descriptorWrites[2].dstArrayElement = 0;
-        descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        descriptorWrites[2].pBufferInfo = &sbInfoCurFrame;
+    // presents to the current swapchain that completed hand their fence back
+    for (size_t i = 0; i < presentFences.size();) {
+        if (vkGetFenceStatus(device, presentFences[i]) == VK_SUCCESS) {
+            vkResetFences(device, 1, &presentFences[i]);
+            freePresentFences.push_back(presentFences[i]);
+            presentFences[i] = presentFences.back();
+            presentFences.pop_back();
+        } else {
+            i++;
+        }
+    }
 
-        vkUpdateDescriptorSets(device, 3, descriptorWrites.data(), 0, nullptr);
+    while (!retiredSwapchains.empty()) {
+        RetiredSwapchain &retired = retiredSwapchains.front();
+        bool presented;
+        if (presentFencesEnabled) {
+            presented = std::all_of(retired.presentFences.begin(), retired.presentFences.end(), [this](VkFence fence) {
+                return vkGetFenceStatus(device, fence) == VK_SUCCESS;
+            });
+        } else {
+            presented = acquireCount >= retired.acquireCount;
+        }
+        if (!presented || retired.frame > graphicsDone) {
+            break;
+        }
+        destroyRetiredSwapchain(retired);
+        retiredSwapchains.pop_front();
     }
 }
 
-void Renderer::cleanupSwapchain() {
-  for (VkFramebuffer fb : framebuffers) {
-    vkDestroyFramebuffer(device, fb, nullptr);
-  }
+VkFence Renderer::takePresentFence() {
+    VkFence fence;
+    if (!freePresentFences.empty()) {
+        fence = freePresentFences.back();
+        freePresentFences.pop_back();
+        return fence;
+    }
 
-  for (VkImageView view : swapchainImageViews) {
-    vkDestroyImageView(device, view, nullptr);
-  }
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    chk(vkCreateFence(device, &fenceInfo, nullptr, &fence), "vkCreateFence");
+    return fence;
+}
 
-  vkDestroySwapchainKHR(device, swapchain, nullptr);
+// Its present fences go back to the pool
+void Renderer::destroyRetiredSwapchain(RetiredSwapchain &retired) {
+    for (VkSemaphore semaphore : retired.renderFinishedSemaphores) {
+        vkDestroySemaphore(device, semaphore, nullptr);
+    }
+    if (!retired.presentFences.empty()) {
+        vkResetFences(device, retired.presentFences.size(), retired.presentFences.data());
+        freePresentFences.insert(freePresentFences.end(), retired.presentFences.begin(), retired.presentFences.end());
+    }
+    vkDestroySwapchainKHR(device, retired.swapchain, nullptr);
 }
 
-void Renderer::recreateSwapchain(uint32_t imageIndex) {
+// No device wait : frames in flight keep rendering to and presenting from the old swapchain, which is passed as
+// oldSwapchain. its views, framebuffers and command buffers go once they retired, the swapchain and its render
+// finished semaphores once their presents are done (collectDeletions)
+void Renderer::recreateSwapchain() {
         int width=0, height=0;
         glfwGetFramebufferSize(window, &width, &height);
         while (width == 0 || height == 0) {
@@ -1182,27 +2395,47 @@ void Renderer::recreateSwapchain(uint32_t imageIndex) {
             glfwWaitEvents();
         }
 
-        vkDeviceWaitIdle(device);
-
-        cleanupSwapchain();
+        double start = glfwGetTime();
 
-        if (imageIndex != -1) {
-            vkDestroySemaphore(this->device, renderFinishedSemaphores[imageIndex], nullptr);
-            VkSemaphoreCreateInfo createInfo{
-                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-                .pNext = nullptr,
-                .flags = 0
-            };
-            vkCreateSemaphore(this->device, &createInfo, nullptr, &renderFinishedSemaphores[imageIndex]);
-        }
+        std::vector<VkImageView> oldImageViews = swapchainImageViews;
+        std::vector<VkFramebuffer> oldFramebuffers = framebuffers;
+        std::vector<VkCommandBuffer> oldCommandBuffers = commandBuffers;
+        deferDeletion([=, this]() {
+            vkFreeCommandBuffers(device, commandPool, oldCommandBuffers.size(), oldCommandBuffers.data());
+            for (VkFramebuffer framebuffer : oldFramebuffers) {
+                vkDestroyFramebuffer(device, framebuffer, nullptr);
+            }
+            for (VkImageView view : oldImageViews) {
+                vkDestroyImageView(device, view, nullptr);
+            }
+        });
+        // without present fences : once the newer swapchains acquired as many images as this one had
+        retiredSwapchains.push_back({swapchain, renderFinishedSemaphores, std::move(presentFences), acquireCount + swapchainImages.size(), frameNumber});
+        presentFences.clear();
 
         createSwapchain();
         createImageViews();
         createFramebuffers();
+
+        // per swapchain image, the image count may have changed
+        VkSemaphoreCreateInfo semaInfo{};
+        semaInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        renderFinishedSemaphores.resize(swapchainImages.size());
+        for (size_t i = 0; i < swapchainImages.size(); i++) {
+            chk(vkCreateSemaphore(device, &semaInfo, nullptr, &renderFinishedSemaphores[i]), "vkCreateSemaphore");
+        }
+
+        // the graphics command buffers point at the old framebuffers
+        createCommandBuffers();
+        // overlay points are placed in pixels
+        buildOverlay();
+
+        printf("[Info] | Swapchain recreated : %ux%u, %zu images, stall %.2f ms\n",
+               swapchainImageExtent.width, swapchainImageExtent.height, swapchainImages.size(), (glfwGetTime() - start) * 1000.0);
     }
 
 // _______________________________________________________________
-static void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
+static void framebufferSizeCallback(GLFWwindow* window, int /*width*/, int /*height*/) {
     auto app = reinterpret_cast<Renderer*> (glfwGetWindowUserPointer(window));
     app->framebufferResized = true;
 }
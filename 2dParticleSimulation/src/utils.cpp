@@ -53,7 +53,7 @@ const char *getDebugType(VkDebugUtilsMessageTypeFlagsEXT Type) {
 VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT Severity,
     VkDebugUtilsMessageTypeFlagsEXT Type,
-    const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData, void *userData) {
+    const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData, void * /*userData*/) {
 
     printf("[Info]\nDebug callback: %s\n", pCallbackData->pMessage);
     printf("Severity : %s\n", getDebugSeverityStr(Severity));
@@ -61,7 +61,7 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     printf("Objects : ");
 
     for (uint32_t i = 0; i < pCallbackData->objectCount; i++) {
-        printf("%llx ", pCallbackData->pObjects[i].objectHandle);
+        printf("%llx ", (unsigned long long)pCallbackData->pObjects[i].objectHandle);
     }
     printf("\n\n");
 
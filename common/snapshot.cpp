@@ -0,0 +1,148 @@
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool isLittleEndian() {
+    uint32_t value = 1;
+    uint8_t firstByte;
+    memcpy(&firstByte, &value, 1);
+    return firstByte == 1;
+}
+
+static uint64_t alignToPage(uint64_t offset) {
+    return (offset + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE * SNAPSHOT_PAGE_SIZE;
+}
+
+void writeSnapshot(const char *path, SnapshotHeader header, const std::vector<SnapshotArrayData> &arrays) {
+    // data is written in host byte order
+    if (!isLittleEndian()) {
+        throw std::runtime_error("Snapshots are only supported on little-endian hosts!");
+    }
+    if (arrays.size() > SNAPSHOT_MAX_ARRAYS) {
+        throw std::runtime_error("Too many snapshot arrays!");
+    }
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.arrayCount = arrays.size();
+
+    uint64_t offset = SNAPSHOT_PAGE_SIZE;
+    for (size_t i = 0; i < arrays.size(); i++) {
+        header.arrays[i] = {arrays[i].id, arrays[i].elementSize, arrays[i].count, offset};
+        offset = alignToPage(offset + arrays[i].count * arrays[i].elementSize);
+    }
+    uint64_t fileSize = offset;
+
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Failed to open snapshot file!");
+    }
+
+    // header page, then every array at its page aligned offset (gaps are zero filled)
+    std::vector<char> zeros(SNAPSHOT_PAGE_SIZE, 0);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(zeros.data(), SNAPSHOT_PAGE_SIZE - sizeof(header), 1, file) == 1;
+    for (size_t i = 0; i < arrays.size() && ok; i++) {
+        uint64_t bytes = arrays[i].count * arrays[i].elementSize;
+        if (bytes > 0) {
+            ok = fwrite(arrays[i].data, bytes, 1, file) == 1;
+        }
+        uint64_t padding = alignToPage(header.arrays[i].offset + bytes) - (header.arrays[i].offset + bytes);
+        if (padding > 0 && ok) {
+            ok = fwrite(zeros.data(), padding, 1, file) == 1;
+        }
+    }
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmpPath.c_str(), path) != 0) {
+        remove(tmpPath.c_str());
+        throw std::runtime_error("Failed to write snapshot file!");
+    }
+
+    printf("[Info] | Snapshot written : %s (%.2f MiB)\n", path, fileSize / (1024.0 * 1024.0));
+}
+
+MappedSnapshot::MappedSnapshot(const char *path, SnapshotKind kind, uint32_t layoutVersion) {
+    if (!isLittleEndian()) {
+        throw std::runtime_error("Snapshots are only supported on little-endian hosts!");
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open snapshot file!");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < SNAPSHOT_PAGE_SIZE) {
+        close(fd);
+        throw std::runtime_error("Invalid snapshot file!");
+    }
+    size = st.st_size;
+
+    mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (mapped == MAP_FAILED) {
+        mapped = nullptr;
+        throw std::runtime_error("Failed to map snapshot file!");
+    }
+
+    const SnapshotHeader &h = header();
+    const char *error = nullptr;
+    if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0) {
+        error = "Not a snapshot file!";
+    } else if (h.version != SNAPSHOT_VERSION) {
+        error = "Unsupported snapshot version!";
+    } else if (h.kind != kind) {
+        error = "Snapshot is from another simulation!";
+    } else if (h.layoutVersion != layoutVersion) {
+        error = "Snapshot layout version mismatch!";
+    } else if (h.arrayCount > SNAPSHOT_MAX_ARRAYS) {
+        error = "Invalid snapshot file!";
+    }
+    for (uint32_t i = 0; i < h.arrayCount && error == nullptr; i++) {
+        const SnapshotArray &a = h.arrays[i];
+        if (a.offset % SNAPSHOT_PAGE_SIZE != 0 || a.offset > size || a.count * a.elementSize > size - a.offset) {
+            error = "Snapshot file is truncated!";
+        }
+    }
+    if (error != nullptr) {
+        munmap(mapped, size);
+        mapped = nullptr;
+        throw std::runtime_error(error);
+    }
+}
+
+MappedSnapshot::~MappedSnapshot() {
+    if (mapped != nullptr) {
+        munmap(mapped, size);
+    }
+}
+
+const SnapshotHeader &MappedSnapshot::header() const {
+    return *static_cast<const SnapshotHeader *>(mapped);
+}
+
+const void *MappedSnapshot::array(uint32_t id, uint32_t elementSize, uint64_t &count) const {
+    const SnapshotHeader &h = header();
+    for (uint32_t i = 0; i < h.arrayCount; i++) {
+        if (h.arrays[i].id != id) {
+            continue;
+        }
+        if (h.arrays[i].elementSize != elementSize) {
+            throw std::runtime_error("Snapshot element size mismatch!");
+        }
+        count = h.arrays[i].count;
+        return static_cast<const char *>(mapped) + h.arrays[i].offset;
+    }
+    count = 0;
+    return nullptr;
+}
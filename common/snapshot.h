@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Binary snapshot file
+//
+//   [SnapshotHeader, zero padded to SNAPSHOT_PAGE_SIZE]
+//   [array 0, page aligned] [array 1, page aligned] ...
+//
+// All values are little-endian. Arrays are raw element data, so a mapped file can be copied
+// straight into a staging buffer (or CPU arrays) without parsing.
+// Shared by both simulators, each one defines its kind's arrays and layout version in its own snapshot.h
+#define SNAPSHOT_MAGIC "VKSNAP\0\0"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_PAGE_SIZE 4096
+#define SNAPSHOT_MAX_ARRAYS 8
+
+enum SnapshotKind : uint32_t {
+    SNAPSHOT_KIND_PARTICLES = 1,
+    SNAPSHOT_KIND_GRAVITY = 2,
+};
+
+struct SnapshotArray {
+    uint32_t id;
+    uint32_t elementSize;
+    uint64_t count;
+    uint64_t offset; // from the start of the file, multiple of SNAPSHOT_PAGE_SIZE
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t layoutVersion;
+    uint32_t arrayCount;
+    uint64_t step;
+    uint64_t seed;
+    double dt;
+    SnapshotArray arrays[SNAPSHOT_MAX_ARRAYS];
+};
+static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_PAGE_SIZE, "snapshot header must fit in one page");
+
+struct SnapshotArrayData {
+    uint32_t id;
+    uint32_t elementSize;
+    uint64_t count;
+    const void *data;
+};
+
+// Writes to <path>.tmp and renames it, a crash never leaves a half written snapshot behind.
+// header.kind / layoutVersion / step / seed / dt are taken from the caller, the rest is filled in.
+void writeSnapshot(const char *path, SnapshotHeader header, const std::vector<SnapshotArrayData> &arrays);
+
+// Read only mapping of a snapshot file. The header is validated on open.
+class MappedSnapshot {
+public:
+    MappedSnapshot(const char *path, SnapshotKind kind, uint32_t layoutVersion);
+    ~MappedSnapshot();
+    MappedSnapshot(const MappedSnapshot &) = delete;
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+    const SnapshotHeader &header() const;
+    // nullptr if the array is not in the file
+    const void *array(uint32_t id, uint32_t elementSize, uint64_t &count) const;
+
+private:
+    void *mapped = nullptr;
+    size_t size = 0;
+};